@@ -1,5 +1,500 @@
 #include "rbtree.h"
 
-int main(int argc, char *argv[]) {
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
-}
\ No newline at end of file
+// rbtree 벤치마크.
+// 키 분포(seq/random/zipf) x 연산 비율(read/write/mixed) x 트리 크기마다 한 번씩 실행하고
+// ns/op, 처리량, 지연 시간 백분위수, 최대 RSS, 노드당 바이트를 CSV나 JSON으로 출력한다.
+// 최대 RSS는 설정마다 따로 재도록 각 실행을 자식 프로세스에서 돌린다.
+//
+//   rbtree-bench [--workloads=seq,random,zipf] [--mixes=read,write,mixed]
+//                [--sizes=1e3,1e4,1e5,1e6] [--ops=N] [--sample=N] [--seed=N]
+//                [--format=csv|json]
+//
+// 연산 비율은 find:insert:erase로 read 90:5:5, write 10:45:45, mixed 50:25:25이다.
+// 키는 트리 크기의 두 배인 슬롯 고리에서 고르고 처음에는 그 절반을 채운다. 세 연산 모두 키 분포로 슬롯을
+// 고른다(seq는 연산 종류마다 앞으로 나아가는 커서, random은 균등, zipf는 순위). 삽입은 고른 슬롯부터 빈 슬롯을,
+// 찾기와 삭제는 찬 슬롯을 앞으로 찾아 쓰므로 삽입과 삭제의 비율이 같으면 트리 크기는 거의 일정하게 유지된다.
+
+typedef enum { DIST_SEQ, DIST_RANDOM, DIST_ZIPF } dist_t;
+
+typedef struct {
+  const char *name;
+  int find, insert, erase; // 백분율
+} mix_t;
+
+static const char *dist_names[] = {"seq", "random", "zipf"};
+
+static const mix_t mixes[] = {
+    {"read", 90, 5, 5},
+    {"write", 10, 45, 45},
+    {"mixed", 50, 25, 25},
+};
+
+#define MAX_RUNS 16
+
+// 2의 거듭제곱 구간마다 32칸으로 나눈 지연 시간 히스토그램(오차 약 3%)
+#define HIST_SUB 32
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+typedef struct {
+  uint64_t counts[HIST_BUCKETS];
+  uint64_t total;
+} histogram;
+
+static int hist_bucket(uint64_t ns)
+{
+  if (ns < HIST_SUB) {
+    return (int)ns;
+  }
+  int exp = 63 - __builtin_clzll(ns);
+  int sub = (int)((ns >> (exp - 5)) & (HIST_SUB - 1));
+  return (exp - 4) * HIST_SUB + sub;
+}
+
+static uint64_t hist_value(int bucket)
+{
+  if (bucket < HIST_SUB) {
+    return (uint64_t)bucket;
+  }
+  int exp = bucket / HIST_SUB + 4;
+  int sub = bucket % HIST_SUB;
+  return ((uint64_t)(HIST_SUB + sub)) << (exp - 5);
+}
+
+static uint64_t hist_percentile(const histogram *h, double p)
+{
+  uint64_t rank = (uint64_t)ceil(p * (double)h->total);
+  uint64_t seen = 0;
+  for (int b = 0; b < HIST_BUCKETS; b++) {
+    seen += h->counts[b];
+    if (seen >= rank && h->counts[b] > 0) {
+      return hist_value(b);
+    }
+  }
+  return 0;
+}
+
+static inline uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// xorshift64* 난수
+static inline uint64_t next_rand(uint64_t *state)
+{
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 0x2545F4914F6CDD1Dull;
+}
+
+// i번 슬롯의 키. seq는 그대로, random/zipf는 섞어서 트리 모양이 슬롯 순서에 묶이지 않게 한다.
+static inline key_t key_of(dist_t dist, uint64_t i)
+{
+  if (dist == DIST_SEQ) {
+    return (key_t)(i + RBTREE_KEY_MIN / 2);
+  }
+  uint32_t x = (uint32_t)i * 0x9E3779B1u; // 2^32에서 일대일 대응
+  x ^= x >> 16;
+  x *= 0x85EBCA6Bu;
+  x ^= x >> 13;
+  return (key_t)x;
+}
+
+// YCSB 방식의 Zipf 분포(theta = 0.99) 순위 생성기
+typedef struct {
+  uint64_t n;
+  double theta, alpha, zetan, eta;
+} zipf_gen;
+
+static void zipf_init(zipf_gen *z, uint64_t n, double theta)
+{
+  double zeta2 = 1.0 + pow(0.5, theta);
+  z->n = n;
+  z->theta = theta;
+  z->zetan = 0;
+  for (uint64_t i = 1; i <= n; i++) {
+    z->zetan += 1.0 / pow((double)i, theta);
+  }
+  z->alpha = 1.0 / (1.0 - theta);
+  z->eta = (1.0 - pow(2.0 / (double)n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+static uint64_t zipf_next(const zipf_gen *z, uint64_t *state)
+{
+  double u = (double)(next_rand(state) >> 11) / 9007199254740992.0;
+  double uz = u * z->zetan;
+  if (uz < 1.0) {
+    return 0;
+  }
+  if (uz < 1.0 + pow(0.5, z->theta)) {
+    return 1;
+  }
+  uint64_t r = (uint64_t)((double)z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+  return r < z->n ? r : z->n - 1;
+}
+
+// 현재 힙 사용량(바이트). glibc가 아니면 RSS로 대신하고, /proc도 없으면 0.
+static size_t heap_in_use(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  struct mallinfo2 mi = mallinfo2();
+  return mi.uordblks + mi.hblkhd;
+#else
+  long pages = 0, resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (!f) {
+    return 0;
+  }
+  if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+    resident = 0;
+  }
+  fclose(f);
+  return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+typedef struct {
+  dist_t dist;
+  const mix_t *mix;
+  size_t size, ops;
+  double ns_per_op, ops_per_sec, bytes_per_node;
+  uint64_t p50, p99, p999;
+  size_t peak_rss_kb;
+} result_t;
+
+// 슬롯마다 키가 트리에 있는지 나타내는 비트 배열
+typedef struct {
+  uint64_t *bits;
+  uint64_t slots, used;
+} slot_set;
+
+static inline int slot_used(const slot_set *s, uint64_t i) { return (int)((s->bits[i / 64] >> (i % 64)) & 1); }
+static inline void slot_flip(slot_set *s, uint64_t i) { s->bits[i / 64] ^= 1ull << (i % 64); }
+
+// from부터 앞으로(끝에서는 처음으로) 돌며 사용 여부가 used인 첫 슬롯. 그런 슬롯이 있어야 한다.
+static uint64_t slot_probe(const slot_set *s, uint64_t from, int used)
+{
+  while (slot_used(s, from) != used) {
+    from = from + 1 == s->slots ? 0 : from + 1;
+  }
+  return from;
+}
+
+// 분포에 따라 슬롯을 고른다. seq는 연산 종류마다 따로 두는 커서를 한 칸씩 옮긴다.
+static uint64_t pick_slot(const result_t *r, const zipf_gen *zipf, uint64_t *state, uint64_t *cursor, uint64_t slots)
+{
+  switch (r->dist) {
+  case DIST_SEQ: {
+    uint64_t slot = *cursor;
+    *cursor = slot + 1 == slots ? 0 : slot + 1;
+    return slot;
+  }
+  case DIST_RANDOM:
+    return next_rand(state) % slots;
+  case DIST_ZIPF:
+    return zipf_next(zipf, state);
+  }
+  return 0;
+}
+
+static int run(result_t *r, uint64_t seed, size_t sample)
+{
+  histogram *hist = calloc(1, sizeof(histogram));
+  slot_set live = {NULL, (uint64_t)r->size * 2, 0};
+  live.bits = calloc((live.slots + 63) / 64, sizeof(uint64_t));
+  if (!hist || !live.bits) {
+    free(hist);
+    free(live.bits);
+    return -1;
+  }
+  uint64_t state = seed | 1;
+  zipf_gen zipf = {0};
+  if (r->dist == DIST_ZIPF) {
+    zipf_init(&zipf, live.slots, 0.99);
+  }
+
+  size_t before = heap_in_use();
+  rbtree *t = new_rbtree();
+  if (!t) {
+    free(live.bits);
+    free(hist);
+    return -1;
+  }
+  // seq는 앞쪽 절반을 이어서 채우고, 나머지는 빈 슬롯을 오래 건너뛰지 않도록 한 칸씩 걸러 채운다.
+  for (uint64_t i = 0; i < r->size; i++) {
+    uint64_t slot = r->dist == DIST_SEQ ? i : 2 * i;
+    if (!rbtree_insert(t, key_of(r->dist, slot))) {
+      delete_rbtree(t);
+      free(live.bits);
+      free(hist);
+      return -1;
+    }
+    slot_flip(&live, slot);
+  }
+  live.used = r->size;
+  size_t after = heap_in_use();
+  r->bytes_per_node = r->size > 0 ? (double)(after > before ? after - before : 0) / (double)r->size : 0;
+
+  // seq의 커서. 살아 있는 키는 erase_cursor부터 이어진 구간이고, 찾기는 그 구간을 차례로 돈다.
+  uint64_t find_cursor = 0, erase_cursor = 0, insert_cursor = r->size;
+  int failed = 0;
+  uint64_t start = now_ns();
+  for (size_t i = 0; i < r->ops && !failed; i++) {
+    int roll = (int)(next_rand(&state) % 100);
+    int timed = i % sample == 0;
+    uint64_t t0 = 0;
+
+    if (roll < r->mix->find) {
+      uint64_t slot = r->dist == DIST_SEQ && live.used > 0 ? (erase_cursor + find_cursor++ % live.used) % live.slots
+                                                             : pick_slot(r, &zipf, &state, &find_cursor, live.slots);
+      key_t key = key_of(r->dist, live.used > 0 ? slot_probe(&live, slot, 1) : slot);
+      t0 = timed ? now_ns() : 0;
+      volatile node_t *found = rbtree_find(t, key);
+      (void)found;
+    } else if ((roll < r->mix->find + r->mix->insert || live.used == 0) && live.used < live.slots) {
+      uint64_t slot = slot_probe(&live, pick_slot(r, &zipf, &state, &insert_cursor, live.slots), 0);
+      t0 = timed ? now_ns() : 0;
+      failed = rbtree_insert(t, key_of(r->dist, slot)) == NULL;
+      slot_flip(&live, slot);
+      live.used++;
+    } else {
+      uint64_t slot = slot_probe(&live, pick_slot(r, &zipf, &state, &erase_cursor, live.slots), 1);
+      key_t key = key_of(r->dist, slot);
+      t0 = timed ? now_ns() : 0;
+      rbtree_erase(t, rbtree_find(t, key));
+      slot_flip(&live, slot);
+      live.used--;
+    }
+
+    if (timed) {
+      uint64_t ns = now_ns() - t0;
+      hist->counts[hist_bucket(ns)]++;
+      hist->total++;
+    }
+  }
+  uint64_t elapsed = now_ns() - start;
+
+  r->ns_per_op = r->ops > 0 ? (double)elapsed / (double)r->ops : 0;
+  r->ops_per_sec = elapsed > 0 ? (double)r->ops * 1e9 / (double)elapsed : 0;
+  r->p50 = hist_percentile(hist, 0.50);
+  r->p99 = hist_percentile(hist, 0.99);
+  r->p999 = hist_percentile(hist, 0.999);
+
+  delete_rbtree(t);
+  free(live.bits);
+  free(hist);
+  return failed ? -1 : 0;
+}
+
+// ru_maxrss는 프로세스 전체의 최댓값이라 한 프로세스에서 연달아 재면 앞서 돈 큰 설정의 값이 뒤에도 남는다.
+// 그래서 설정마다 자식 프로세스에서 run을 돌리고, 결과는 파이프로, 최대 RSS는 wait4로 받는다.
+static int run_isolated(result_t *r, uint64_t seed, size_t sample)
+{
+  int fds[2];
+  if (pipe(fds) < 0) {
+    return -1;
+  }
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    int ok = run(r, seed, sample) == 0 && write(fds[1], r, sizeof(*r)) == (ssize_t)sizeof(*r);
+    _exit(ok ? 0 : 1);
+  }
+
+  close(fds[1]);
+  ssize_t got = read(fds[0], r, sizeof(*r)); // PIPE_BUF보다 작으므로 한 번에 온다.
+  close(fds[0]);
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+      got != (ssize_t)sizeof(*r)) {
+    return -1;
+  }
+  r->peak_rss_kb = (size_t)usage.ru_maxrss;
+  return 0;
+}
+
+static void print_result(const result_t *r, int json, int first)
+{
+  if (json) {
+    printf("%s  {\"workload\": \"%s\", \"mix\": \"%s\", \"size\": %zu, \"ops\": %zu, "
+           "\"ns_per_op\": %.2f, \"ops_per_sec\": %.0f, \"p50_ns\": %llu, \"p99_ns\": %llu, "
+           "\"p999_ns\": %llu, \"peak_rss_kb\": %zu, \"bytes_per_node\": %.1f}",
+           first ? "" : ",\n", dist_names[r->dist], r->mix->name, r->size, r->ops, r->ns_per_op,
+           r->ops_per_sec, (unsigned long long)r->p50, (unsigned long long)r->p99,
+           (unsigned long long)r->p999, r->peak_rss_kb, r->bytes_per_node);
+  } else {
+    printf("%s,%s,%zu,%zu,%.2f,%.0f,%llu,%llu,%llu,%zu,%.1f\n", dist_names[r->dist], r->mix->name,
+           r->size, r->ops, r->ns_per_op, r->ops_per_sec, (unsigned long long)r->p50,
+           (unsigned long long)r->p99, (unsigned long long)r->p999, r->peak_rss_kb, r->bytes_per_node);
+  }
+  fflush(stdout);
+}
+
+// "a,b,c" 목록을 names에서 찾아 인덱스 배열로 바꾼다.
+static int parse_names(const char *list, const char *const *names, size_t n_names, int *out)
+{
+  int count = 0;
+  char *copy = strdup(list);
+  for (char *tok = strtok(copy, ","); tok && count < MAX_RUNS; tok = strtok(NULL, ",")) {
+    size_t i = 0;
+    while (i < n_names && strcmp(tok, names[i]) != 0) {
+      i++;
+    }
+    if (i == n_names) {
+      fprintf(stderr, "unknown name: %s\n", tok);
+      free(copy);
+      return -1;
+    }
+    out[count++] = (int)i;
+  }
+  free(copy);
+  return count;
+}
+
+// "50000"이나 "1e3" 같은 양의 정수. 숫자 뒤에 다른 문자가 있거나 0이거나 max보다 크면 -1.
+static int parse_count(const char *text, size_t max, size_t *out)
+{
+  char *end;
+  errno = 0;
+  unsigned long long value = strtoull(text, &end, 10);
+  if (end == text || !isdigit((unsigned char)text[0]) || errno != 0) {
+    return -1;
+  }
+  if (*end == 'e' || *end == 'E') {
+    const char *digits = end + 1;
+    unsigned long exp = strtoul(digits, &end, 10);
+    if (end == digits || !isdigit((unsigned char)digits[0]) || exp > 19) {
+      return -1;
+    }
+    for (; exp > 0; exp--) {
+      if (value > max / 10) {
+        return -1;
+      }
+      value *= 10;
+    }
+  }
+  if (*end != '\0' || value == 0 || value > max) {
+    return -1;
+  }
+  *out = (size_t)value;
+  return 0;
+}
+
+// "1e3,50000" 같은 크기 목록. 키 슬롯이 크기의 두 배이고 key_of가 32비트로 섞으므로 2^30개까지 받는다.
+static int parse_sizes(const char *list, size_t *out)
+{
+  int count = 0;
+  char *copy = strdup(list);
+  if (!copy) {
+    return -1;
+  }
+  for (char *tok = strtok(copy, ","); tok && count < MAX_RUNS; tok = strtok(NULL, ",")) {
+    if (parse_count(tok, (size_t)1 << 30, &out[count]) < 0) {
+      fprintf(stderr, "bad size: %s\n", tok);
+      free(copy);
+      return -1;
+    }
+    count++;
+  }
+  free(copy);
+  return count > 0 ? count : -1;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *mix_names[] = {"read", "write", "mixed"};
+  int dists[MAX_RUNS] = {DIST_SEQ, DIST_RANDOM, DIST_ZIPF}, n_dists = 3;
+  int mix_idx[MAX_RUNS] = {0, 1, 2}, n_mixes = 3;
+  size_t sizes[MAX_RUNS] = {1000, 10000, 100000, 1000000};
+  int n_sizes = 4;
+  size_t ops = 1000000, sample = 8;
+  uint64_t seed = 42;
+  int json = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (strncmp(arg, "--workloads=", 12) == 0) {
+      n_dists = parse_names(arg + 12, dist_names, 3, dists);
+    } else if (strncmp(arg, "--mixes=", 8) == 0) {
+      n_mixes = parse_names(arg + 8, mix_names, 3, mix_idx);
+    } else if (strncmp(arg, "--sizes=", 8) == 0) {
+      n_sizes = parse_sizes(arg + 8, sizes);
+    } else if (strncmp(arg, "--ops=", 6) == 0) {
+      if (parse_count(arg + 6, SIZE_MAX, &ops) < 0) {
+        fprintf(stderr, "bad op count: %s\n", arg + 6);
+        return 2;
+      }
+    } else if (strncmp(arg, "--sample=", 9) == 0) {
+      if (parse_count(arg + 9, SIZE_MAX, &sample) < 0) {
+        fprintf(stderr, "bad sample interval: %s\n", arg + 9);
+        return 2;
+      }
+    } else if (strncmp(arg, "--seed=", 7) == 0) {
+      seed = strtoull(arg + 7, NULL, 10);
+    } else if (strcmp(arg, "--format=json") == 0) {
+      json = 1;
+    } else if (strcmp(arg, "--format=csv") == 0) {
+      json = 0;
+    } else {
+      fprintf(stderr, "usage: %s [--workloads=seq,random,zipf] [--mixes=read,write,mixed] "
+                      "[--sizes=1e3,...,1e8] [--ops=N] [--sample=N] [--seed=N] [--format=csv|json]\n",
+              argv[0]);
+      return 2;
+    }
+  }
+  if (n_dists < 0 || n_mixes < 0 || n_sizes < 0) {
+    return 2;
+  }
+
+  if (json) {
+    printf("[\n");
+  } else {
+    printf("workload,mix,size,ops,ns_per_op,ops_per_sec,p50_ns,p99_ns,p999_ns,peak_rss_kb,bytes_per_node\n");
+  }
+
+  int first = 1;
+  for (int d = 0; d < n_dists; d++) {
+    for (int m = 0; m < n_mixes; m++) {
+      for (int s = 0; s < n_sizes; s++) {
+        result_t r = {.dist = (dist_t)dists[d], .mix = &mixes[mix_idx[m]], .size = sizes[s], .ops = ops};
+        if (run_isolated(&r, seed, sample) < 0) {
+          fprintf(stderr, "run failed: %s %s %zu\n", dist_names[r.dist], r.mix->name, r.size);
+          return 1;
+        }
+        print_result(&r, json, first);
+        first = 0;
+      }
+    }
+  }
+
+  if (json) {
+    printf("\n]\n");
+  }
+  return 0;
+}
@@ -1,247 +1,723 @@
 #include "rbtree.h"
+#include "rbtree_fixup.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 
-void print_malloc_failed() { printf("메모리 할당에 실패하였습니다.\n"); }
+// 청크 하나에 담기는 노드 수의 하한과 상한
+#define RBTREE_CHUNK_MIN 64
+#define RBTREE_CHUNK_MAX 65536
 
-rbtree *new_rbtree(void)
+// 노드 크기는 풀마다 다르므로(rbtree_topdown의 노드는 더 작다) 바이트 배열로 두고 node_size씩 잘라 쓴다.
+struct rbtree_chunk {
+  struct rbtree_chunk *next;
+  size_t capacity;
+  _Alignas(max_align_t) unsigned char nodes[];
+};
+
+// 청크를 소유하는 단위. split/join으로 노드가 트리 사이를 옮겨 다니므로 청크는 트리가 아니라
+// arena에 속하고, arena는 그것을 쓰는 트리가 모두 사라질 때 해제된다.
+// join으로 두 arena가 합쳐지면 한쪽이 청크를 모두 넘기고 forward로 다른 쪽을 가리킨다.
+struct rbtree_arena {
+  rbtree_allocator allocator;   // 청크와 arena 자신을 할당한 곳. 함께 쓰는 트리는 모두 같은 할당자를 쓴다.
+  size_t node_size;             // 함께 쓰는 풀의 노드 크기(모두 같다)
+  struct rbtree_chunk *chunks;
+  size_t refs;                  // 이 arena를 직접 가리키는 풀과 arena의 수
+  struct rbtree_arena *forward; // 청크를 넘겨받은 arena
+  void *map;                    // rbtree_open_mmap으로 매핑한 이미지
+  size_t map_len;
+};
+
+// arena의 청크 목록과 참조 수는 서로 다른 스레드의 트리가 함께 쓰므로 이 lock으로 보호한다.
+// 청크를 새로 만들 때와 트리를 만들고 없애거나 합칠 때만 잡는다.
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// 모든 트리가 함께 쓰는 sentinel. 읽기 전용 영역에 두어서 어떤 연산도 nil에 쓰지 않는다.
+// 덕분에 서로 다른 트리의 노드를 O(1)에 이어 붙일 수 있고, 여러 스레드가 같은 nil을 읽어도 안전하다.
+// mmap으로 연 트리만 이미지 안의 nil을 쓴다.
+#ifdef RBTREE_COMPACT
+static const node_t nil_node = {
+    .parent_color = RBTREE_BLACK,
+#else
+static const node_t nil_node = {
+    .color = RBTREE_BLACK,
+    .parent = (node_t *)&nil_node,
+#endif
+    .left = (node_t *)&nil_node,
+    .right = (node_t *)&nil_node,
+#ifdef RBTREE_INTERVAL
+    // 어떤 구간과도 겹치지 않도록 nil의 최대 끝점은 가장 작은 키로 둡니다.
+    .hi = RBTREE_KEY_MIN,
+    .max = RBTREE_KEY_MIN,
+#endif
+};
+
+#define NIL ((node_t *)&nil_node)
+
+#ifdef RBTREE_COMPACT
+static inline void set_parent(node_t *n, node_t *p)
 {
-  rbtree *t = (rbtree *)calloc(1, sizeof(rbtree));
+  n->parent_color = (uintptr_t)p | (n->parent_color & 1);
+}
 
-  if (!t) {
-    print_malloc_failed();
-    return NULL;
+static inline void set_color(node_t *n, color_t c)
+{
+  n->parent_color = (n->parent_color & ~(uintptr_t)1) | c;
+}
+
+static inline void set_parent_color(node_t *n, node_t *p, color_t c)
+{
+  n->parent_color = (uintptr_t)p | c;
+}
+#else
+static inline void set_parent(node_t *n, node_t *p) { n->parent = p; }
+static inline void set_color(node_t *n, color_t c) { n->color = c; }
+static inline void set_parent_color(node_t *n, node_t *p, color_t c)
+{
+  n->parent = p;
+  n->color = c;
+}
+#endif
+
+// 트리에 붙어 있는 노드의 자식 포인터와 루트를 바꾼다. lock 없이 읽는 쪽(rbtree_concurrent)이
+// 포인터를 찢어지지 않게 보고, 새 노드의 키와 자식도 먼저 보도록 release store로 쓴다.
+// x86에서는 일반 store와 같은 명령이다.
+static inline void set_link(node_t **link, node_t *node)
+{
+  __atomic_store_n(link, node, __ATOMIC_RELEASE);
+}
+
+#if defined(RBTREE_ORDER_STATS) || defined(RBTREE_INTERVAL)
+#define RBTREE_AUGMENTED
+#endif
+
+// 계측 카운터. RBTREE_STATS가 꺼져 있으면 아무 코드도 만들지 않는다.
+// 삽입과 삭제의 카운터는 트리를 고치는 쪽만 갱신하므로 그냥 더한다.
+#ifdef RBTREE_STATS
+#define STAT_ADD(t, field, n) ((t)->stats.field += (n))
+
+// 조회는 const 트리에서 여러 스레드가 함께 하므로(sharded의 공유 lock 아래 조회, concurrent의 lock-free 독자)
+// 조회 카운터는 트리 구조체 밖에 두고, 조회 하나가 끝날 때 지역 변수에 센 값을 relaxed atomic으로 한 번 더한다.
+struct rbtree_lookup_stats {
+  uint64_t find_compares;
+#ifdef RBTREE_STATS_LATENCY
+  uint64_t latency[RBTREE_STATS_BUCKETS];
+#endif
+};
+
+#define STAT_LOOKUP_DECL(v) uint64_t v = 0
+#define STAT_LOOKUP_COUNT(v) ((v)++)
+#define STAT_LOOKUP_ADD(t, field, v) __atomic_fetch_add(&(t)->lookup_stats->field, (v), __ATOMIC_RELAXED)
+#else
+#define STAT_ADD(t, field, n) ((void)0)
+#define STAT_LOOKUP_DECL(v) ((void)0)
+#define STAT_LOOKUP_COUNT(v) ((void)0)
+#define STAT_LOOKUP_ADD(t, field, v) ((void)0)
+#endif
+
+#ifdef RBTREE_STATS_LATENCY
+static inline uint64_t stat_clock(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// start부터 걸린 시간의 log2 버킷
+static inline int stat_bucket(uint64_t start)
+{
+  uint64_t ns = stat_clock() - start;
+  int bucket = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+  return bucket < RBTREE_STATS_BUCKETS ? bucket : RBTREE_STATS_BUCKETS - 1;
+}
+
+#define STAT_LATENCY_BEGIN() uint64_t stat_start = stat_clock()
+#define STAT_LATENCY_END(t, op) ((t)->stats.latency[(op)][stat_bucket(stat_start)]++)
+#define STAT_LOOKUP_LATENCY_END(t) \
+  __atomic_fetch_add(&(t)->lookup_stats->latency[stat_bucket(stat_start)], 1, __ATOMIC_RELAXED)
+#else
+#define STAT_LATENCY_BEGIN() ((void)0)
+#define STAT_LATENCY_END(t, op) ((void)0)
+#define STAT_LOOKUP_LATENCY_END(t) ((void)0)
+#endif
+
+// 키를 설정한다. 구간 모드에서는 [key, key] 구간이 된다.
+static inline void set_key(node_t *n, key_t key)
+{
+  n->key = key;
+#ifdef RBTREE_INTERVAL
+  n->hi = key;
+#endif
+}
+
+// 노드 하나가 담은 키 수. 멀티셋 모드에서는 개수이고 nil은 0이다.
+static inline size_t node_weight(const node_t *x)
+{
+#ifdef RBTREE_MULTISET
+  return x->count;
+#else
+  (void)x;
+  return 1;
+#endif
+}
+
+// 자식의 값으로 x의 부가 정보(서브트리 크기, 최대 끝점)를 다시 계산한다. x는 nil이 아니어야 한다.
+static inline void augment_update(node_t *x)
+{
+#ifndef RBTREE_AUGMENTED
+  (void)x;
+#endif
+#ifdef RBTREE_ORDER_STATS
+  x->size = x->left->size + x->right->size + node_weight(x);
+#endif
+#ifdef RBTREE_INTERVAL
+  key_t max = x->hi;
+  if (x->left->max > max) {
+    max = x->left->max;
+  }
+  if (x->right->max > max) {
+    max = x->right->max;
   }
+  x->max = max;
+#endif
+}
+
+// x부터 루트까지 부가 정보를 다시 계산한다. 부가 정보가 없으면 아무 일도 하지 않는다.
+static inline void augment_propagate(const rbtree *t, node_t *x)
+{
+#ifdef RBTREE_AUGMENTED
+  for (; x != t->nil; x = rbtree_parent(x)) {
+    augment_update(x);
+  }
+#else
+  (void)t;
+  (void)x;
+#endif
+}
+
+static void *default_alloc(void *ctx, size_t size)
+{
+  (void)ctx;
+  return malloc(size);
+}
 
-  // T.nil을 생성합니다. 생성된 T.nil은 트리 내에서 계속 사용됩니다.
-  node_t *nil_node = (node_t *)calloc(1, sizeof(node_t));
-  if (!nil_node) {
-    print_malloc_failed();
-    free(t);
+static void default_free(void *ctx, void *ptr, size_t size)
+{
+  (void)ctx;
+  (void)size;
+  free(ptr);
+}
+
+static const rbtree_allocator default_allocator = {default_alloc, default_free, NULL};
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#define NUMA_MAX_NODES 1024
+
+// 페이지 단위로 익명 메모리를 매핑한 뒤 ctx가 가리키는 NUMA 노드를 우선하도록 묶는다.
+// 묶지 못해도(NUMA가 없는 커널, 없는 노드) 메모리는 그대로 쓴다. 실제 페이지는 처음 쓸 때 그 노드에서 잡힌다.
+static void *numa_alloc(void *ctx, size_t size)
+{
+  void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED) {
     return NULL;
   }
+#ifdef SYS_mbind
+  const long node = (long)(intptr_t)ctx;
+  if (node >= 0 && node < NUMA_MAX_NODES) {
+    unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+    mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+    syscall(SYS_mbind, ptr, size, MPOL_PREFERRED, mask, NUMA_MAX_NODES + 1, 0);
+  }
+#endif
+  return ptr;
+}
 
-  // T.nil의 멤버를 설정합니다.
-  nil_node->color = RBTREE_BLACK;
-  nil_node->parent = nil_node;
-  nil_node->left = nil_node;
-  nil_node->right = nil_node;
+static void numa_free(void *ctx, void *ptr, size_t size)
+{
+  (void)ctx;
+  munmap(ptr, size);
+}
 
-  // 트리의 멤버를 설정합니다.
-  t->root = nil_node;
-  t->nil = nil_node;
+rbtree_allocator rbtree_numa_allocator(const int node)
+{
+  long target = node;
+#ifdef SYS_getcpu
+  unsigned cpu, current;
+  if (target < 0 && syscall(SYS_getcpu, &cpu, &current, NULL) == 0) {
+    target = current;
+  }
+#endif
+  rbtree_allocator allocator = {numa_alloc, numa_free, (void *)(intptr_t)target};
+  return allocator;
+}
 
-  return t;
+static int allocator_equal(const rbtree_allocator *a, const rbtree_allocator *b)
+{
+  return a->alloc == b->alloc && a->free == b->free && a->ctx == b->ctx;
 }
 
-void delete_rbtree(rbtree *t)
+static size_t chunk_bytes(size_t capacity, size_t node_size)
 {
+  return sizeof(struct rbtree_chunk) + capacity * node_size;
+}
 
-  if (!t)
+// 반납된 노드에서 다음 노드를 가리키는 포인터 필드
+#define POOL_LINK(pool, node) (*(void **)((char *)(node) + (pool)->link))
+
+static struct rbtree_arena *arena_root(struct rbtree_arena *arena)
+{
+  while (arena->forward) {
+    arena = arena->forward;
+  }
+  return arena;
+}
+
+// arena 참조를 하나 놓는다. 마지막 참조였으면 청크를 해제하고 forward 쪽 참조도 놓는다.
+// arena_lock을 잡은 상태에서 부른다.
+static void arena_put(struct rbtree_arena *arena)
+{
+  while (arena && --arena->refs == 0) {
+    struct rbtree_arena *forward = arena->forward;
+    const rbtree_allocator allocator = arena->allocator;
+    struct rbtree_chunk *chunk = arena->chunks;
+    while (chunk) {
+      struct rbtree_chunk *next = chunk->next;
+      allocator.free(allocator.ctx, chunk, chunk_bytes(chunk->capacity, arena->node_size));
+      chunk = next;
+    }
+    if (arena->map) {
+      munmap(arena->map, arena->map_len);
+    }
+    allocator.free(allocator.ctx, arena, sizeof(*arena));
+    arena = forward;
+  }
+}
+
+// 노드를 free list에 반납합니다. 메모리는 arena가 해제될 때 청크 단위로 해제됩니다.
+static void pool_free(rbtree_pool *pool, void *node)
+{
+  POOL_LINK(pool, node) = pool->free_list;
+  if (!pool->free_list) {
+    pool->free_tail = node;
+  }
+  pool->free_list = node;
+}
+
+// link 필드로 연결된 노드 목록 [head, tail]을 free list 앞에 한 번에 붙입니다.
+static void pool_free_list(rbtree_pool *pool, void *head, void *tail)
+{
+  if (!head) {
     return;
+  }
+  POOL_LINK(pool, tail) = pool->free_list;
+  if (!pool->free_list) {
+    pool->free_tail = tail;
+  }
+  pool->free_list = head;
+}
+
+// 새 청크를 arena에 붙이고 현재 청크로 삼습니다. 이전 청크의 남은 자리는 버리지 않고 free list로 넘깁니다.
+static int pool_grow(rbtree_pool *pool, size_t capacity)
+{
+  if (capacity > (SIZE_MAX - sizeof(struct rbtree_chunk)) / pool->node_size) {
+    return -1;
+  }
 
-  // 스택 공간을 할당합니다.
-  node_t *stack[1024];
-  int stack_top = 0;
+  // 할당자는 arena를 만들 때 정해진 뒤 바뀌지 않으므로 lock 없이 읽는다.
+  const rbtree_allocator *allocator = &pool->arena->allocator;
+  struct rbtree_chunk *chunk =
+      (struct rbtree_chunk *)allocator->alloc(allocator->ctx, chunk_bytes(capacity, pool->node_size));
+  if (!chunk) {
+    return -1;
+  }
 
-  // 스택에 루트 노드를 넣고 스택 포인터를 +1합니다.
-  if (t->root != t->nil) {
-    stack[stack_top] = t->root;
-    stack_top++;
+  if (pool->chunk) {
+    while (pool->used < pool->chunk->capacity) {
+      pool_free(pool, pool->chunk->nodes + pool->used++ * pool->node_size);
+    }
   }
 
-  // 스택이 비어있을 때까지 반복합니다.
-  while (stack_top > 0) {
+  chunk->capacity = capacity;
+  pthread_mutex_lock(&arena_lock);
+  struct rbtree_arena *arena = arena_root(pool->arena);
+  chunk->next = arena->chunks;
+  arena->chunks = chunk;
+  pthread_mutex_unlock(&arena_lock);
+  pool->chunk = chunk;
+  pool->used = 0;
 
-    // 스택에서 노드를 pop합니다.
-    stack_top--;
-    node_t *node = stack[stack_top];
+  // 청크 크기는 상한까지 두 배씩 늘립니다.
+  pool->next_capacity = capacity * 2 < RBTREE_CHUNK_MAX ? capacity * 2 : RBTREE_CHUNK_MAX;
+  if (pool->next_capacity < RBTREE_CHUNK_MIN) {
+    pool->next_capacity = RBTREE_CHUNK_MIN;
+  }
+  return 0;
+}
 
-    // 오른쪽 노드를 먼저 넣어서 전위 순회를 구현합니다.
-    // T.nil이 아니면 오른쪽 노드를 스택에 push합니다.
-    if (node->right != t->nil) {
-      stack[stack_top] = node->right;
-      stack_top++;
+// 노드 하나를 풀에서 꺼냅니다. free list를 먼저 쓰고, 없으면 현재 청크에서 잘라냅니다.
+static void *pool_alloc(rbtree_pool *pool)
+{
+  if (pool->free_list) {
+    void *node = pool->free_list;
+    pool->free_list = POOL_LINK(pool, node);
+    if (!pool->free_list) {
+      pool->free_tail = NULL;
     }
+    return node;
+  }
 
-    // T.nil이 아니면 왼쪽 노드를 스택에 push합니다.
-    if (node->left != t->nil) {
-      stack[stack_top] = node->left;
-      stack_top++;
+  if (!pool->chunk || pool->used == pool->chunk->capacity) {
+    if (pool->spare) {
+      // 비워 둔 청크를 처음부터 다시 쓴다. spare_last 뒤의 next는 청크 목록을 합칠 때 바뀔 수 있으므로 따라가지 않는다.
+      pool->chunk = pool->spare;
+      pool->spare = pool->spare == pool->spare_last ? NULL : pool->spare->next;
+      pool->used = 0;
+    } else if (pool_grow(pool, pool->next_capacity) < 0) {
+      return NULL;
     }
+  }
+  return pool->chunk->nodes + pool->used++ * pool->node_size;
+}
+
+// 비어 있는 풀을 만듭니다. share가 있으면 그 풀과 같은 arena와 노드 모양을 쓰고,
+// 없으면 allocator로 새 arena를 만듭니다. link는 반납된 노드를 잇는 포인터 필드의 오프셋입니다.
+static int pool_setup(rbtree_pool *pool, const rbtree_pool *share, const rbtree_allocator *allocator,
+                      const size_t node_size, const size_t link)
+{
+  memset(pool, 0, sizeof(*pool));
+  pool->next_capacity = RBTREE_CHUNK_MIN;
+  pool->node_size = share ? share->node_size : node_size;
+  pool->link = share ? share->link : link;
 
-    // 꺼낸 노드를 해제합니다.
-    free(node);
-    node = NULL;
+  if (share) {
+    pthread_mutex_lock(&arena_lock);
+    pool->arena = share->arena;
+    pool->arena->refs++;
+    pthread_mutex_unlock(&arena_lock);
+    pool->next_capacity = share->next_capacity;
+    return 0;
   }
 
-  // 모든 노드를 해제 후에 T.nil을 해제합니다.
-  free(t->nil);
+  pool->arena = (struct rbtree_arena *)allocator->alloc(allocator->ctx, sizeof(struct rbtree_arena));
+  if (!pool->arena) {
+    return -1;
+  }
+  memset(pool->arena, 0, sizeof(struct rbtree_arena));
+  pool->arena->allocator = *allocator;
+  pool->arena->node_size = node_size;
+  pool->arena->refs = 1;
+  return 0;
+}
 
-  // 트리를 해제합니다.
-  free(t);
+// rbtree 노드(node_t, right로 연결)의 풀
+static int pool_init(rbtree_pool *pool, const rbtree_pool *share, const rbtree_allocator *allocator)
+{
+  return pool_setup(pool, share, allocator, sizeof(node_t), offsetof(node_t, right));
 }
 
-// 좌회전 함수
-void left_rotate(rbtree *t, node_t *x)
+// src 트리의 노드가 dst 트리로 옮겨 올 때 부른다. 두 arena를 하나로 합치고 free list를 이어 붙인다.
+// 두 트리는 같은 nil을 써야 하므로, mmap 이미지를 가진 arena는 같은 이미지에서 나온 트리끼리만 만난다.
+// 남은 자리가 더 많은 청크를 현재 청크로 남기고, 다른 쪽 청크의 남은 자리는 arena가 해제될 때까지 쓰지 않는다.
+static void pool_merge(rbtree_pool *dst, rbtree_pool *src)
 {
-  if (x == t->nil || x->right == t->nil) {
-    return;
+  pthread_mutex_lock(&arena_lock);
+  struct rbtree_arena *a = arena_root(dst->arena);
+  struct rbtree_arena *b = arena_root(src->arena);
+  if (a != b) {
+    if (b->chunks) {
+      struct rbtree_chunk *last = b->chunks;
+      while (last->next) {
+        last = last->next;
+      }
+      last->next = a->chunks;
+      a->chunks = b->chunks;
+      b->chunks = NULL;
+    }
+    b->forward = a;
+    a->refs++;
   }
+  arena_put(src->arena);
+  pthread_mutex_unlock(&arena_lock);
 
-  // y를 설정
-  node_t *y = x->right;
+  pool_free_list(dst, src->free_list, src->free_tail);
+  if (src->chunk &&
+      (!dst->chunk || src->chunk->capacity - src->used > dst->chunk->capacity - dst->used)) {
+    dst->chunk = src->chunk;
+    dst->used = src->used;
+  }
+  if (src->next_capacity > dst->next_capacity) {
+    dst->next_capacity = src->next_capacity;
+  }
+  memset(src, 0, sizeof(*src));
+}
 
-  // y의 왼쪽 서브트리를 x의 오른쪽 서브트리로 옮긴다.
-  x->right = y->left;
-  if (y->left != t->nil) {
-    y->left->parent = x;
+// 이 풀만 쓰는 arena면 노드를 모두 버린 것으로 보고 청크를 처음부터 다시 쓰게 한다. 함께 쓰면 -1
+static int pool_rewind(rbtree_pool *pool)
+{
+  pthread_mutex_lock(&arena_lock);
+  struct rbtree_arena *arena = pool->arena;
+  if (arena->forward || arena->refs != 1) {
+    pthread_mutex_unlock(&arena_lock);
+    return -1;
+  }
+  struct rbtree_chunk *last = arena->chunks;
+  while (last && last->next) {
+    last = last->next;
   }
+  pool->chunk = arena->chunks;
+  pool->used = 0;
+  pool->spare = pool->chunk && pool->chunk != last ? pool->chunk->next : NULL;
+  pool->spare_last = pool->spare ? last : NULL;
+  pthread_mutex_unlock(&arena_lock);
+
+  pool->free_list = pool->free_tail = NULL;
+  return 0;
+}
+
+static void pool_release(rbtree_pool *pool)
+{
+  pthread_mutex_lock(&arena_lock);
+  arena_put(pool->arena);
+  pthread_mutex_unlock(&arena_lock);
+  memset(pool, 0, sizeof(*pool));
+}
 
-  // y의 부모를 x의 부모로 변경한다.(y를 부모 자리로 승격)
-  y->parent = x->parent;
-  if (x->parent == t->nil) { // x가 루트였다면 승격된 y를 트리의 루트로 설정
-    t->root = y;
-  } else if (x == x->parent->left) { // x가 왼쪽 자식 노드였다면 승격된 y를 기존 부모의 왼쪽 자식으로 설정
-    x->parent->left = y;
-  } else { // x가 오른쪽 자식 노드였다면 승격된 y를 기존 부모의 오른쪽 자식으로 설정
-    x->parent->right = y;
+// node_t가 아닌 노드를 쓰는 트리(rbtree_topdown)도 같은 풀을 쓴다. arena는 기본 할당자로 만든다.
+int rbtree_pool_init(rbtree_pool *pool, const size_t node_size, const size_t link)
+{
+  if (pool == NULL || link > node_size - sizeof(void *) || node_size % _Alignof(void *) != 0) {
+    return -1;
   }
+  return pool_setup(pool, NULL, &default_allocator, node_size, link);
+}
 
-  // 승격된 y와 강등된 x의 관계를 설정
-  y->left = x;
-  x->parent = y;
+void *rbtree_pool_alloc(rbtree_pool *pool)
+{
+  return pool_alloc(pool);
 }
 
-// 우회전 함수
-void right_rotate(rbtree *t, node_t *x)
+void rbtree_pool_free(rbtree_pool *pool, void *node)
 {
-  if (x == t->nil || x->left == t->nil) {
-    return;
+  pool_free(pool, node);
+}
+
+void rbtree_pool_release(rbtree_pool *pool)
+{
+  pool_release(pool);
+}
+
+// 빈 트리 구조체를 allocator에서 얻습니다. 풀은 아직 만들지 않습니다.
+// 계측을 켜면 조회 카운터를 트리 구조체 바로 뒤에 함께 할당한다.
+#ifdef RBTREE_STATS
+#define TREE_BYTES (sizeof(rbtree) + sizeof(struct rbtree_lookup_stats))
+#else
+#define TREE_BYTES sizeof(rbtree)
+#endif
+
+static rbtree *tree_alloc(const rbtree_allocator *allocator)
+{
+  rbtree *t = (rbtree *)allocator->alloc(allocator->ctx, TREE_BYTES);
+  if (!t) {
+    return NULL;
   }
+  memset(t, 0, TREE_BYTES);
+  t->allocator = *allocator;
+#ifdef RBTREE_STATS
+  t->lookup_stats = (struct rbtree_lookup_stats *)(t + 1);
+#endif
+  return t;
+}
 
-  // y를 설정
-  node_t *y = x->left;
+// 트리 구조체만 돌려줍니다. 풀은 이미 정리되었거나 다른 트리로 넘어간 상태여야 합니다.
+static void tree_free(rbtree *t)
+{
+  const rbtree_allocator allocator = t->allocator;
+  allocator.free(allocator.ctx, t, TREE_BYTES);
+}
 
-  // y의 오른쪽 서브트리를 x의 왼쪽 서브트리로 옮긴다.
-  x->left = y->right;
-  if (y->right != t->nil) {
-    y->right->parent = x;
+// 노드 n개 분량의 청크를 미리 확보한 트리를 만듭니다.
+static rbtree *tree_create(const rbtree_allocator *allocator, const size_t n)
+{
+  rbtree *t = tree_alloc(allocator);
+  if (!t) {
+    return NULL;
   }
 
-  // y의 부모를 x의 부모로 변경한다.(y를 부모 자리로 승격)
-  y->parent = x->parent;
-  if (x->parent == t->nil) { // x가 루트였다면 승격된 y를 트리의 루트로 설정
-    t->root = y;
-  } else if (x == x->parent->left) { // x가 왼쪽 자식 노드였다면 승격된 y를 기존 부모의 왼쪽 자식으로 설정
-    x->parent->left = y;
-  } else { // x가 오른쪽 자식 노드였다면 승격된 y를 기존 부모의 오른쪽 자식으로 설정
-    x->parent->right = y;
+  // 트리의 멤버를 설정합니다. T.nil은 모든 트리가 함께 쓰는 읽기 전용 노드입니다.
+  t->root = NIL;
+  t->nil = NIL;
+  t->leftmost = t->rightmost = NIL;
+
+  // 첫 청크는 요청한 용량으로, 없으면 첫 삽입 때 최소 크기로 만듭니다.
+  if (pool_init(&t->pool, NULL, allocator) < 0) {
+    tree_free(t);
+    return NULL;
+  }
+  if (n > 0 && pool_grow(&t->pool, n) < 0) {
+    pool_release(&t->pool);
+    tree_free(t);
+    return NULL;
   }
 
-  // 승격된 y와 강등된 x의 관계를 설정
-  y->right = x;
-  x->parent = y;
+  return t;
 }
 
-void rbtree_insert_fixup(rbtree *t, node_t *z)
+rbtree *new_rbtree(void)
 {
-  // 신규 노드가 루트면 끝 && 신규 노드의 부모 레드면 계속 체크
-  while (z != t->root && z->parent->color == RBTREE_RED) {
-    if (z->parent == z->parent->parent->left) { // 부모가 왼쪽 자식이라면
-      node_t *y = z->parent->parent->right;     // 삼촌 노드 설정
-      if (y->color == RBTREE_RED) {
-        // 케이스1: z의 삼촌 y가 레드
-        z->parent->color = RBTREE_BLACK;       // 부모 노드를 블랙으로 설정
-        y->color = RBTREE_BLACK;               // 삼촌 노드를 블랙으로 설정
-        z->parent->parent->color = RBTREE_RED; // 조부모를 레드로 설정(부모와 삼촌에게 블랙을 물려줌)
-        z = z->parent->parent;                 // 레드로 설정된 조부모를 신규 삽입 노드로 취급
-      } else {
-        if (z == z->parent->right) {
-          // 케이스2: z가 오른쪽 자식인 경우(2는 궁극적으로 케이스 3이 됨)
-          z = z->parent; // 회전 기준을 z의 부모로 설정
-          left_rotate(t, z);
-        }
-        // 케이스 3: z가 왼쪽 자식인 경우
-        z->parent->color = RBTREE_BLACK;
-        z->parent->parent->color = RBTREE_RED;
-        right_rotate(t, z->parent->parent); // 조부모를 기준으로 회전
-      }
-    } else { // 부모가 오른쪽 자식이라면(좌회전과 반대 코드)
-      node_t *y = z->parent->parent->left;
-      if (y->color == RBTREE_RED) {
-        z->parent->color = RBTREE_BLACK;
-        y->color = RBTREE_BLACK;
-        z->parent->parent->color = RBTREE_RED;
-        z = z->parent->parent;
-      } else {
-        if (z == z->parent->left) {
-          z = z->parent;
-          right_rotate(t, z);
-        }
-        z->parent->color = RBTREE_BLACK;
-        z->parent->parent->color = RBTREE_RED;
-        left_rotate(t, z->parent->parent);
-      }
-    }
-  }
-  t->root->color = RBTREE_BLACK;
+  return tree_create(&default_allocator, 0);
 }
 
-node_t *rbtree_insert(rbtree *t, const key_t key)
+rbtree *new_rbtree_with_capacity(const size_t n)
 {
-  node_t *new_node = (node_t *)(malloc(sizeof(node_t)));
-  if (new_node == NULL) {
-    print_malloc_failed();
-    return t->root;
+  return tree_create(&default_allocator, n);
+}
+
+rbtree *new_rbtree_ex(const rbtree_allocator *allocator)
+{
+  if (allocator == NULL) {
+    allocator = &default_allocator;
+  }
+  if (allocator->alloc == NULL || allocator->free == NULL) {
+    return NULL;
   }
+  return tree_create(allocator, 0);
+}
 
-  new_node->color = RBTREE_RED;
-  new_node->key = key;
-  new_node->parent = t->nil;
-  new_node->left = t->nil;
-  new_node->right = t->nil;
+void delete_rbtree(rbtree *t)
+{
 
-  node_t *current = t->root;
-  node_t *parent = t->nil;
+  if (!t)
+    return;
+
+  // 노드는 모두 풀의 청크에 있으므로 하나씩 순회하지 않고 청크 단위로 해제합니다.
+  // 다른 트리와 arena를 함께 쓰고 있으면 마지막 트리가 해제할 때 청크가 해제됩니다.
+  pool_release(&t->pool);
+
+  // 트리를 해제합니다.
+  tree_free(t);
+}
+
+// rbtree_fixup.h가 노드에 접근하는 방법. nil은 읽기 전용이므로 nil이 아닌 노드에만 쓰고,
+// 회전한 두 노드의 부가 정보는 아래쪽 x부터 다시 계산한다.
+#define RBTREE_OPS_NIL(t) ((t)->nil)
+#define RBTREE_OPS_ROOT(t) ((t)->root)
+#define RBTREE_OPS_LEFT(t, x) ((x)->left)
+#define RBTREE_OPS_RIGHT(t, x) ((x)->right)
+#define RBTREE_OPS_LINK(t, link, v) set_link(&(link), (v))
+#define RBTREE_OPS_PARENT(t, x) rbtree_parent(x)
+#define RBTREE_OPS_SET_PARENT(t, x, p) set_parent((x), (p))
+#define RBTREE_OPS_COLOR(t, x) rbtree_color(x)
+#define RBTREE_OPS_SET_COLOR(t, x, c) set_color((x), (c))
+#define RBTREE_OPS_ROTATED(t, x, y, counter) (STAT_ADD(t, counter, 1), augment_update(x), augment_update(y))
+#define RBTREE_OPS_LOOP(t, counter) STAT_ADD(t, counter, 1)
+
+// rbtree_left_rotate, rbtree_right_rotate, rbtree_insert_fixup, rbtree_erase_fixup
+RBTREE_FIXUP_GENERATE(static, rbtree, rbtree, node_t *, RBTREE_OPS)
+
+// key를 start의 서브트리 안에 넣고 RB Tree 특성을 복구한 뒤 키를 담은 노드를 돌려준다.
+// new_node는 키가 채워진 새 노드이고, NULL이면 붙일 자리를 찾은 뒤에 풀에서 할당한다(실패하면 NULL).
+// start가 루트면 일반 삽입과 같고, 키가 start 서브트리의 범위 안에 있어야 한다.
+// 멀티셋 모드에서 같은 키의 노드가 있으면 new_node는 쓰지 않고 그 노드의 개수를 늘린다.
+static node_t *insert_node(rbtree *t, node_t *start, const key_t key, node_t *new_node)
+{
+  node_t *current = start;
+  node_t *parent = start == t->root ? t->nil : rbtree_parent(start);
 
   // 신규 노드 삽입될 위치 찾기
   while (current != t->nil) {
+    STAT_ADD(t, insert_compares, 1);
     parent = current;
     if (key < current->key) {
       current = current->left;
     } else if (key > current->key) {
       current = current->right;
     } else {
+#ifdef RBTREE_MULTISET
+      // 있는 키는 개수만 늘린다. 노드 할당도 fixup도 없다.
+      current->count++;
+      augment_propagate(t, current);
+      return current;
+#else
       current = current->right;
+#endif
+    }
+  }
+
+  if (new_node == NULL) {
+    if ((new_node = pool_alloc(&t->pool)) == NULL) {
+      return NULL;
     }
+    set_key(new_node, key);
   }
+  new_node->left = t->nil;
+  new_node->right = t->nil;
+#ifdef RBTREE_MULTISET
+  new_node->count = 1;
+#endif
 
   // 신규 노드의 부모를 설정
-  new_node->parent = parent;
+  set_parent_color(new_node, parent, RBTREE_RED);
   if (parent == t->nil) {
-    t->root = new_node;
+    set_link(&t->root, new_node);
   } else if (key < parent->key) {
-    parent->left = new_node;
+    set_link(&parent->left, new_node);
   } else if (key > parent->key) {
-    parent->right = new_node;
+    set_link(&parent->right, new_node);
   } else {
-    parent->right = new_node;
+    set_link(&parent->right, new_node);
+  }
+
+  // 새 노드는 잎이므로 끝 노드의 바깥쪽에 붙었을 때만 끝 노드가 바뀐다. 회전은 순서를 바꾸지 않는다.
+  if (parent == t->nil) {
+    t->leftmost = t->rightmost = new_node;
+  } else if (parent == t->leftmost && parent->left == new_node) {
+    t->leftmost = new_node;
+  } else if (parent == t->rightmost && parent->right == new_node) {
+    t->rightmost = new_node;
+  }
+
+  if (t->nodes != RBTREE_NODES_UNKNOWN) {
+    t->nodes++;
   }
 
-  // RB Tree 특성 복구
+  // 새 노드부터 루트까지 부가 정보를 갱신한 뒤 RB Tree 특성 복구
+  augment_propagate(t, new_node);
   rbtree_insert_fixup(t, new_node);
+  return new_node;
+}
+
+node_t *rbtree_insert(rbtree *t, const key_t key)
+{
+  STAT_LATENCY_BEGIN();
+  node_t *new_node = insert_node(t, t->root, key, NULL);
+  if (new_node == NULL) {
+    return NULL;
+  }
 
+  STAT_LATENCY_END(t, RBTREE_STAT_INSERT);
   return new_node;
 }
 
 node_t *rbtree_find(const rbtree *t, const key_t key)
 {
+  STAT_LATENCY_BEGIN();
+  STAT_LOOKUP_DECL(compares);
   node_t *current = t->root;
 
   while (current != t->nil) {  // 현재 노드가 nil이 아니면 계속 검색
+    STAT_LOOKUP_COUNT(compares);
     if (key == current->key) { // 찾았음
-      return current;
+      break;
     }
 
     if (key < current->key) {
@@ -250,26 +726,87 @@ node_t *rbtree_find(const rbtree *t, const key_t key)
       current = current->right; // 우측 탐색
     }
   }
+
+  STAT_LOOKUP_ADD(t, find_compares, compares);
+  STAT_LOOKUP_LATENCY_END(t);
   // printf("일치하는 키가 없습니다.[%d]\n", key);
-  return NULL;
+  return current != t->nil ? current : NULL;
 }
 
-node_t *rbtree_min(const rbtree *t)
+// 한 번에 진행하는 탐색 수. 메모리 요청을 동시에 이만큼 띄워 둔다.
+#define RBTREE_BATCH_WIDTH 16
+
+// 여러 탐색을 번갈아 한 레벨씩 진행한다(AMAC). 다음 자식을 prefetch해 두고 다른 탐색으로 넘어가므로
+// 한 탐색이 캐시 미스를 기다리는 동안 나머지 탐색의 메모리 요청이 함께 진행된다.
+// 끝난 자리에는 바로 다음 키를 넣어 항상 RBTREE_BATCH_WIDTH개가 움직이게 한다.
+size_t rbtree_find_batch(const rbtree *t, const key_t *keys, node_t **out, const size_t n)
 {
-  node_t *current = t->root;
-  while (current->left != t->nil) {
-    current = current->left;
+  node_t *node[RBTREE_BATCH_WIDTH];
+  size_t index[RBTREE_BATCH_WIDTH];
+  size_t next = 0, found = 0;
+  int active = 0;
+  STAT_LOOKUP_DECL(compares);
+
+  while (active < RBTREE_BATCH_WIDTH && next < n) {
+    node[active] = t->root;
+    index[active++] = next++;
+  }
+
+  while (active > 0) {
+    for (int s = 0; s < active;) {
+      node_t *current = node[s];
+      const key_t key = keys[index[s]];
+      if (current != t->nil) {
+        STAT_LOOKUP_COUNT(compares);
+        if (key != current->key) {
+          current = key < current->key ? current->left : current->right;
+          __builtin_prefetch(current);
+          node[s++] = current;
+          continue;
+        }
+        found++;
+      }
+
+      // 끝난 탐색의 결과를 쓰고 다음 키로 바꾼다. 남은 키가 없으면 마지막 탐색을 이 자리로 옮긴다.
+      out[index[s]] = current != t->nil ? current : NULL;
+      if (next < n) {
+        node[s] = t->root;
+        index[s++] = next++;
+      } else {
+        active--;
+        node[s] = node[active];
+        index[s] = index[active];
+      }
+    }
   }
-  return current;
+  STAT_LOOKUP_ADD(t, find_compares, compares);
+  return found;
+}
+
+node_t *rbtree_min(const rbtree *t)
+{
+  return t->leftmost;
 }
 
 node_t *rbtree_max(const rbtree *t)
+{
+  return t->rightmost;
+}
+
+// 루트를 통째로 바꾼 뒤(일괄 생성, join/split, 집합 연산, mmap) 양 끝 노드를 다시 찾는다. O(log n)
+static void reset_bounds(rbtree *t)
 {
   node_t *current = t->root;
-  while (current->right != t->nil) {
+  while (current != t->nil && current->left != t->nil) {
+    current = current->left;
+  }
+  t->leftmost = current;
+
+  current = t->root;
+  while (current != t->nil && current->right != t->nil) {
     current = current->right;
   }
-  return current;
+  t->rightmost = current;
 }
 
 node_t *rbtree_min_in_subtree(rbtree *t, node_t *node)
@@ -298,133 +835,381 @@ node_t *rbtree_max_in_subtree(rbtree *t, node_t *node)
   return node;
 }
 
-// 삭제된 노드의 서브트리를 삭제된 노드의 부모와 연결한다.
-// u는 삭제할 노드, v는 삭제할 노드의 서브트리
-void rbtree_transplant(rbtree *t, node_t *u, node_t *v)
+// 중위 순회에서 node의 다음/이전 노드. 없으면 nil을 돌려준다.
+static node_t *next_node(const rbtree *t, node_t *node)
 {
-  if (u->parent == t->nil) {
-    t->root = v;
-  } else if (u == u->parent->left) {
-    u->parent->left = v;
-  } else {
-    u->parent->right = v;
+  if (node->right != t->nil) {
+    node = node->right;
+    while (node->left != t->nil) {
+      node = node->left;
+    }
+    return node;
+  }
+
+  node_t *parent = rbtree_parent(node);
+  while (parent != t->nil && node == parent->right) {
+    node = parent;
+    parent = rbtree_parent(parent);
   }
-  v->parent = u->parent;
+  return parent;
 }
 
-// rbtree 속성을 복구한다.
-void rbtree_erase_fixup(rbtree *t, node_t *x)
+static node_t *prev_node(const rbtree *t, node_t *node)
 {
-  node_t *w;
-
-  while (x != t->root && x->color == RBTREE_BLACK) {
-    if (x == x->parent->left) { // x가 왼쪽 노드이면 오른쪽 노드를 삼촌으로 설정
-      w = x->parent->right;
-      if (w->color == RBTREE_RED) { // 케이스1. 형제 w가 적색인 경우
-        w->color = RBTREE_BLACK;
-        x->parent->color = RBTREE_RED;
-        left_rotate(t, x->parent);
-        w = x->parent->right; // 삼촌을 재설정해서 케이스 2,3,4로 변환
-      }
-      if (w->left->color == RBTREE_BLACK && w->right->color == RBTREE_BLACK) { // 케이스2
-        w->color = RBTREE_RED;
-        x = x->parent; // 이 시점에서 x가 블랙이면서 루트가 되면 루프가 종료
-      } else if (w->right->color == RBTREE_BLACK) {
-        w->left->color = RBTREE_BLACK;
-        w->color = RBTREE_RED;
-        right_rotate(t, w); // 이 시점에서 케이스4로 변환
-        w = x->parent->right;
-      }
-      // 케이스 4. 케이스2의 일부 케이스를 제외하고 궁극적으로 모든 케이스는 4로 귀결됨.
-      w->color = x->parent->color;
-      x->parent->color = RBTREE_BLACK;
-      w->right->color = RBTREE_BLACK;
-      left_rotate(t, x->parent);
-      x = t->root;
-    } else {
-      w = x->parent->left;
-      if (w->color == RBTREE_RED) { // 케이스1. 형제 w가 적색인 경우
-        w->color = RBTREE_BLACK;
-        x->parent->color = RBTREE_RED;
-        right_rotate(t, x->parent);
-        w = x->parent->left; // 삼촌을 재설정해서 케이스 2,3,4로 변환
-      }
-      if (w->right->color == RBTREE_BLACK && w->left->color == RBTREE_BLACK) { // 케이스2
-        w->color = RBTREE_RED;
-        x = x->parent; // 이 시점에서 x가 블랙이면서 루트가 되면 루프가 종료
-      } else if (w->left->color == RBTREE_BLACK) {
-        w->right->color = RBTREE_BLACK;
-        w->color = RBTREE_RED;
-        left_rotate(t, w); // 이 시점에서 케이스4로 변환
-        w = x->parent->left;
-      }
-      // 케이스 4. 케이스2의 일부 케이스를 제외하고 궁극적으로 모든 케이스는 4로 귀결됨.
-      w->color = x->parent->color;
-      x->parent->color = RBTREE_BLACK;
-      w->left->color = RBTREE_BLACK;
-      right_rotate(t, x->parent);
-      x = t->root;
+  if (node->left != t->nil) {
+    node = node->left;
+    while (node->right != t->nil) {
+      node = node->right;
     }
+    return node;
+  }
+
+  node_t *parent = rbtree_parent(node);
+  while (parent != t->nil && node == parent->left) {
+    node = parent;
+    parent = rbtree_parent(parent);
   }
-  x->color = RBTREE_BLACK;
+  return parent;
 }
 
-// 이진 검색 트리 방식으로 삭제
-int rbtree_erase(rbtree *t, node_t *z)
+node_t *rbtree_next(const rbtree *t, const node_t *node)
 {
-  if (z == NULL || z == t->nil) {
-    return -1;
-  }
+  node_t *next = next_node(t, (node_t *)node);
+  return next == t->nil ? NULL : next;
+}
 
-  node_t *successor = z;
-  node_t *replacement; // x는 삭제 연산으로 인해 부모 노드를 잃게 된 노드
-  color_t successor_original_color = successor->color;
+node_t *rbtree_prev(const rbtree *t, const node_t *node)
+{
+  node_t *prev = prev_node(t, (node_t *)node);
+  return prev == t->nil ? NULL : prev;
+}
 
-  if (z->left == t->nil) {  // 삭제할 노드의 왼쪽 자녀가 nil
-    replacement = z->right; // 삭제 과정에서 새롭게 올라온 노드를 기준으로 트리를 재조정함.
-    rbtree_transplant(t, z, z->right);
+// key가 hint의 바로 앞이나 바로 뒤 자리에 들어가면 루트 대신 hint에서 내려가 붙인다.
+// hint에 오른쪽 자식이 없으면(직전에 넣은 최대 노드 등) 비교 한 번으로 자리가 정해진다.
+// 이웃 노드는 부모 포인터로 찾으므로 키 비교 없이 포인터만 따라간다. hint가 양 끝 노드면 바깥쪽 이웃이
+// 없다는 것을 기억해 둔 끝 노드로 알므로, 정렬된 입력은 위로 올라가지 않고 O(1)에 자리를 찾는다.
+node_t *rbtree_insert_hint(rbtree *t, node_t *hint, const key_t key)
+{
+  if (hint == NULL || hint == t->nil) {
+    return rbtree_insert(t, key);
+  }
+
+  node_t *start = NULL;
+  if (hint->key <= key) {
+    // 같은 키는 맨 뒤에 들어가야 하므로 다음 노드의 키는 key보다 커야 한다.
+    node_t *next = hint == t->rightmost ? t->nil : next_node(t, hint);
+    if (next == t->nil || key < next->key) {
+      start = hint;
+    }
+  } else {
+    node_t *prev = hint == t->leftmost ? t->nil : prev_node(t, hint);
+    if (prev == t->nil || prev->key < key) {
+      start = hint;
+    } else if (prev->key == key) {
+      start = prev;
+    }
+  }
+  if (start == NULL) {
+    return rbtree_insert(t, key);
+  }
+
+  STAT_LATENCY_BEGIN();
+  node_t *new_node = insert_node(t, start, key, NULL);
+  if (new_node == NULL) {
+    return NULL;
+  }
+
+  STAT_LATENCY_END(t, RBTREE_STAT_INSERT);
+  return new_node;
+}
+
+// key 이상인 첫 노드
+node_t *rbtree_lower_bound(const rbtree *t, const key_t key)
+{
+  node_t *current = t->root;
+  node_t *found = NULL;
+
+  while (current != t->nil) {
+    if (current->key >= key) {
+      found = current; // 후보를 기억하고 더 작은 쪽을 찾는다.
+      current = current->left;
+    } else {
+      current = current->right;
+    }
+  }
+  return found;
+}
+
+// key보다 큰 첫 노드
+node_t *rbtree_upper_bound(const rbtree *t, const key_t key)
+{
+  node_t *current = t->root;
+  node_t *found = NULL;
+
+  while (current != t->nil) {
+    if (current->key > key) {
+      found = current;
+      current = current->left;
+    } else {
+      current = current->right;
+    }
+  }
+  return found;
+}
+
+// key 이하인 마지막 노드
+node_t *rbtree_floor(const rbtree *t, const key_t key)
+{
+  node_t *current = t->root;
+  node_t *found = NULL;
+
+  while (current != t->nil) {
+    if (current->key <= key) {
+      found = current; // 후보를 기억하고 더 큰 쪽을 찾는다.
+      current = current->right;
+    } else {
+      current = current->left;
+    }
+  }
+  return found;
+}
+
+// key 이상인 첫 노드(rbtree_lower_bound와 같다)
+node_t *rbtree_ceil(const rbtree *t, const key_t key)
+{
+  return rbtree_lower_bound(t, key);
+}
+
+// [lo, hi] 범위의 노드를 키 순서로 callback에 넘긴다. callback이 0이 아닌 값을 돌려주면 멈춘다.
+// 시작 위치를 찾는 데 O(log n), 이후 노드마다 분할 상환 O(1)이 든다.
+size_t rbtree_range(const rbtree *t, const key_t lo, const key_t hi, rbtree_visit_fn callback, void *ctx)
+{
+  size_t visited = 0;
+
+  for (node_t *node = rbtree_lower_bound(t, lo); node != NULL && node->key <= hi; node = rbtree_next(t, node)) {
+    visited++;
+    if (callback(node, ctx)) {
+      break;
+    }
+  }
+  return visited;
+}
+
+// 삭제된 노드의 서브트리를 삭제된 노드의 부모와 연결한다.
+// u는 삭제할 노드, v는 삭제할 노드의 서브트리
+void rbtree_transplant(rbtree *t, node_t *u, node_t *v)
+{
+  node_t *up = rbtree_parent(u);
+  if (up == t->nil) {
+    set_link(&t->root, v);
+  } else if (u == up->left) {
+    set_link(&up->left, v);
+  } else {
+    set_link(&up->right, v);
+  }
+  if (v != t->nil) { // nil은 모든 트리가 함께 쓰므로 부모를 기록하지 않는다.
+    set_parent(v, up);
+  }
+}
+
+// 이진 검색 트리 방식으로 z를 트리에서 떼어 낸다. 노드는 반납하지 않고,
+// z의 left/right도 그대로 두어서 z를 지나던 lock-free 독자가 계속 내려갈 수 있다.
+int rbtree_unlink(rbtree *t, node_t *z)
+{
+  if (z == NULL || z == t->nil) {
+    return -1;
+  }
+
+  if (t->nodes != RBTREE_NODES_UNKNOWN) {
+    t->nodes--;
+  }
+
+  // 끝 노드는 바깥쪽 자식이 없으므로 이웃이 바로 옆(자식이나 부모)에 있다.
+  if (z == t->leftmost) {
+    t->leftmost = next_node(t, z);
+  }
+  if (z == t->rightmost) {
+    t->rightmost = prev_node(t, z);
+  }
+
+  node_t *successor = z;
+  node_t *replacement; // x는 삭제 연산으로 인해 부모 노드를 잃게 된 노드
+  node_t *changed = rbtree_parent(z); // 서브트리 구성이 바뀐 가장 아래 노드
+  color_t successor_original_color = rbtree_color(successor);
+
+  if (z->left == t->nil) {  // 삭제할 노드의 왼쪽 자녀가 nil
+    replacement = z->right; // 삭제 과정에서 새롭게 올라온 노드를 기준으로 트리를 재조정함.
+    rbtree_transplant(t, z, z->right);
   } else if (z->right == t->nil) { // 삭제할 노드의 오른쪽 자녀가 nil
     replacement = z->left;         // 삭제 과정에서 새롭게 올라온 노드를 기준으로 트리를 재조정함.
     rbtree_transplant(t, z, z->left);
   } else {                                          // 삭제한 노드에 모두 자녀가 있음
     successor = rbtree_min_in_subtree(t, z->right); // 후계자 찾기
-    successor_original_color = successor->color;
+    successor_original_color = rbtree_color(successor);
     replacement = successor->right; // y의 왼쪽 자식은 무조건 nil이지만 오른쪽은 서브트리 존재 가능함
 
-    if (successor->parent == z) {                        // 후계자가 삭제 노드의 직접 자식이라면, y는 이미 올바른 위치(y는 언제든지 떠날 준비가 되어 있음.)
-      replacement->parent = successor;                   // x는 임시 변수로, y의 오른쪽 자녀로 등록되었지만, x의 부모가 누군인지는 아직 모름. 이 시점에서 연동.
+    if (rbtree_parent(successor) == z) {                 // 후계자가 삭제 노드의 직접 자식이라면, y는 이미 올바른 위치(y는 언제든지 떠날 준비가 되어 있음.)
+      changed = successor;                               // x가 nil이 아니면 부모는 이미 y이다.
     } else {                                             // y가 z를 대체하기 위해서는 y의 관계를 y의 오른쪽 자식에게 물려주고 떠나야 함.
+      changed = rbtree_parent(successor);
       rbtree_transplant(t, successor, successor->right); // y를 y의 오른쪽 자식으로 대체
-      successor->right = z->right;
-      successor->right->parent = successor;
+      set_link(&successor->right, z->right);
+      set_parent(successor->right, successor);
     }
 
     // z를 삭제(y로 대체)하고 기존 z의 왼쪽 자식의 관계를 y의 관계로 재설정
     rbtree_transplant(t, z, successor);
-    successor->left = z->left;
-    successor->left->parent = successor;
-    successor->color = z->color;
+    set_link(&successor->left, z->left);
+    set_parent(successor->left, successor);
+    set_color(successor, rbtree_color(z));
   }
 
-  free(z);
-  z = NULL;
+  // 회전하기 전에 바뀐 경로의 부가 정보를 먼저 맞춘다.
+  augment_propagate(t, changed);
 
-  // 이 부분이 더블블랙을 해소하는 부분.
+  // 이 부분이 더블블랙을 해소하는 부분. replacement의 부모는 changed이다.
   if (successor_original_color == RBTREE_BLACK) {
-    rbtree_erase_fixup(t, replacement);
+    rbtree_erase_fixup(t, replacement, changed);
   }
   return 1;
 }
 
-void inorder_recursion(const node_t *node, key_t *arr, size_t *index, const node_t *nil)
+// rbtree_unlink로 떼어 낸 노드를 풀에 반납한다.
+void rbtree_release_node(rbtree *t, node_t *z)
 {
-  if (node == nil)
-    return;
+  pool_free(&t->pool, z);
+}
+
+int rbtree_erase(rbtree *t, node_t *z)
+{
+  STAT_LATENCY_BEGIN();
+#ifdef RBTREE_MULTISET
+  if (z != NULL && z != t->nil && z->count > 1) {
+    z->count--;
+    augment_propagate(t, z);
+    STAT_LATENCY_END(t, RBTREE_STAT_ERASE);
+    return 1;
+  }
+#endif
+  int ret = rbtree_unlink(t, z);
+  if (ret < 0) {
+    return ret;
+  }
+  pool_free(&t->pool, z);
+
+  STAT_LATENCY_END(t, RBTREE_STAT_ERASE);
+  return ret;
+}
+
+// 타이머 큐처럼 끝에서만 꺼내는 경우를 위한 것. 끝 노드는 자식이 많아야 하나라서 떼어 낼 때
+// 후계자를 찾지 않고, 다음 끝 노드도 바로 옆에 있으므로 남는 비용은 erase fixup뿐이다.
+int rbtree_pop_min(rbtree *t, key_t *key)
+{
+  node_t *node = t->leftmost;
+  if (node == t->nil) {
+    return 0;
+  }
+  if (key != NULL) {
+    *key = node->key;
+  }
+  rbtree_erase(t, node);
+  return 1;
+}
+
+int rbtree_pop_max(rbtree *t, key_t *key)
+{
+  node_t *node = t->rightmost;
+  if (node == t->nil) {
+    return 0;
+  }
+  if (key != NULL) {
+    *key = node->key;
+  }
+  rbtree_erase(t, node);
+  return 1;
+}
+
+#ifdef RBTREE_STATS
+// 서브트리의 노드 수를 count에 더하고 높이(nil은 0)를 돌려준다.
+static size_t stats_walk(const rbtree *t, const node_t *node, size_t *count)
+{
+  if (node == t->nil) {
+    return 0;
+  }
+  (*count)++;
+  size_t lh = stats_walk(t, node->left, count);
+  size_t rh = stats_walk(t, node->right, count);
+  return (lh > rh ? lh : rh) + 1;
+}
+
+void rbtree_get_stats(const rbtree *t, rbtree_stats *out)
+{
+  *out = t->stats;
+  out->find_compares = __atomic_load_n(&t->lookup_stats->find_compares, __ATOMIC_RELAXED);
+#ifdef RBTREE_STATS_LATENCY
+  for (int b = 0; b < RBTREE_STATS_BUCKETS; b++) {
+    out->latency[RBTREE_STAT_FIND][b] = __atomic_load_n(&t->lookup_stats->latency[b], __ATOMIC_RELAXED);
+  }
+#endif
+  out->nodes = 0;
+  out->height = stats_walk(t, t->root, &out->nodes);
+}
+
+void rbtree_reset_stats(rbtree *t)
+{
+  memset(&t->stats, 0, sizeof(t->stats));
+  __atomic_store_n(&t->lookup_stats->find_compares, 0, __ATOMIC_RELAXED);
+#ifdef RBTREE_STATS_LATENCY
+  for (int b = 0; b < RBTREE_STATS_BUCKETS; b++) {
+    __atomic_store_n(&t->lookup_stats->latency[b], 0, __ATOMIC_RELAXED);
+  }
+#endif
+}
+#endif
+
+void rbtree_cursor_init(rbtree_cursor *cursor)
+{
+  cursor->next = NULL;
+  cursor->started = 0;
+#ifdef RBTREE_MULTISET
+  cursor->repeat = 0;
+#endif
+}
+
+// cursor 위치부터 키를 최대 cap개 buf에 쓰고 쓴 개수를 돌려준다. 0이면 순회가 끝난 것이다.
+// 부모 포인터로 다음 노드를 찾으므로 재귀나 추가 메모리 없이 이어서 내보낼 수 있다.
+// 내보내는 도중에 트리가 바뀌면 cursor는 무효가 된다.
+size_t rbtree_export(const rbtree *t, rbtree_cursor *cursor, key_t *buf, const size_t cap)
+{
+  if (t == NULL || cursor == NULL || (buf == NULL && cap > 0)) {
+    return 0;
+  }
+
+  if (!cursor->started) {
+    cursor->started = 1;
+    cursor->next = t->root == t->nil ? NULL : rbtree_min(t);
+  }
 
-  inorder_recursion(node->left, arr, index, nil);
-  arr[(*index)] = node->key;
-  (*index)++;
-  inorder_recursion(node->right, arr, index, nil);
+  size_t written = 0;
+  node_t *node = cursor->next;
+  while (node != NULL && written < cap) {
+#ifdef RBTREE_MULTISET
+    // 키를 개수만큼 반복한다. buf가 중간에 차면 다음 호출에서 남은 개수부터 잇는다.
+    while (cursor->repeat < node->count && written < cap) {
+      buf[written++] = node->key;
+      cursor->repeat++;
+    }
+    if (cursor->repeat < node->count) {
+      break;
+    }
+    cursor->repeat = 0;
+#else
+    buf[written++] = node->key;
+#endif
+    node = rbtree_next(t, node);
+  }
+  cursor->next = node;
+  return written;
 }
 
 int rbtree_to_array(const rbtree *t, key_t *arr, const size_t n)
@@ -432,12 +1217,1394 @@ int rbtree_to_array(const rbtree *t, key_t *arr, const size_t n)
   if (t == NULL || arr == NULL)
     return -1;
 
-  size_t index = 0;
-  inorder_recursion(t->root, arr, &index, t->nil);
+  // arr에는 n개까지만 쓰고, 키 수가 n과 다르면 -1을 돌려준다.
+  rbtree_cursor cursor;
+  rbtree_cursor_init(&cursor);
+  size_t index = rbtree_export(t, &cursor, arr, n);
 
-  if (index != n) {
+  if (index != n || cursor.next != NULL) {
     return -1;
   }
 
   return 0;
 }
+
+// 노드 n개를 균형 있게 쌓았을 때 채워지지 않은 마지막 레벨의 깊이, floor(log2(n + 1)).
+// n = 2^k - 1이면 그 깊이에는 노드가 없다.
+static int last_level_depth(size_t n)
+{
+  int depth = 0;
+  for (size_t m = n + 1; m > 1; m >>= 1) {
+    depth++;
+  }
+  return depth;
+}
+
+// arr[lo, hi)를 가운데에서 나누어 균형 잡힌 서브트리를 만든다.
+// 양쪽 크기 차이가 1 이하이므로 nil은 두 레벨에만 생기고, 마지막 레벨(red_depth)만 레드로 칠하면
+// 모든 경로의 블랙 노드 수가 같아진다.
+static node_t *build_balanced(rbtree *t, node_t *nodes, const key_t *arr, size_t lo, size_t hi,
+                              node_t *parent, int depth, int red_depth)
+{
+  if (lo >= hi) {
+    return t->nil;
+  }
+
+  size_t mid = lo + (hi - lo) / 2;
+  node_t *node = &nodes[mid];
+  set_key(node, arr[mid]);
+  set_parent_color(node, parent, depth == red_depth ? RBTREE_RED : RBTREE_BLACK);
+  node->left = build_balanced(t, nodes, arr, lo, mid, node, depth + 1, red_depth);
+  node->right = build_balanced(t, nodes, arr, mid + 1, hi, node, depth + 1, red_depth);
+  augment_update(node);
+  return node;
+}
+
+// 정렬된 배열로 트리를 O(n)에 만든다. 노드는 한 청크에 키 순서대로 놓인다.
+rbtree *rbtree_from_sorted_array(const key_t *arr, const size_t n)
+{
+  if (arr == NULL && n > 0) {
+    return NULL;
+  }
+
+  rbtree *t = new_rbtree_with_capacity(n);
+  if (!t || n == 0) {
+    return t;
+  }
+
+#ifdef RBTREE_MULTISET
+  // 같은 키가 이어지는 구간을 노드 하나로 모은다. 개수는 노드에 미리 적어 두고 키만 따로 모아 쌓는다.
+  node_t *nodes = (node_t *)t->pool.chunk->nodes;
+  key_t *keys = (key_t *)malloc(n * sizeof(key_t));
+  if (!keys) {
+    delete_rbtree(t);
+    return NULL;
+  }
+  size_t m = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (m == 0 || keys[m - 1] != arr[i]) {
+      keys[m] = arr[i];
+      nodes[m++].count = 0;
+    }
+    nodes[m - 1].count++;
+  }
+  t->root = build_balanced(t, nodes, keys, 0, m, t->nil, 0, last_level_depth(m));
+  t->pool.used = t->nodes = m;
+  free(keys);
+#else
+  t->root = build_balanced(t, (node_t *)t->pool.chunk->nodes, arr, 0, n, t->nil, 0, last_level_depth(n));
+  t->pool.used = t->nodes = n;
+#endif
+  reset_bounds(t);
+  return t;
+}
+
+// 이 크기보다 작은 배열은 스레드 없이 정렬한다.
+#define RBTREE_PARALLEL_SORT_MIN (1 << 20)
+#define RBTREE_SORT_THREADS_MAX 64
+
+// 부호 비트를 뒤집어 int 키를 부호 없는 순서로 바꾼 뒤 8비트씩 4번 기수 정렬한다.
+// 짝수 번 옮기므로 결과는 다시 a에 남는다.
+static void radix_sort(key_t *a, key_t *tmp, size_t n)
+{
+  for (int shift = 0; shift < 32; shift += 8) {
+    size_t count[257] = {0};
+    for (size_t i = 0; i < n; i++) {
+      count[((((uint32_t)a[i] ^ 0x80000000u) >> shift) & 0xff) + 1]++;
+    }
+    for (int b = 0; b < 256; b++) {
+      count[b + 1] += count[b];
+    }
+    for (size_t i = 0; i < n; i++) {
+      tmp[count[(((uint32_t)a[i] ^ 0x80000000u) >> shift) & 0xff]++] = a[i];
+    }
+    key_t *swap = a;
+    a = tmp;
+    tmp = swap;
+  }
+}
+
+typedef struct {
+  key_t *a, *tmp;
+  size_t n;
+} sort_task;
+
+static void *sort_worker(void *arg)
+{
+  sort_task *task = (sort_task *)arg;
+  radix_sort(task->a, task->tmp, task->n);
+  return NULL;
+}
+
+typedef struct {
+  const key_t *a, *b;
+  size_t na, nb;
+  key_t *out;
+} merge_task;
+
+static void *merge_worker(void *arg)
+{
+  merge_task *task = (merge_task *)arg;
+  size_t i = 0, j = 0, k = 0;
+  while (i < task->na && j < task->nb) {
+    task->out[k++] = task->b[j] < task->a[i] ? task->b[j++] : task->a[i++];
+  }
+  while (i < task->na) {
+    task->out[k++] = task->a[i++];
+  }
+  while (j < task->nb) {
+    task->out[k++] = task->b[j++];
+  }
+  return NULL;
+}
+
+// 작업들을 스레드로 나누어 실행한다. 스레드를 만들지 못한 작업은 현재 스레드에서 실행한다.
+static void run_parallel(void *(*worker)(void *), void *tasks, size_t task_size, int n)
+{
+  pthread_t threads[RBTREE_SORT_THREADS_MAX];
+  int spawned[RBTREE_SORT_THREADS_MAX] = {0};
+
+  for (int i = 1; i < n; i++) {
+    spawned[i] = pthread_create(&threads[i], NULL, worker, (char *)tasks + i * task_size) == 0;
+  }
+  worker(tasks);
+  for (int i = 1; i < n; i++) {
+    if (spawned[i]) {
+      pthread_join(threads[i], NULL);
+    } else {
+      worker((char *)tasks + i * task_size);
+    }
+  }
+}
+
+// a[0, n)를 정렬하고 결과가 담긴 버퍼(a 또는 tmp)를 돌려준다.
+// 큰 입력은 조각마다 스레드로 기수 정렬한 뒤, 인접한 조각끼리 병렬로 병합한다.
+static key_t *parallel_sort(key_t *a, key_t *tmp, size_t n)
+{
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int runs = cpus < 1 ? 1 : cpus > RBTREE_SORT_THREADS_MAX ? RBTREE_SORT_THREADS_MAX : (int)cpus;
+  if (n < RBTREE_PARALLEL_SORT_MIN || runs == 1) {
+    radix_sort(a, tmp, n);
+    return a;
+  }
+
+  size_t bounds[RBTREE_SORT_THREADS_MAX + 1];
+  sort_task sorts[RBTREE_SORT_THREADS_MAX];
+  for (int i = 0; i <= runs; i++) {
+    bounds[i] = n * i / runs;
+  }
+  for (int i = 0; i < runs; i++) {
+    sorts[i] = (sort_task){a + bounds[i], tmp + bounds[i], bounds[i + 1] - bounds[i]};
+  }
+  run_parallel(sort_worker, sorts, sizeof(sort_task), runs);
+
+  key_t *src = a, *dst = tmp;
+  while (runs > 1) {
+    merge_task merges[RBTREE_SORT_THREADS_MAX / 2];
+    int pairs = runs / 2;
+    for (int i = 0; i < pairs; i++) {
+      size_t lo = bounds[2 * i], mid = bounds[2 * i + 1], hi = bounds[2 * i + 2];
+      merges[i] = (merge_task){src + lo, src + mid, mid - lo, hi - mid, dst + lo};
+    }
+    run_parallel(merge_worker, merges, sizeof(merge_task), pairs);
+
+    // 짝이 없는 마지막 조각은 그대로 옮긴다.
+    if (runs % 2) {
+      memcpy(dst + bounds[runs - 1], src + bounds[runs - 1], (n - bounds[runs - 1]) * sizeof(key_t));
+    }
+    for (int i = 0; i <= pairs; i++) {
+      bounds[i] = bounds[i * 2 < runs ? i * 2 : runs];
+    }
+    runs = (runs + 1) / 2;
+    bounds[runs] = n;
+
+    key_t *swap = src;
+    src = dst;
+    dst = swap;
+  }
+  return src;
+}
+
+// 정렬되지 않은 배열로 트리를 만든다. 정렬 후 rbtree_from_sorted_array와 같은 방식으로 만든다.
+rbtree *rbtree_from_array(const key_t *arr, const size_t n)
+{
+  if (arr == NULL && n > 0) {
+    return NULL;
+  }
+  if (n > SIZE_MAX / (2 * sizeof(key_t))) {
+    return NULL;
+  }
+
+  key_t *buf = (key_t *)malloc((n ? n : 1) * 2 * sizeof(key_t));
+  if (!buf) {
+    return NULL;
+  }
+
+  memcpy(buf, arr, n * sizeof(key_t));
+  rbtree *t = rbtree_from_sorted_array(parallel_sort(buf, buf + n, n), n);
+  free(buf);
+  return t;
+}
+
+// node에서 가장 왼쪽 경로의 블랙 노드 수(nil 제외)
+static int black_height(const node_t *nil, const node_t *node)
+{
+  int height = 0;
+  for (; node != nil; node = node->left) {
+    if (rbtree_color(node) == RBTREE_BLACK) {
+      height++;
+    }
+  }
+  return height;
+}
+
+// 이미 키가 들어 있는 nodes[lo, hi)를 build_balanced와 같은 모양으로 다시 연결한다.
+static node_t *link_balanced(rbtree *t, node_t **nodes, size_t lo, size_t hi,
+                             node_t *parent, int depth, int red_depth)
+{
+  if (lo >= hi) {
+    return t->nil;
+  }
+
+  size_t mid = lo + (hi - lo) / 2;
+  node_t *node = nodes[mid];
+  set_parent_color(node, parent, depth == red_depth ? RBTREE_RED : RBTREE_BLACK);
+  node->left = link_balanced(t, nodes, lo, mid, node, depth + 1, red_depth);
+  node->right = link_balanced(t, nodes, mid + 1, hi, node, depth + 1, red_depth);
+  augment_update(node);
+  return node;
+}
+
+// radix_sort와 같은 방식으로 연산을 키 순으로 정렬한다. 기수 정렬은 안정적이므로
+// 같은 키의 연산은 입력 순서를 유지한다.
+static void radix_sort_ops(op_t *a, op_t *tmp, size_t n)
+{
+  for (int shift = 0; shift < 32; shift += 8) {
+    size_t count[257] = {0};
+    for (size_t i = 0; i < n; i++) {
+      count[((((uint32_t)a[i].key ^ 0x80000000u) >> shift) & 0xff) + 1]++;
+    }
+    for (int b = 0; b < 256; b++) {
+      count[b + 1] += count[b];
+    }
+    for (size_t i = 0; i < n; i++) {
+      tmp[count[(((uint32_t)a[i].key ^ 0x80000000u) >> shift) & 0xff]++] = a[i];
+    }
+    op_t *swap = a;
+    a = tmp;
+    tmp = swap;
+  }
+}
+
+static int push_node(node_t ***nodes, size_t *cap, size_t *n, node_t *node)
+{
+  if (*n == *cap) {
+    node_t **grown = (node_t **)realloc(*nodes, *cap * 2 * sizeof(node_t *));
+    if (!grown) {
+      return -1;
+    }
+    *nodes = grown;
+    *cap *= 2;
+  }
+  (*nodes)[(*n)++] = node;
+  return 0;
+}
+
+#ifdef RBTREE_MULTISET
+// merge_rebuild가 트리를 다시 이을 때 노드에 적을 개수
+typedef struct {
+  node_t *node;
+  size_t count;
+} count_update;
+#endif
+
+// 기존 노드를 중위 순회하면서 정렬된 연산과 합병한 뒤, 결과 노드들로 균형 트리를 다시 연결한다.
+// 회전이나 fixup 없이 O(n + m)에 끝나며, 살아남은 노드는 주소가 그대로 유지된다.
+// fresh에서 쓰지 않은 노드(멀티셋 모드에서 이미 있던 키)는 풀에 반납한다.
+static int merge_rebuild(rbtree *t, const op_t *ops, size_t m, node_t **fresh, size_t n_fresh)
+{
+  size_t cap = m + 64, out = 0, n_erased = 0, f = 0;
+  node_t **merged = (node_t **)malloc(cap * sizeof(node_t *));
+  node_t **erased = (node_t **)malloc(m * sizeof(node_t *));
+#ifdef RBTREE_MULTISET
+  size_t n_updates = 0;
+  count_update *updates = (count_update *)malloc(m * sizeof(count_update));
+  if (!updates) {
+    goto fail;
+  }
+#endif
+  if (!merged || !erased) {
+    goto fail;
+  }
+
+  node_t *node = rbtree_min(t);
+  for (size_t i = 0; i < m;) {
+    const key_t key = ops[i].key;
+
+    // key보다 작은 기존 노드는 그대로 옮긴다.
+    while (node != t->nil && node->key < key) {
+      if (push_node(&merged, &cap, &out, node) < 0) {
+        goto fail;
+      }
+      node = next_node(t, node);
+    }
+
+    // 같은 키의 기존 노드를 모은 뒤, 그 키의 연산을 순서대로 적용한다.
+    size_t group = out;
+    while (node != t->nil && node->key == key) {
+      if (push_node(&merged, &cap, &out, node) < 0) {
+        goto fail;
+      }
+      node = next_node(t, node);
+    }
+#ifdef RBTREE_MULTISET
+    // 같은 키의 노드는 많아야 하나이므로 연산을 개수에 모았다가 다시 이을 때 적는다.
+    node_t *holder = out > group ? merged[out - 1] : NULL;
+    size_t count = holder ? holder->count : 0;
+    for (; i < m && ops[i].key == key; i++) {
+      if (ops[i].kind == RBTREE_OP_INSERT) {
+        count++;
+      } else if (count > 0) {
+        count--;
+      }
+    }
+    if (count > 0 && holder == NULL) {
+      holder = fresh[f++];
+      set_key(holder, key);
+      if (push_node(&merged, &cap, &out, holder) < 0) {
+        goto fail;
+      }
+    } else if (count == 0 && holder != NULL) {
+      erased[n_erased++] = merged[--out];
+    }
+    if (count > 0) {
+      updates[n_updates].node = holder;
+      updates[n_updates++].count = count;
+    }
+#else
+    for (; i < m && ops[i].key == key; i++) {
+      if (ops[i].kind == RBTREE_OP_INSERT) {
+        set_key(fresh[f], key);
+        if (push_node(&merged, &cap, &out, fresh[f++]) < 0) {
+          goto fail;
+        }
+      } else if (out > group) {
+        erased[n_erased++] = merged[--out];
+      }
+    }
+#endif
+  }
+  while (node != t->nil) {
+    if (push_node(&merged, &cap, &out, node) < 0) {
+      goto fail;
+    }
+    node = next_node(t, node);
+  }
+
+  // 여기부터는 실패하지 않는다. 순회가 끝난 뒤에 트리를 바꾼다.
+#ifdef RBTREE_MULTISET
+  for (size_t i = 0; i < n_updates; i++) {
+    updates[i].node->count = updates[i].count;
+  }
+  free(updates);
+#endif
+  t->root = link_balanced(t, merged, 0, out, t->nil, 0, last_level_depth(out));
+  t->nodes = out;
+  reset_bounds(t);
+  for (size_t i = 0; i < n_erased; i++) {
+    pool_free(&t->pool, erased[i]);
+  }
+  while (f < n_fresh) {
+    pool_free(&t->pool, fresh[f++]);
+  }
+
+  free(erased);
+  free(merged);
+  return 0;
+
+fail:
+#ifdef RBTREE_MULTISET
+  free(updates);
+#endif
+  free(erased);
+  free(merged);
+  return -1;
+}
+
+// 직전에 다룬 노드(finger)에서 위로 올라가 key가 들어갈 범위를 덮는 서브트리를 찾는다.
+// 키가 오름차순으로 오므로 아래쪽 경계는 항상 만족하고, 왼쪽 자식으로 내려왔던 조상의 키가
+// key보다 크면 그 서브트리에서 내려가면 된다.
+static node_t *finger_start(const rbtree *t, node_t *finger, const key_t key)
+{
+  if (finger == t->nil) {
+    return t->root;
+  }
+
+  node_t *x = finger;
+  while (x != t->root) {
+    node_t *parent = rbtree_parent(x);
+    if (x == parent->left && key < parent->key) {
+      return x;
+    }
+    x = parent;
+  }
+  return t->root;
+}
+
+// 트리에 비해 작은 배치는 직전 위치에서 이어서 내려가며 하나씩 적용한다.
+static void finger_apply(rbtree *t, const op_t *ops, size_t m, node_t **fresh)
+{
+  node_t *finger = t->nil;
+  size_t f = 0;
+
+  for (size_t i = 0; i < m; i++) {
+    const key_t key = ops[i].key;
+    node_t *start = finger_start(t, finger, key);
+
+    if (ops[i].kind == RBTREE_OP_INSERT) {
+      set_key(fresh[f], key);
+      finger = insert_node(t, start, key, fresh[f]);
+      if (finger != fresh[f]) {
+        pool_free(&t->pool, fresh[f]); // 멀티셋 모드에서 이미 있던 키
+      }
+      f++;
+      continue;
+    }
+
+    node_t *z = start;
+    while (z != t->nil && z->key != key) {
+      z = key < z->key ? z->left : z->right;
+    }
+    // 같은 키가 서브트리 왼쪽 바깥에 있을 수 있으므로 못 찾으면 루트에서 다시 찾는다.
+    if (z == t->nil) {
+      z = start == t->root ? NULL : rbtree_find(t, key);
+      if (z == NULL) {
+        continue;
+      }
+    }
+#ifdef RBTREE_MULTISET
+    if (z->count > 1) {
+      finger = z;
+      rbtree_erase(t, z);
+      continue;
+    }
+#endif
+    finger = prev_node(t, z);
+    rbtree_erase(t, z);
+  }
+}
+
+// 다시 만들 때 노드 하나에 드는 비용(훑기, 모으기, 다시 잇기)을 탐색 한 단계의 몇 배로 볼지.
+// 무작위 트리에서 재어 보면 노드 100만 개에서 m이 n의 두세 배쯤일 때 두 경로가 비슷하다.
+#ifndef RBTREE_BATCH_REBUILD_COST
+#define RBTREE_BATCH_REBUILD_COST 40
+#endif
+
+// 하나씩 적용하는 비용 m log2 n이 트리 전체를 다시 만드는 비용 c n보다 크면 1
+// split으로 나눈 뒤처럼 노드 수를 모르면 세어 본다. c k가 m log2 k를 넘는 순간 답이 정해지므로
+// 거기서 멈추고, 끝까지 셌으면 그 수를 트리에 적어 둔다. 어느 쪽이든 O(m log n) 안에 끝난다.
+static int batch_rebuilds(rbtree *t, const size_t m)
+{
+  size_t n = t->nodes;
+  if (n == RBTREE_NODES_UNKNOWN) {
+    n = 0;
+    for (node_t *node = t->leftmost; node != t->nil; node = next_node(t, node)) {
+      n++;
+      if (RBTREE_BATCH_REBUILD_COST * n / (size_t)(64 - __builtin_clzll(n)) > m) {
+        return 0;
+      }
+    }
+    t->nodes = n;
+  }
+  return n == 0 || RBTREE_BATCH_REBUILD_COST * n / (size_t)(64 - __builtin_clzll(n)) <= m;
+}
+
+int rbtree_apply_batch(rbtree *t, const op_t *ops, const size_t m)
+{
+  if (t == NULL || (ops == NULL && m > 0)) {
+    return -1;
+  }
+  if (m == 0) {
+    return 0;
+  }
+  if (m > SIZE_MAX / (2 * sizeof(op_t))) {
+    return -1;
+  }
+
+  op_t *sorted = (op_t *)malloc(m * 2 * sizeof(op_t));
+  node_t **fresh = (node_t **)malloc(m * sizeof(node_t *));
+  if (!sorted || !fresh) {
+    free(fresh);
+    free(sorted);
+    return -1;
+  }
+  memcpy(sorted, ops, m * sizeof(op_t));
+  radix_sort_ops(sorted, sorted + m, m);
+
+  // 삽입할 노드를 먼저 모두 확보해 두면 중간에 실패해도 트리는 바뀌지 않는다.
+  size_t inserts = 0;
+  for (size_t i = 0; i < m; i++) {
+    if (sorted[i].kind != RBTREE_OP_INSERT) {
+      continue;
+    }
+    if ((fresh[inserts] = pool_alloc(&t->pool)) == NULL) {
+      goto fail;
+    }
+    inserts++;
+  }
+
+  if (batch_rebuilds(t, m)) {
+    if (merge_rebuild(t, sorted, m, fresh, inserts) < 0) {
+      goto fail;
+    }
+  } else {
+    finger_apply(t, sorted, m, fresh);
+  }
+
+  free(fresh);
+  free(sorted);
+  return 0;
+
+fail:
+  while (inserts > 0) {
+    pool_free(&t->pool, fresh[--inserts]);
+  }
+  free(fresh);
+  free(sorted);
+  return -1;
+}
+
+// 집합 연산에 쓸 최대 스레드 수. 0이면 온라인 CPU 수만큼 쓴다.
+#ifndef RBTREE_SETOP_THREADS
+#define RBTREE_SETOP_THREADS 0
+#endif
+
+// 블랙 높이가 이보다 낮은 서브트리(노드 약 4천 개 미만)는 스레드를 나누지 않는다.
+#define RBTREE_SETOP_FORK_BH 12
+
+// 결과 루트를 트리에 연결한다. 떼어 낸 서브트리의 루트는 부모가 남아 있거나 레드일 수 있다.
+static void set_root(rbtree *t, node_t *root)
+{
+  if (root != t->nil) {
+    set_parent_color(root, t->nil, RBTREE_BLACK);
+  }
+  set_link(&t->root, root);
+  reset_bounds(t);
+}
+
+// l의 모든 키 <= k의 키 <= r의 모든 키일 때 셋을 하나의 rbtree로 잇고 루트를 돌려준다.
+// hl, hr은 l과 r의 블랙 높이(black_height와 같이 루트가 블랙이면 루트도 센다)이고, 결과의 블랙 높이는 *h에 적는다.
+// 높이가 큰 쪽의 바깥 경로를 따라 내려가 높이가 같은 블랙 서브트리 자리에 k를 레드로 끼우고,
+// 삽입과 같은 fixup으로 복구한다. 높이를 받으므로 O(|hl - hr| + 1)이다.
+static node_t *join_node(node_t *nil, node_t *l, int hl, node_t *k, node_t *r, int hr, int *h)
+{
+  // 트리에서 떼어 낸 서브트리는 루트를 블랙으로 바꿔도 rbtree이다. 레드였으면 높이가 1 는다.
+  if (l != nil) {
+    hl += rbtree_color(l) == RBTREE_RED;
+    set_parent_color(l, nil, RBTREE_BLACK);
+  }
+  if (r != nil) {
+    hr += rbtree_color(r) == RBTREE_RED;
+    set_parent_color(r, nil, RBTREE_BLACK);
+  }
+
+  const int from_left = hl >= hr; // l의 오른쪽 경로를 내려가면 1, r의 왼쪽 경로를 내려가면 0
+  const int target = from_left ? hr : hl;
+  const int top = from_left ? hl : hr;
+
+  // 회전과 fixup이 루트를 바꿀 수 있도록 서브트리를 임시 트리로 감싼다.
+  rbtree view = {.root = from_left ? l : r, .nil = nil, .nodes = RBTREE_NODES_UNKNOWN};
+  node_t *parent = nil;
+  node_t *current = view.root;
+  int height = top;
+  while (height > target || rbtree_color(current) == RBTREE_RED) {
+    if (rbtree_color(current) == RBTREE_BLACK) {
+      height--;
+    }
+    parent = current;
+    current = from_left ? current->right : current->left;
+  }
+
+  k->left = from_left ? current : l;
+  k->right = from_left ? r : current;
+  set_parent_color(k, parent, RBTREE_RED);
+  if (k->left != nil) {
+    set_parent(k->left, k);
+  }
+  if (k->right != nil) {
+    set_parent(k->right, k);
+  }
+  if (parent == nil) {
+    view.root = k;
+  } else if (from_left) {
+    set_link(&parent->right, k);
+  } else {
+    set_link(&parent->left, k);
+  }
+
+  augment_update(k);
+  augment_propagate(&view, parent);
+  // 끼우기 전의 높이는 큰 쪽의 높이이고(k가 루트가 되면 두 높이가 같다), fixup은 루트를 블랙으로 바꿀 때만 높인다.
+  *h = top + rbtree_insert_fixup(&view, k);
+  return view.root;
+}
+
+// 블랙 높이가 h인 node 서브트리에서 가장 큰 노드를 떼어 *last로 돌려주고, 나머지 트리와 그 높이(*rest_h)를 만든다.
+// split_lt처럼 내려간 경로의 왼쪽 서브트리들을 아래에서부터 잇는다. O(log n)
+static node_t *split_last(node_t *nil, node_t *node, const int h, node_t **last, int *rest_h)
+{
+  const int hc = h - (rbtree_color(node) == RBTREE_BLACK); // 자식 서브트리의 블랙 높이
+  if (node->right == nil) {
+    *last = node;
+    *rest_h = hc;
+    return node->left;
+  }
+
+  node_t *left = node->left, *rest;
+  int h_rest;
+  rest = split_last(nil, node->right, hc, last, &h_rest);
+  return join_node(nil, left, hc, node, rest, h_rest, rest_h);
+}
+
+// l의 모든 키 <= r의 모든 키일 때 둘을 잇는다. l의 최대 노드를 떼어 내 가운데 노드로 쓴다. O(log n)
+static node_t *join2(node_t *nil, node_t *l, const int hl, node_t *r, const int hr, int *h)
+{
+  if (l == nil) {
+    *h = hr;
+    return r;
+  }
+  if (r == nil) {
+    *h = hl;
+    return l;
+  }
+
+  node_t *max;
+  int h_rest;
+  node_t *rest = split_last(nil, l, hl, &max, &h_rest);
+  return join_node(nil, rest, h_rest, max, r, hr, h);
+}
+
+// 블랙 높이가 h인 node 서브트리를 key보다 작은 키(*l)와 key 이상인 키(*r)로 나누고 각각의 높이를 *hl, *hr에 적는다.
+// 내려가면서 자식의 높이를 구하고, 떨어져 나온 서브트리들을 아래에서부터 join_node로 다시 잇는다.
+// 이어 붙이는 비용이 높이 차이만큼이고 그 합이 높이로 줄어들므로 전체 O(log n)이다.
+static void split_lt(node_t *nil, node_t *node, const int h, const key_t key, node_t **l, int *hl, node_t **r, int *hr)
+{
+  if (node == nil) {
+    *l = *r = nil;
+    *hl = *hr = 0;
+    return;
+  }
+
+  const int hc = h - (rbtree_color(node) == RBTREE_BLACK);
+  node_t *left = node->left, *right = node->right, *mid;
+  int h_mid;
+  if (key <= node->key) {
+    split_lt(nil, left, hc, key, l, hl, &mid, &h_mid);
+    *r = join_node(nil, mid, h_mid, node, right, hc, hr);
+  } else {
+    split_lt(nil, right, hc, key, &mid, &h_mid, r, hr);
+    *l = join_node(nil, left, hc, node, mid, h_mid, hl);
+  }
+}
+
+// split_lt와 같지만 key와 같은 노드를 만나면 그 노드를 *found로 떼어 내고 나머지를 양쪽으로 나눈다.
+// 없으면 *found는 nil이다.
+static void split3(node_t *nil, node_t *node, const int h, const key_t key, node_t **l, int *hl, node_t **found,
+                   node_t **r, int *hr)
+{
+  if (node == nil) {
+    *l = *r = *found = nil;
+    *hl = *hr = 0;
+    return;
+  }
+
+  const int hc = h - (rbtree_color(node) == RBTREE_BLACK);
+  node_t *left = node->left, *right = node->right, *mid;
+  int h_mid;
+  if (key == node->key) {
+    *l = left;
+    *found = node;
+    *r = right;
+    *hl = *hr = hc;
+  } else if (key < node->key) {
+    split3(nil, left, hc, key, l, hl, found, &mid, &h_mid);
+    *r = join_node(nil, mid, h_mid, node, right, hc, hr);
+  } else {
+    split3(nil, right, hc, key, &mid, &h_mid, found, r, hr);
+    *l = join_node(nil, left, hc, node, mid, h_mid, hl);
+  }
+}
+
+// 두 트리의 노드 수를 더한다. 한쪽이라도 모르면 결과도 모른다.
+static size_t nodes_add(const size_t a, const size_t b)
+{
+  return a == RBTREE_NODES_UNKNOWN || b == RBTREE_NODES_UNKNOWN ? RBTREE_NODES_UNKNOWN : a + b;
+}
+
+int rbtree_join(rbtree *t1, const key_t key, rbtree *t2)
+{
+  if (t1 == NULL || t2 == NULL || t1 == t2 || t1->nil != t2->nil || !allocator_equal(&t1->allocator, &t2->allocator)) {
+    return -1;
+  }
+  if ((t1->root != t1->nil && rbtree_max(t1)->key > key) || (t2->root != t2->nil && rbtree_min(t2)->key < key)) {
+    return -1;
+  }
+
+#ifdef RBTREE_MULTISET
+  // 가운데 키가 이미 한쪽 끝에 있으면 그 노드의 개수로 세고, 양쪽 끝에 모두 있으면 t1의 노드로 모은다.
+  node_t *max1 = t1->root != t1->nil ? rbtree_max(t1) : NULL;
+  node_t *min2 = t2->root != t2->nil ? rbtree_min(t2) : NULL;
+  if (min2 != NULL && min2->key != key) {
+    min2 = NULL;
+  }
+  node_t *same = max1 != NULL && max1->key == key ? max1 : min2;
+  if (same != NULL) {
+    same->count++;
+    if (same != min2 && min2 != NULL) {
+      same->count += min2->count;
+      rbtree_unlink(t2, min2);
+      pool_free(&t2->pool, min2);
+    }
+    augment_propagate(same == min2 ? t2 : t1, same);
+    pool_merge(&t1->pool, &t2->pool);
+    t1->nodes = nodes_add(t1->nodes, t2->nodes);
+    int h;
+    set_root(t1, join2(t1->nil, t1->root, black_height(t1->nil, t1->root), t2->root,
+                       black_height(t2->nil, t2->root), &h));
+    tree_free(t2);
+    return 0;
+  }
+#endif
+
+  // 가운데 노드를 먼저 확보해 두면 실패해도 두 트리는 바뀌지 않는다.
+  node_t *k = pool_alloc(&t1->pool);
+  if (k == NULL) {
+    return -1;
+  }
+  set_key(k, key);
+#ifdef RBTREE_MULTISET
+  k->count = 1;
+#endif
+
+  pool_merge(&t1->pool, &t2->pool);
+  t1->nodes = nodes_add(nodes_add(t1->nodes, t2->nodes), 1);
+  int h;
+  set_root(t1, join_node(t1->nil, t1->root, black_height(t1->nil, t1->root), k, t2->root,
+                         black_height(t2->nil, t2->root), &h));
+  tree_free(t2);
+  return 0;
+}
+
+rbtree *rbtree_split(rbtree *t, const key_t key)
+{
+  if (t == NULL) {
+    return NULL;
+  }
+
+  // 떼어 낸 노드는 t의 청크에 그대로 있으므로 새 트리는 t와 arena를 함께 쓴다.
+  rbtree *r = tree_alloc(&t->allocator);
+  if (!r) {
+    return NULL;
+  }
+  r->nil = t->nil;
+  pool_init(&r->pool, &t->pool, NULL);
+
+  node_t *left, *right;
+  int hl, hr;
+  split_lt(t->nil, t->root, black_height(t->nil, t->root), key, &left, &hl, &right, &hr);
+#if defined(RBTREE_ORDER_STATS) && !defined(RBTREE_MULTISET)
+  t->nodes = left->size;
+  r->nodes = right->size;
+#else
+  // 양쪽으로 몇 개씩 갔는지는 세어 봐야 알므로 한쪽이 비었을 때만 적고, 나머지는 apply_batch가 필요할 때 센다.
+  const size_t total = t->nodes;
+  t->nodes = right == t->nil ? total : left == t->nil ? 0 : RBTREE_NODES_UNKNOWN;
+  r->nodes = left == t->nil ? total : right == t->nil ? 0 : RBTREE_NODES_UNKNOWN;
+#endif
+  set_root(t, left);
+  set_root(r, right);
+  return r;
+}
+
+// 트리에서 빠지는 노드 목록(right로 연결). 스레드마다 따로 모았다가 끝에 풀에 한 번에 반납한다.
+typedef struct {
+  node_t *head, *tail;
+} node_list;
+
+static void list_push(node_list *list, node_t *node)
+{
+  node->right = list->head;
+  if (!list->head) {
+    list->tail = node;
+  }
+  list->head = node;
+}
+
+static void list_append(node_list *list, const node_list *other)
+{
+  if (!other->head) {
+    return;
+  }
+  other->tail->right = list->head;
+  if (!list->head) {
+    list->tail = other->tail;
+  }
+  list->head = other->head;
+}
+
+static size_t list_length(const node_list *list)
+{
+  size_t n = 0;
+  for (const node_t *node = list->head; node != NULL; node = node->right) {
+    n++;
+  }
+  return n;
+}
+
+// 서브트리의 노드를 모두 목록에 넣고 담긴 키 수를 돌려준다. 서브트리는 버리는 것이므로
+// 왼쪽 자식이 있으면 우회전해 올리고, 없으면 노드를 떼어 오른쪽으로 간다. 높이와 관계없이 추가 공간은 O(1)이다.
+static size_t list_push_subtree(const node_t *nil, node_list *list, node_t *node)
+{
+  size_t n = 0;
+  while (node != nil) {
+    node_t *left = node->left;
+    if (left != nil) {
+      node->left = left->right;
+      left->right = node;
+      node = left;
+      continue;
+    }
+    node_t *right = node->right;
+    n += node_weight(node);
+    list_push(list, node);
+    node = right;
+  }
+  return n;
+}
+
+typedef enum { SETOP_UNION, SETOP_INTERSECTION, SETOP_DIFFERENCE } setop_kind;
+
+typedef struct {
+  setop_kind kind;
+  node_t *nil;
+  node_t *a, *b;
+  int ha, hb; // a와 b의 블랙 높이
+  int spawn;  // 스레드를 더 나눌 수 있는 재귀 깊이
+  node_t *result;
+  int h; // 결과의 블랙 높이
+  node_list garbage;
+} setop_task;
+
+static void *setop_worker(void *);
+
+// a의 루트 키로 b를 나누고 양쪽을 재귀로 합친 뒤 a의 루트로 다시 잇는다.
+// 두 재귀는 서로 다른 노드만 건드리므로 큰 입력에서는 한쪽을 새 스레드에서 실행한다.
+// 빠지는 노드는 garbage에 모은다. 블랙 높이는 split과 같이 내려가며 구하고 결과의 높이를 *h에 적는다.
+// 작업량은 O(m log(n / m + 1)), m <= n이다.
+static node_t *set_op(setop_kind kind, node_t *nil, node_t *a, const int ha, node_t *b, const int hb, int spawn,
+                      node_list *garbage, int *h)
+{
+  if (a == nil || b == nil) {
+    if (kind == SETOP_UNION) {
+      *h = a == nil ? hb : ha;
+      return a == nil ? b : a;
+    }
+    list_push_subtree(nil, garbage, b);
+    if (kind == SETOP_INTERSECTION) {
+      list_push_subtree(nil, garbage, a);
+      *h = 0;
+      return nil;
+    }
+    *h = ha;
+    return a;
+  }
+
+  node_t *k = a, *l2, *dup, *r2;
+  node_t *r1 = a->right;
+  const int hc = ha - (rbtree_color(a) == RBTREE_BLACK);
+  int hl2, hr2;
+  split3(nil, b, hb, k->key, &l2, &hl2, &dup, &r2, &hr2);
+
+  setop_task task = {kind, nil, a->left, l2, hc, hl2, spawn - 1, nil, 0, {NULL, NULL}};
+  pthread_t thread;
+  int forked = spawn > 0 && (ha >= RBTREE_SETOP_FORK_BH || hb >= RBTREE_SETOP_FORK_BH) &&
+               pthread_create(&thread, NULL, setop_worker, &task) == 0;
+  if (!forked) {
+    setop_worker(&task);
+  }
+  int hr;
+  node_t *r = set_op(kind, nil, r1, hc, r2, hr2, spawn - 1, garbage, &hr);
+  if (forked) {
+    pthread_join(thread, NULL);
+  }
+  list_append(garbage, &task.garbage);
+  node_t *l = task.result;
+  const int hl = task.h;
+
+  // 같은 키는 a의 노드를 남긴다.
+#ifdef RBTREE_MULTISET
+  if (dup != nil) {
+    if (kind == SETOP_UNION) {
+      k->count += dup->count;
+    } else if (kind == SETOP_INTERSECTION) {
+      k->count = k->count < dup->count ? k->count : dup->count;
+    } else {
+      k->count = k->count > dup->count ? k->count - dup->count : 0;
+    }
+  }
+  const int keep = k->count > 0 && (kind != SETOP_INTERSECTION || dup != nil);
+#else
+  const int keep = kind == SETOP_UNION || (kind == SETOP_INTERSECTION ? dup != nil : dup == nil);
+#endif
+  if (dup != nil) {
+    list_push(garbage, dup);
+  }
+  if (keep) {
+    return join_node(nil, l, hl, k, r, hr, h);
+  }
+  list_push(garbage, k);
+  return join2(nil, l, hl, r, hr, h);
+}
+
+static void *setop_worker(void *arg)
+{
+  setop_task *task = (setop_task *)arg;
+  task->result = set_op(task->kind, task->nil, task->a, task->ha, task->b, task->hb, task->spawn, &task->garbage,
+                        &task->h);
+  return NULL;
+}
+
+// 스레드를 나눌 재귀 깊이. 깊이 d까지 나누면 최대 2^d개의 스레드가 함께 돈다.
+static int setop_spawn_depth(void)
+{
+  long threads = RBTREE_SETOP_THREADS > 0 ? RBTREE_SETOP_THREADS : sysconf(_SC_NPROCESSORS_ONLN);
+  int depth = 0;
+  while ((1L << depth) < threads && (1L << depth) < RBTREE_SORT_THREADS_MAX) {
+    depth++;
+  }
+  return depth;
+}
+
+// t2의 노드를 t1으로 옮겨 집합 연산을 하고, 빠진 노드는 t1의 풀에 반납한 뒤 t2를 해제한다.
+static int set_operation(rbtree *t1, rbtree *t2, setop_kind kind)
+{
+  if (t1 == NULL || t2 == NULL || t1 == t2 || t1->nil != t2->nil || !allocator_equal(&t1->allocator, &t2->allocator)) {
+    return -1;
+  }
+
+  node_list garbage = {NULL, NULL};
+  int h;
+  node_t *root = set_op(kind, t1->nil, t1->root, black_height(t1->nil, t1->root), t2->root,
+                        black_height(t2->nil, t2->root), setop_spawn_depth(), &garbage, &h);
+
+  t1->nodes = nodes_add(t1->nodes, t2->nodes);
+  if (t1->nodes != RBTREE_NODES_UNKNOWN) {
+    t1->nodes -= list_length(&garbage);
+  }
+  pool_merge(&t1->pool, &t2->pool);
+  pool_free_list(&t1->pool, garbage.head, garbage.tail);
+  set_root(t1, root);
+  tree_free(t2);
+  return 0;
+}
+
+int rbtree_union(rbtree *t1, rbtree *t2)
+{
+  return set_operation(t1, t2, SETOP_UNION);
+}
+
+int rbtree_intersection(rbtree *t1, rbtree *t2)
+{
+  return set_operation(t1, t2, SETOP_INTERSECTION);
+}
+
+int rbtree_difference(rbtree *t1, rbtree *t2)
+{
+  return set_operation(t1, t2, SETOP_DIFFERENCE);
+}
+
+// [lo, hi]를 split으로 떼어 내 반납하고 남은 양쪽을 다시 잇는다. O(log n + 지운 수)
+size_t rbtree_erase_range(rbtree *t, const key_t lo, const key_t hi)
+{
+  if (t == NULL || lo > hi) {
+    return 0;
+  }
+
+  node_t *left, *mid, *right = t->nil;
+  int h_left, h_mid, h_right = 0, h;
+  split_lt(t->nil, t->root, black_height(t->nil, t->root), lo, &left, &h_left, &mid, &h_mid);
+  if (hi < RBTREE_KEY_MAX) {
+    split_lt(t->nil, mid, h_mid, hi + 1, &mid, &h_mid, &right, &h_right);
+  }
+
+  node_list erased = {NULL, NULL};
+  size_t n = list_push_subtree(t->nil, &erased, mid);
+  if (t->nodes != RBTREE_NODES_UNKNOWN) {
+#ifdef RBTREE_MULTISET
+    t->nodes -= list_length(&erased);
+#else
+    t->nodes -= n;
+#endif
+  }
+  pool_free_list(&t->pool, erased.head, erased.tail);
+  set_root(t, join2(t->nil, left, h_left, right, h_right, &h));
+  return n;
+}
+
+void rbtree_clear(rbtree *t)
+{
+  if (t == NULL) {
+    return;
+  }
+
+  // 청크를 다른 트리와 함께 쓰면 이 트리의 노드만 골라 free list로 돌려준다.
+  if (pool_rewind(&t->pool) < 0) {
+    node_list cleared = {NULL, NULL};
+    list_push_subtree(t->nil, &cleared, t->root);
+    pool_free_list(&t->pool, cleared.head, cleared.tail);
+  }
+  t->nodes = 0;
+  set_root(t, t->nil);
+}
+
+// 이미지 파일 머리. RBTREE_IMAGE_NODES 위치부터 노드 배열이 오고, 0번 노드가 이 이미지의 nil이다.
+// 노드의 링크는 노드 배열의 시작부터 잰 바이트 오프셋(번호 * sizeof(node_t))으로 저장하므로
+// 이미지는 어느 주소에나 매핑할 수 있다.
+#define RBTREE_IMAGE_MAGIC "RBTIMG02"
+#define RBTREE_IMAGE_NODES 64
+
+typedef struct {
+  char magic[8];
+  uint32_t node_size; // sizeof(node_t)
+  uint32_t layout;    // 노드 배치를 바꾸는 컴파일 옵션
+  uint64_t count;     // nil을 포함한 노드 수
+  uint64_t root;      // 루트 노드의 번호(빈 트리면 0)
+  uint64_t check;     // 앞 필드들의 FNV-1a 해시
+} rbtree_image_header;
+
+static uint32_t image_layout(void)
+{
+  uint32_t layout = 0;
+#ifdef RBTREE_COMPACT
+  layout |= 1;
+#endif
+#ifdef RBTREE_ORDER_STATS
+  layout |= 2;
+#endif
+#ifdef RBTREE_INTERVAL
+  layout |= 4;
+#endif
+#ifdef RBTREE_MULTISET
+  layout |= 8;
+#endif
+  return layout;
+}
+
+static uint64_t image_check(const rbtree_image_header *header)
+{
+  const unsigned char *p = (const unsigned char *)header;
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < offsetof(rbtree_image_header, check); i++) {
+    hash = (hash ^ p[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// 파일에 저장하는 index번 노드의 링크
+static node_t *image_link(size_t index)
+{
+  return (node_t *)(uintptr_t)(index * sizeof(node_t));
+}
+
+// 트리를 너비 우선 순서로 번호를 매겨 저장한다. 위쪽 레벨이 파일 앞쪽에 모이므로
+// 매핑한 뒤 처음 몇 번의 탐색이 적은 페이지만 읽는다.
+int rbtree_save(const rbtree *t, const char *path)
+{
+  if (t == NULL || path == NULL) {
+    return -1;
+  }
+
+  size_t cap = 64, n = 0;
+  node_t **order = (node_t **)malloc(cap * sizeof(node_t *));
+  if (!order || (t->root != t->nil && push_node(&order, &cap, &n, t->root) < 0)) {
+    free(order);
+    return -1;
+  }
+  for (size_t i = 0; i < n; i++) {
+    if ((order[i]->left != t->nil && push_node(&order, &cap, &n, order[i]->left) < 0) ||
+        (order[i]->right != t->nil && push_node(&order, &cap, &n, order[i]->right) < 0)) {
+      free(order);
+      return -1;
+    }
+  }
+
+  // 자식의 번호는 너비 우선으로 다시 훑으면서 매기고, 부모 번호는 자식을 만날 때 기록해 둔다.
+  size_t *parent = (size_t *)malloc((n ? n : 1) * sizeof(size_t));
+  FILE *fp = parent ? fopen(path, "wb") : NULL;
+  if (!fp) {
+    free(parent);
+    free(order);
+    return -1;
+  }
+
+  rbtree_image_header header = {RBTREE_IMAGE_MAGIC, sizeof(node_t), image_layout(), n + 1, n ? 1 : 0, 0};
+  header.check = image_check(&header);
+  char pad[RBTREE_IMAGE_NODES - sizeof(rbtree_image_header)] = {0};
+  node_t nil_image = nil_node;
+  nil_image.left = nil_image.right = image_link(0);
+#ifndef RBTREE_COMPACT
+  nil_image.parent = image_link(0);
+#endif
+  int ok = fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(pad, sizeof(pad), 1, fp) == 1 &&
+           fwrite(&nil_image, sizeof(node_t), 1, fp) == 1;
+
+  size_t next = 1; // 다음 자식이 받을 번호(1부터)
+  for (size_t i = 0; ok && i < n; i++) {
+    node_t image = *order[i];
+    set_parent_color(&image, image_link(i == 0 ? 0 : parent[i]), rbtree_color(order[i]));
+    image.left = image.right = image_link(0);
+    if (order[i]->left != t->nil) {
+      parent[next] = i + 1;
+      image.left = image_link(++next);
+    }
+    if (order[i]->right != t->nil) {
+      parent[next] = i + 1;
+      image.right = image_link(++next);
+    }
+    ok = fwrite(&image, sizeof(node_t), 1, fp) == 1;
+  }
+
+  ok = fclose(fp) == 0 && ok;
+  if (!ok) {
+    remove(path);
+  }
+  free(parent);
+  free(order);
+  return ok ? 0 : -1;
+}
+
+// 저장된 링크가 가리키는 노드 번호. 노드 경계가 아니거나 이미지 밖이면 count.
+static size_t image_index(size_t count, const node_t *link)
+{
+  uintptr_t offset = (uintptr_t)link;
+  if (offset % sizeof(node_t) != 0 || offset / sizeof(node_t) >= count) {
+    return count;
+  }
+  return offset / sizeof(node_t);
+}
+
+// 매핑한 노드 배열의 링크를 앞에서부터 한 번 훑으며 포인터로 바꾼다. 너비 우선 번호이므로
+// 부모의 번호는 자기보다 작고 자식의 번호는 크며, 부모는 이미 바뀌어 있으므로 자신을 자식으로
+// 가리키는지 바로 확인할 수 있다. 링크마다 이 검사만 하면 모든 포인터가 이미지 안을 가리키고 순환이
+// 없으므로 깨진 파일로도 탐색이 이미지 밖으로 나가거나 끝나지 않는 일이 없다.
+static int image_load(node_t *nodes, size_t count, size_t root)
+{
+  node_t *nil = &nodes[0];
+  if (root != (count > 1 ? 1 : 0) || rbtree_color(nil) != RBTREE_BLACK) {
+    return -1;
+  }
+  nil->left = nil->right = nil;
+  set_parent_color(nil, nil, RBTREE_BLACK);
+
+  for (size_t i = 1; i < count; i++) {
+    node_t *node = &nodes[i];
+    const color_t color = rbtree_color(node);
+#ifndef RBTREE_COMPACT
+    if (color != RBTREE_RED && color != RBTREE_BLACK) {
+      return -1;
+    }
+#endif
+    const size_t p = image_index(count, rbtree_parent(node));
+    const size_t l = image_index(count, node->left);
+    const size_t r = image_index(count, node->right);
+    if ((i == root ? p != 0 : p == 0 || p >= i || (nodes[p].left != node && nodes[p].right != node)) ||
+        (l != 0 && (l <= i || l >= count)) || (r != 0 && (r <= i || r >= count)) || (l != 0 && l == r)) {
+      return -1;
+    }
+    set_parent_color(node, &nodes[p], color);
+    node->left = &nodes[l];
+    node->right = &nodes[r];
+  }
+  return 0;
+}
+
+// 저장된 이미지를 MAP_PRIVATE로 커널이 고른 주소에 매핑해 트리로 연다. 머리는 해시와 크기만 보고
+// O(1)에 검사하고, 링크는 노드 배열을 순서대로 한 번 훑으며 포인터로 바꾼다. 바뀐 페이지와 이후 고친
+// 노드는 익명 메모리에 복사되어 파일은 바뀌지 않고, 새 노드는 일반 트리처럼 풀에서 할당한다.
+rbtree *rbtree_open_mmap(const char *path)
+{
+  if (path == NULL) {
+    return NULL;
+  }
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  rbtree_image_header header;
+  struct stat st;
+  if (fstat(fd, &st) < 0 || pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+      memcmp(header.magic, RBTREE_IMAGE_MAGIC, sizeof(header.magic)) != 0 || header.check != image_check(&header) ||
+      header.node_size != sizeof(node_t) || header.layout != image_layout() || header.count == 0 ||
+      header.root >= header.count || header.count > (SIZE_MAX - RBTREE_IMAGE_NODES) / sizeof(node_t) ||
+      (uint64_t)st.st_size < RBTREE_IMAGE_NODES + header.count * sizeof(node_t)) {
+    close(fd);
+    return NULL;
+  }
+
+  const size_t len = RBTREE_IMAGE_NODES + header.count * sizeof(node_t);
+  void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+  madvise(map, len, MADV_SEQUENTIAL);
+  node_t *nodes = (node_t *)((char *)map + RBTREE_IMAGE_NODES);
+  if (image_load(nodes, header.count, header.root) < 0) {
+    munmap(map, len);
+    return NULL;
+  }
+
+  rbtree *t = tree_alloc(&default_allocator);
+  if (!t || pool_init(&t->pool, NULL, &default_allocator) < 0) {
+    if (t) {
+      tree_free(t);
+    }
+    munmap(map, len);
+    return NULL;
+  }
+  t->pool.arena->map = map;
+  t->pool.arena->map_len = len;
+  t->nil = &nodes[0];
+  t->root = &nodes[header.root];
+  t->nodes = header.count - 1;
+  reset_bounds(t);
+  return t;
+}
+
+#ifdef RBTREE_ORDER_STATS
+// k번째(0부터) 작은 키의 노드. k가 키 수 이상이면 NULL.
+node_t *rbtree_select(const rbtree *t, size_t k)
+{
+  node_t *current = t->root;
+
+  while (current != t->nil) {
+    size_t left = current->left->size;
+    if (k < left) {
+      current = current->left;
+    } else if (k < left + node_weight(current)) {
+      return current;
+    } else {
+      k -= left + node_weight(current);
+      current = current->right;
+    }
+  }
+  return NULL;
+}
+
+// key보다 작은(inclusive면 작거나 같은) 키의 수
+static size_t count_below(const rbtree *t, const key_t key, int inclusive)
+{
+  node_t *current = t->root;
+  size_t count = 0;
+
+  while (current != t->nil) {
+    if (current->key < key || (inclusive && current->key == key)) {
+      count += current->left->size + node_weight(current); // 왼쪽 서브트리와 현재 노드를 센다.
+      current = current->right;
+    } else {
+      current = current->left;
+    }
+  }
+  return count;
+}
+
+// key보다 작은 키의 수. key가 있다면 정렬했을 때 첫 위치와 같다.
+size_t rbtree_rank(const rbtree *t, const key_t key)
+{
+  return count_below(t, key, 0);
+}
+
+// [lo, hi] 범위의 키 수
+size_t rbtree_count_range(const rbtree *t, const key_t lo, const key_t hi)
+{
+  if (lo > hi) {
+    return 0;
+  }
+  return count_below(t, hi, 1) - count_below(t, lo, 0);
+}
+#endif
+
+#ifdef RBTREE_INTERVAL
+// 구간 [lo, hi]를 삽입한다. lo가 키가 되고, 같은 lo는 rbtree_insert처럼 오른쪽으로 간다.
+node_t *rbtree_interval_insert(rbtree *t, const key_t lo, const key_t hi)
+{
+  if (lo > hi) {
+    return NULL;
+  }
+
+  node_t *new_node = pool_alloc(&t->pool);
+  if (new_node == NULL) {
+    return NULL;
+  }
+
+  new_node->key = lo;
+  new_node->hi = hi;
+  insert_node(t, t->root, lo, new_node);
+
+  return new_node;
+}
+
+// [lo, hi]와 겹치는 구간 중 시작점이 가장 작은 노드. 경로 하나만 내려가므로 O(log n)이다.
+node_t *rbtree_interval_overlap_first(const rbtree *t, const key_t lo, const key_t hi)
+{
+  node_t *current = t->root;
+
+  while (current != t->nil) {
+    if (current->left != t->nil && current->left->max >= lo) {
+      // 왼쪽에 끝점이 lo 이상인 구간이 있다. 현재 노드의 시작점이 hi 이하면 그 구간의 시작점도
+      // hi 이하라 겹치고, hi보다 크면 현재 노드와 오른쪽은 겹칠 수 없으므로 어느 쪽이든 왼쪽으로 간다.
+      current = current->left;
+    } else if (current->key > hi) {
+      return NULL; // 왼쪽에는 없고 현재 노드부터는 모두 hi 뒤에서 시작한다.
+    } else if (current->hi >= lo) {
+      return current;
+    } else {
+      current = current->right;
+    }
+  }
+  return NULL;
+}
+
+// 최대 끝점이 lo보다 작은 서브트리와 시작점이 hi보다 큰 오른쪽 서브트리는 건너뛴다.
+static int overlap_visit(const rbtree *t, node_t *node, const key_t lo, const key_t hi,
+                         rbtree_visit_fn callback, void *ctx, size_t *visited)
+{
+  if (node == t->nil || node->max < lo) {
+    return 0;
+  }
+
+  if (overlap_visit(t, node->left, lo, hi, callback, ctx, visited)) {
+    return 1;
+  }
+  if (node->key > hi) {
+    return 0;
+  }
+  if (node->hi >= lo) {
+    (*visited)++;
+    if (callback(node, ctx)) {
+      return 1;
+    }
+  }
+  return overlap_visit(t, node->right, lo, hi, callback, ctx, visited);
+}
+
+// [lo, hi]와 겹치는 모든 구간을 시작점 순서로 방문하고 방문한 수를 돌려준다.
+// callback이 0이 아닌 값을 돌려주면 멈춘다.
+size_t rbtree_interval_overlap_all(const rbtree *t, const key_t lo, const key_t hi, rbtree_visit_fn callback, void *ctx)
+{
+  size_t visited = 0;
+  overlap_visit(t, t->root, lo, hi, callback, ctx, &visited);
+  return visited;
+}
+#endif
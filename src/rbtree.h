@@ -1,32 +1,256 @@
 #ifndef _RBTREE_H_
 #define _RBTREE_H_
 
+#include <limits.h>
 #include <stddef.h>
+#include <stdint.h>
 
 typedef enum { RBTREE_RED, RBTREE_BLACK } color_t;
 
 typedef int key_t;
 
+#define RBTREE_KEY_MIN INT_MIN
+#define RBTREE_KEY_MAX INT_MAX
+
+// 지연 시간 히스토그램은 계측 옵션의 일부다.
+#if defined(RBTREE_STATS_LATENCY) && !defined(RBTREE_STATS)
+#define RBTREE_STATS
+#endif
+
+// 멀티셋 모드는 같은 키를 노드 하나의 개수로 센다. 구간 모드의 노드는 같은 키라도 끝점이 다르므로 함께 쓸 수 없다.
+#if defined(RBTREE_MULTISET) && defined(RBTREE_INTERVAL)
+#error "RBTREE_MULTISET은 RBTREE_INTERVAL과 함께 쓸 수 없다"
+#endif
+
+#ifdef RBTREE_COMPACT
+// 노드는 항상 8바이트 정렬이므로 parent 포인터의 최하위 비트에 색을 저장한다.(노드 32바이트)
+typedef struct node_t {
+  uintptr_t parent_color;
+  struct node_t *left, *right;
+  key_t key;
+#ifdef RBTREE_MULTISET
+  size_t count; // 이 키가 들어간 횟수(nil은 0)
+#endif
+#ifdef RBTREE_ORDER_STATS
+  size_t size; // 이 노드를 루트로 하는 서브트리의 키 수(멀티셋 모드에서는 개수의 합, nil은 0)
+#endif
+#ifdef RBTREE_INTERVAL
+  key_t hi, max; // 구간 [key, hi]와 서브트리의 최대 끝점
+#endif
+} node_t;
+
+#define rbtree_parent(n) ((node_t *)((n)->parent_color & ~(uintptr_t)1))
+#define rbtree_color(n) ((color_t)((n)->parent_color & 1))
+#else
 typedef struct node_t {
   color_t color;
   key_t key;
   struct node_t *parent, *left, *right;
+#ifdef RBTREE_MULTISET
+  size_t count; // 이 키가 들어간 횟수(nil은 0)
+#endif
+#ifdef RBTREE_ORDER_STATS
+  size_t size; // 이 노드를 루트로 하는 서브트리의 키 수(멀티셋 모드에서는 개수의 합, nil은 0)
+#endif
+#ifdef RBTREE_INTERVAL
+  key_t hi, max; // 구간 [key, hi]와 서브트리의 최대 끝점
+#endif
 } node_t;
 
+#define rbtree_parent(n) ((n)->parent)
+#define rbtree_color(n) ((n)->color)
+#endif
+
+struct rbtree_chunk;
+struct rbtree_arena;
+
+// 트리 구조체와 노드 청크를 얻고 돌려주는 함수. ctx는 그대로 넘기고, free는 alloc에 준 크기를 함께 받는다.
+// alloc은 실패하면 NULL을 돌려주고, 돌려준 메모리는 malloc처럼 정렬되어 있어야 한다.
+typedef struct {
+  void *(*alloc)(void *ctx, size_t size);
+  void (*free)(void *ctx, void *ptr, size_t size);
+  void *ctx;
+} rbtree_allocator;
+
+// 노드 전용 슬랩 풀. 큰 청크에서 노드를 잘라 쓰고, 삭제된 노드는 free list로 재사용한다.
+// 청크는 split/join으로 나뉘거나 합쳐진 트리들이 함께 쓰는 arena가 소유한다.
+typedef struct {
+  struct rbtree_arena *arena;  // 청크를 소유하는 arena
+  struct rbtree_chunk *chunk;  // 노드를 잘라 쓰고 있는 청크
+  size_t used;                 // 현재 청크에서 잘라낸 노드 수
+  size_t next_capacity;        // 다음 청크의 노드 수
+  size_t node_size;            // 노드 하나의 바이트 수
+  size_t link;                 // 반납된 노드를 잇는 포인터 필드의 오프셋(node_t는 right)
+  void *free_list;             // 반납된 노드(link 필드로 연결)
+  void *free_tail;
+  struct rbtree_chunk *spare;      // rbtree_clear가 비운 뒤 차례로 다시 쓸 청크(next로 spare_last까지)
+  struct rbtree_chunk *spare_last;
+} rbtree_pool;
+
+// 노드 모양이 다른 트리가 같은 풀을 쓰기 위한 함수. link는 노드 안 포인터 필드의 오프셋으로,
+// 반납된 노드는 그 필드로 연결된다. 노드는 release할 때 청크 단위로 한꺼번에 해제된다.
+int rbtree_pool_init(rbtree_pool *, const size_t node_size, const size_t link); // 실패하면 -1
+void *rbtree_pool_alloc(rbtree_pool *);                                         // 메모리가 부족하면 NULL
+void rbtree_pool_free(rbtree_pool *, void *);
+void rbtree_pool_release(rbtree_pool *);
+
+#ifdef RBTREE_STATS
+// 트리별 계측 값. RBTREE_STATS_LATENCY를 함께 켜면 연산별 지연 시간 히스토그램도 모은다.
+typedef enum { RBTREE_STAT_INSERT, RBTREE_STAT_FIND, RBTREE_STAT_ERASE, RBTREE_STAT_OPS } rbtree_stat_op;
+
+#define RBTREE_STATS_BUCKETS 32 // 버킷 b는 [2^b, 2^(b+1)) ns, 마지막 버킷은 그 이상 전부
+
+typedef struct {
+  uint64_t left_rotations, right_rotations;
+  uint64_t insert_fixup_loops, erase_fixup_loops; // fixup while 루프 반복 수
+  uint64_t find_compares, insert_compares;        // 키를 비교한 노드 수
+  size_t nodes, height;                           // rbtree_get_stats가 채운다
+#ifdef RBTREE_STATS_LATENCY
+  uint64_t latency[RBTREE_STAT_OPS][RBTREE_STATS_BUCKETS];
+#endif
+} rbtree_stats;
+#endif
+
+#define RBTREE_NODES_UNKNOWN SIZE_MAX
+
 typedef struct {
   node_t *root;
-  node_t *nil;  // for sentinel
+  node_t *nil;  // for sentinel, 모든 트리가 함께 쓰는 읽기 전용 노드(mmap으로 연 트리는 이미지의 0번 노드)
+  node_t *leftmost, *rightmost; // 가장 작은/큰 노드(비었으면 nil). 삽입과 삭제가 그때그때 고친다.
+  size_t nodes; // 노드 수(멀티셋 모드에서 같은 키는 노드 하나). split으로 나눈 뒤처럼 모르면 RBTREE_NODES_UNKNOWN
+  rbtree_pool pool;
+  rbtree_allocator allocator; // 이 구조체를 할당한 곳(노드 청크는 arena가 같은 할당자로 얻는다)
+#ifdef RBTREE_STATS
+  rbtree_stats stats; // 삽입과 삭제가 갱신하는 카운터
+  struct rbtree_lookup_stats *lookup_stats; // 조회가 갱신하는 카운터(구조체 바로 뒤에 함께 할당)
+#endif
 } rbtree;
 
+typedef enum { RBTREE_OP_INSERT, RBTREE_OP_ERASE } op_kind_t;
+
+typedef struct {
+  op_kind_t kind;
+  key_t key;
+} op_t;
+
+// 메모리가 부족하면 NULL을 돌려준다.
 rbtree *new_rbtree(void);
+rbtree *new_rbtree_with_capacity(const size_t);
+rbtree *new_rbtree_ex(const rbtree_allocator *); // 노드와 트리를 allocator로 할당한다. NULL이면 malloc/free
 void delete_rbtree(rbtree *);
+// 모든 키를 지워 빈 트리로 만들되 노드 메모리는 돌려주지 않고 다음 삽입에 다시 쓴다.
+// 청크를 다른 트리와 함께 쓰지 않으면 O(청크 수), 함께 쓰면 노드를 한 번 훑는다. 재귀나 스택은 쓰지 않는다.
+void rbtree_clear(rbtree *);
+
+// 노드 청크를 NUMA 노드 node의 메모리에 두는 할당자. node가 음수면 호출한 스레드가 도는 CPU의 노드를 쓴다.
+// 할당은 페이지 단위의 mmap이므로 소켓마다 트리를 두고 노드를 많이 담을 때 쓴다.
+rbtree_allocator rbtree_numa_allocator(const int);
+
+// 배열 하나로 트리를 O(n)에 만든다. sorted 버전은 arr가 오름차순이어야 한다.
+rbtree *rbtree_from_sorted_array(const key_t *, const size_t);
+rbtree *rbtree_from_array(const key_t *, const size_t);
 
+// 같은 키는 새 노드로 오른쪽에 들어간다. 멀티셋 모드에서는 있는 노드의 개수만 늘리고 그 노드를 돌려준다.
+// 메모리가 부족하면 NULL을 돌려주고 트리는 바뀌지 않는다.
 node_t *rbtree_insert(rbtree *, const key_t);
+// hint 근처에 먼저 넣어 본다. hint가 key의 바로 앞이나 뒤 노드이면 루트에서 내려가지 않으므로
+// 오름차순으로 들어오는 키는 직전에 넣은 노드를 hint로 주면 키 비교 한두 번에 붙는다.
+// hint가 맞지 않거나 NULL이면 rbtree_insert와 같다. 결과는 어느 경우든 rbtree_insert와 같은 자리이다.
+node_t *rbtree_insert_hint(rbtree *, node_t *, const key_t);
 node_t *rbtree_find(const rbtree *, const key_t);
+// keys[i]를 찾아 out[i]에 쓴다(없으면 NULL). 여러 탐색을 번갈아 진행해 캐시 미스를 겹치고, 찾은 수를 돌려준다.
+size_t rbtree_find_batch(const rbtree *, const key_t *, node_t **, const size_t);
+// 기억해 둔 양 끝 노드를 O(1)에 돌려준다. 비었으면 nil
 node_t *rbtree_min(const rbtree *);
 node_t *rbtree_max(const rbtree *);
+// 멀티셋 모드에서는 개수를 하나 줄이고, 0이 될 때만 노드를 지운다.
 int rbtree_erase(rbtree *, node_t *);
+// 가장 작은/큰 키 하나를 탐색 없이 지우고 key가 NULL이 아니면 그 키를 담는다. 지웠으면 1, 비었으면 0
+int rbtree_pop_min(rbtree *, key_t *);
+int rbtree_pop_max(rbtree *, key_t *);
+
+// rbtree_erase를 두 단계로 나눈 것. unlink는 노드를 트리에서 떼어 내기만 하고,
+// 떼어 낸 노드는 더 이상 읽는 쪽이 없을 때 release_node로 반납한다. 멀티셋 모드에서도 노드를 통째로 뗀다.
+int rbtree_unlink(rbtree *, node_t *);
+void rbtree_release_node(rbtree *, node_t *);
+
+// 순서 기반 탐색. 해당하는 노드가 없으면 NULL을 돌려준다.
+node_t *rbtree_next(const rbtree *, const node_t *);
+node_t *rbtree_prev(const rbtree *, const node_t *);
+node_t *rbtree_lower_bound(const rbtree *, const key_t); // key 이상인 첫 노드
+node_t *rbtree_upper_bound(const rbtree *, const key_t); // key보다 큰 첫 노드
+node_t *rbtree_floor(const rbtree *, const key_t);       // key 이하인 마지막 노드
+node_t *rbtree_ceil(const rbtree *, const key_t);        // key 이상인 첫 노드
+
+// 범위 탐색 callback. 0이 아닌 값을 돌려주면 탐색을 멈춘다.
+typedef int (*rbtree_visit_fn)(node_t *, void *);
+
+// [lo, hi] 범위의 노드를 키 순서로 방문하고 방문한 노드 수를 돌려준다.
+size_t rbtree_range(const rbtree *, const key_t, const key_t, rbtree_visit_fn, void *);
+
+// join 기반 연산. 블랙 높이를 맞춰 서브트리를 통째로 이어 붙이므로 노드를 옮기거나 복사하지 않는다.
+// 루트에서 한 번 구한 블랙 높이를 내려가며 따라가므로, 잇는 비용은 두 서브트리의 높이 차이만큼이다.
+// t2를 받는 연산은 성공하면 t2의 노드를 t1으로 옮기고 t2 자체를 해제한다. 두 트리 모두 다른 스레드가 쓰지 않아야 하고,
+// 같은 할당자로 만든 트리여야 한다.
+int rbtree_join(rbtree *, const key_t, rbtree *); // t1의 최대 키 <= key <= t2의 최소 키일 때 하나로 잇는다. O(log n)
+rbtree *rbtree_split(rbtree *, const key_t);       // key 이상인 키를 새 트리로 떼어 내 돌려준다. O(log n)
 
+// 집합 연산. 결과는 t1에 남고, 두 트리 모두에 있는 키는 t1의 노드를 남긴다. 각 트리의 키는 서로 달라야 한다.
+// 멀티셋 모드에서 같은 키의 개수는 합집합이면 더하고, 교집합이면 작은 쪽을, 차집합이면 뺀 만큼을 남긴다.
+// 작은 쪽이 m개, 큰 쪽이 n개면 O(m log(n / m + 1))이고, 큰 입력은 서브트리를 스레드로 나누어 병렬로 처리한다.
+int rbtree_union(rbtree *, rbtree *);
+int rbtree_intersection(rbtree *, rbtree *);
+int rbtree_difference(rbtree *, rbtree *); // t1 - t2
+
+// [lo, hi] 범위의 노드를 모두 지우고 지운 키 수를 돌려준다. O(log n + 지운 노드 수)
+size_t rbtree_erase_range(rbtree *, const key_t, const key_t);
+
+// 트리 이미지. 노드를 한 배열에 너비 우선으로 저장하고 0번 노드를 nil로 쓴다. 링크는 노드 번호로
+// 저장하므로 rbtree_open_mmap은 이미지를 아무 주소에나 매핑하고, 머리를 O(1)에 검사한 뒤 링크를
+// 한 번 순서대로 훑으며 포인터로 바꾼다. 같은 이미지를 여러 번 열 수 있고, 머리나 링크가 깨졌으면 NULL.
+// 연 트리는 일반 트리처럼 고칠 수 있고 파일은 바뀌지 않는다. 이미지의 nil이 따로 있으므로
+// 같은 이미지에서 나온 트리끼리만 join과 집합 연산을 할 수 있다.
+int rbtree_save(const rbtree *, const char *);
+rbtree *rbtree_open_mmap(const char *);
+
+#ifdef RBTREE_ORDER_STATS
+// 서브트리 크기를 이용한 순위 질의. 모두 O(log n)이다.
+node_t *rbtree_select(const rbtree *, size_t);                    // k번째(0부터) 작은 키의 노드
+size_t rbtree_rank(const rbtree *, const key_t);                  // key보다 작은 키의 수
+size_t rbtree_count_range(const rbtree *, const key_t, const key_t); // [lo, hi] 범위의 키 수
+#endif
+
+#ifdef RBTREE_INTERVAL
+// 구간 트리. 노드는 [key, hi]를 저장하고 rbtree_insert(t, key)는 [key, key]를 넣는다.
+node_t *rbtree_interval_insert(rbtree *, const key_t, const key_t);
+node_t *rbtree_interval_overlap_first(const rbtree *, const key_t, const key_t);
+size_t rbtree_interval_overlap_all(const rbtree *, const key_t, const key_t, rbtree_visit_fn, void *);
+#endif
+
+// 키를 오름차순으로 arr에 쓴다. 멀티셋 모드에서는 키마다 개수만큼 반복하므로 n은 키 수의 합이다.
 int rbtree_to_array(const rbtree *, key_t *, const size_t);
 
+#ifdef RBTREE_STATS
+// 누적된 계측 값을 out에 복사한다. 노드 수와 높이는 트리를 순회해 O(n)에 계산한다.
+void rbtree_get_stats(const rbtree *, rbtree_stats *);
+void rbtree_reset_stats(rbtree *);
+#endif
+
+// 트리를 고정 크기 조각으로 나누어 내보내기 위한 위치. 트리가 바뀌면 무효가 된다.
+typedef struct {
+  node_t *next; // 다음에 내보낼 노드
+  int started;
+#ifdef RBTREE_MULTISET
+  size_t repeat; // next의 키를 이미 내보낸 수
+#endif
+} rbtree_cursor;
+
+void rbtree_cursor_init(rbtree_cursor *);
+size_t rbtree_export(const rbtree *, rbtree_cursor *, key_t *, const size_t);
+
+// 삽입/삭제 연산을 키 순으로 정렬해 한 번에 반영한다. 같은 키의 연산은 배열 순서대로 적용되고,
+// 없는 키의 삭제는 무시된다. 실패하면 -1을 돌려주고 트리는 바뀌지 않는다.
+// 배치가 노드 수에 비해 작으면 하나씩 O(m log n)에, 몇 배쯤 크면 합병 후 다시 만들어 O(n + m)에 반영한다.
+int rbtree_apply_batch(rbtree *, const op_t *, const size_t);
+
 #endif  // _RBTREE_H_
@@ -0,0 +1,269 @@
+#include "rbtree32.h"
+#include "rbtree_fixup.h"
+#include <stdlib.h>
+
+// 첫 배열의 크기(nil 포함)
+#define RBTREE32_INITIAL_CAPACITY 64
+
+#define NODE(i) (t->nodes[(i)])
+
+static inline rbtree32_idx parent_of(const rbtree32 *t, rbtree32_idx i) { return NODE(i).parent_color >> 1; }
+static inline color_t color_of(const rbtree32 *t, rbtree32_idx i) { return (color_t)(NODE(i).parent_color & 1); }
+
+static inline void set_parent(rbtree32 *t, rbtree32_idx i, rbtree32_idx p)
+{
+  NODE(i).parent_color = (p << 1) | (NODE(i).parent_color & 1);
+}
+
+static inline void set_color(rbtree32 *t, rbtree32_idx i, color_t c)
+{
+  NODE(i).parent_color = (NODE(i).parent_color & ~(uint32_t)1) | c;
+}
+
+// 노드 배열을 capacity 크기로 늘립니다. 링크가 인덱스이므로 배열이 옮겨져도 트리는 그대로입니다.
+static int reserve(rbtree32 *t, size_t capacity)
+{
+  if (capacity > (size_t)RBTREE32_MAX_NODES + 1) {
+    capacity = (size_t)RBTREE32_MAX_NODES + 1;
+  }
+  if (capacity <= t->capacity) {
+    return capacity > t->used ? 0 : -1;
+  }
+
+  node32_t *nodes = (node32_t *)realloc(t->nodes, capacity * sizeof(node32_t));
+  if (!nodes) {
+    return -1;
+  }
+  t->nodes = nodes;
+  t->capacity = (rbtree32_idx)capacity;
+  return 0;
+}
+
+rbtree32 *new_rbtree32(void)
+{
+  return new_rbtree32_with_capacity(0);
+}
+
+// 노드 n개 분량의 배열을 미리 확보한 트리를 만듭니다.
+rbtree32 *new_rbtree32_with_capacity(const size_t n)
+{
+  rbtree32 *t = (rbtree32 *)calloc(1, sizeof(rbtree32));
+  if (!t) {
+    return NULL;
+  }
+
+  size_t capacity = n + 1 > RBTREE32_INITIAL_CAPACITY ? n + 1 : RBTREE32_INITIAL_CAPACITY;
+  if (reserve(t, capacity) < 0) {
+    free(t);
+    return NULL;
+  }
+
+  // nodes[0]을 T.nil로 사용합니다.
+  NODE(RBTREE32_NIL).key = 0;
+  NODE(RBTREE32_NIL).left = RBTREE32_NIL;
+  NODE(RBTREE32_NIL).right = RBTREE32_NIL;
+  NODE(RBTREE32_NIL).parent_color = RBTREE_BLACK;
+
+  t->root = RBTREE32_NIL;
+  t->used = 1;
+  t->free_list = RBTREE32_NIL;
+  return t;
+}
+
+void delete_rbtree32(rbtree32 *t)
+{
+  if (!t)
+    return;
+
+  // 노드가 하나의 배열에 모여 있으므로 한 번에 해제합니다.
+  free(t->nodes);
+  free(t);
+}
+
+static rbtree32_idx node_alloc(rbtree32 *t)
+{
+  if (t->free_list != RBTREE32_NIL) {
+    rbtree32_idx i = t->free_list;
+    t->free_list = NODE(i).right;
+    return i;
+  }
+
+  if (t->used == t->capacity && reserve(t, (size_t)t->capacity * 2) < 0) {
+    return RBTREE32_NIL;
+  }
+  return t->used++;
+}
+
+// rbtree_fixup.h가 노드에 접근하는 방법. 링크가 인덱스이므로 그냥 대입한다.
+#define RBTREE32_OPS_NIL(t) RBTREE32_NIL
+#define RBTREE32_OPS_ROOT(t) ((t)->root)
+#define RBTREE32_OPS_LEFT(t, i) ((t)->nodes[(i)].left)
+#define RBTREE32_OPS_RIGHT(t, i) ((t)->nodes[(i)].right)
+#define RBTREE32_OPS_LINK(t, link, v) ((link) = (v))
+#define RBTREE32_OPS_PARENT(t, i) parent_of((t), (i))
+#define RBTREE32_OPS_SET_PARENT(t, i, p) set_parent((t), (i), (p))
+#define RBTREE32_OPS_COLOR(t, i) color_of((t), (i))
+#define RBTREE32_OPS_SET_COLOR(t, i, c) set_color((t), (i), (c))
+#define RBTREE32_OPS_ROTATED(t, x, y, counter) ((void)0)
+#define RBTREE32_OPS_LOOP(t, counter) ((void)0)
+
+RBTREE_FIXUP_GENERATE(static, rbtree32, rbtree32, rbtree32_idx, RBTREE32_OPS)
+
+rbtree32_idx rbtree32_insert(rbtree32 *t, const key_t key)
+{
+  rbtree32_idx z = node_alloc(t);
+  if (z == RBTREE32_NIL) {
+    return RBTREE32_NIL;
+  }
+
+  rbtree32_idx current = t->root;
+  rbtree32_idx parent = RBTREE32_NIL;
+
+  // 같은 키는 오른쪽으로 보냅니다.
+  while (current != RBTREE32_NIL) {
+    parent = current;
+    current = key < NODE(current).key ? NODE(current).left : NODE(current).right;
+  }
+
+  NODE(z).key = key;
+  NODE(z).left = RBTREE32_NIL;
+  NODE(z).right = RBTREE32_NIL;
+  NODE(z).parent_color = (parent << 1) | RBTREE_RED;
+
+  if (parent == RBTREE32_NIL) {
+    t->root = z;
+  } else if (key < NODE(parent).key) {
+    NODE(parent).left = z;
+  } else {
+    NODE(parent).right = z;
+  }
+
+  rbtree32_insert_fixup(t, z);
+  return z;
+}
+
+rbtree32_idx rbtree32_find(const rbtree32 *t, const key_t key)
+{
+  rbtree32_idx current = t->root;
+
+  while (current != RBTREE32_NIL) {
+    if (key == NODE(current).key) {
+      return current;
+    }
+    current = key < NODE(current).key ? NODE(current).left : NODE(current).right;
+  }
+  return RBTREE32_NIL;
+}
+
+static rbtree32_idx min_in_subtree(const rbtree32 *t, rbtree32_idx i)
+{
+  while (NODE(i).left != RBTREE32_NIL) {
+    i = NODE(i).left;
+  }
+  return i;
+}
+
+rbtree32_idx rbtree32_min(const rbtree32 *t)
+{
+  return min_in_subtree(t, t->root);
+}
+
+rbtree32_idx rbtree32_max(const rbtree32 *t)
+{
+  rbtree32_idx current = t->root;
+  while (NODE(current).right != RBTREE32_NIL) {
+    current = NODE(current).right;
+  }
+  return current;
+}
+
+static void transplant(rbtree32 *t, rbtree32_idx u, rbtree32_idx v)
+{
+  rbtree32_idx up = parent_of(t, u);
+  if (up == RBTREE32_NIL) {
+    t->root = v;
+  } else if (u == NODE(up).left) {
+    NODE(up).left = v;
+  } else {
+    NODE(up).right = v;
+  }
+  if (v != RBTREE32_NIL) {
+    set_parent(t, v, up);
+  }
+}
+
+int rbtree32_erase(rbtree32 *t, rbtree32_idx z)
+{
+  if (z == RBTREE32_NIL || z >= t->used) {
+    return -1;
+  }
+
+  rbtree32_idx y = z;
+  rbtree32_idx x;
+  rbtree32_idx xp = parent_of(t, z); // x의 부모. x가 nil이어도 알 수 있도록 따로 둡니다.
+  color_t y_original_color = color_of(t, y);
+
+  if (NODE(z).left == RBTREE32_NIL) {
+    x = NODE(z).right;
+    transplant(t, z, x);
+  } else if (NODE(z).right == RBTREE32_NIL) {
+    x = NODE(z).left;
+    transplant(t, z, x);
+  } else {
+    y = min_in_subtree(t, NODE(z).right);
+    y_original_color = color_of(t, y);
+    x = NODE(y).right;
+
+    if (parent_of(t, y) == z) {
+      xp = y;
+    } else {
+      xp = parent_of(t, y);
+      transplant(t, y, x);
+      NODE(y).right = NODE(z).right;
+      set_parent(t, NODE(y).right, y);
+    }
+
+    transplant(t, z, y);
+    NODE(y).left = NODE(z).left;
+    set_parent(t, NODE(y).left, y);
+    set_color(t, y, color_of(t, z));
+  }
+
+  // 삭제된 노드는 free list로 돌려보냅니다.
+  NODE(z).right = t->free_list;
+  t->free_list = z;
+
+  if (y_original_color == RBTREE_BLACK) {
+    rbtree32_erase_fixup(t, x, xp);
+  }
+  return 1;
+}
+
+// 부모 인덱스를 따라 중위 순회합니다.
+int rbtree32_to_array(const rbtree32 *t, key_t *arr, const size_t n)
+{
+  if (t == NULL || arr == NULL)
+    return -1;
+
+  size_t index = 0;
+  rbtree32_idx current = t->root == RBTREE32_NIL ? RBTREE32_NIL : min_in_subtree(t, t->root);
+  while (current != RBTREE32_NIL && index < n) {
+    arr[index++] = NODE(current).key;
+
+    if (NODE(current).right != RBTREE32_NIL) {
+      current = min_in_subtree(t, NODE(current).right);
+    } else {
+      rbtree32_idx parent = parent_of(t, current);
+      while (parent != RBTREE32_NIL && current == NODE(parent).right) {
+        current = parent;
+        parent = parent_of(t, parent);
+      }
+      current = parent;
+    }
+  }
+
+  if (index != n || current != RBTREE32_NIL) {
+    return -1;
+  }
+  return 0;
+}
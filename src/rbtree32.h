@@ -0,0 +1,45 @@
+#ifndef _RBTREE32_H_
+#define _RBTREE32_H_
+
+#include "rbtree.h"
+
+// 노드 배열의 인덱스로 연결하는 16바이트 노드 레이아웃.
+// 인덱스 0은 nil이고, 부모 인덱스의 최하위 비트에 색을 저장하므로 노드는 최대 2^31 - 1개까지 담을 수 있다.
+typedef uint32_t rbtree32_idx;
+
+typedef struct {
+  key_t key;
+  rbtree32_idx left, right;
+  uint32_t parent_color; // (부모 인덱스 << 1) | 색
+} node32_t;
+
+typedef struct {
+  node32_t *nodes;        // nodes[0]은 nil
+  rbtree32_idx root;
+  rbtree32_idx used;      // 잘라낸 노드 수(nil 포함)
+  rbtree32_idx free_list; // 반납된 노드(right로 연결)
+  rbtree32_idx capacity;  // nodes 배열의 크기
+} rbtree32;
+
+#define RBTREE32_NIL ((rbtree32_idx)0)
+#define RBTREE32_MAX_NODES ((rbtree32_idx)0x7fffffff)
+
+// 인덱스로 노드에 접근한다. 삽입으로 배열이 커지면 이전에 얻은 포인터는 무효가 된다.
+#define rbtree32_node(t, i) (&(t)->nodes[(i)])
+#define rbtree32_key(t, i) ((t)->nodes[(i)].key)
+#define rbtree32_parent(t, i) ((rbtree32_idx)((t)->nodes[(i)].parent_color >> 1))
+#define rbtree32_color(t, i) ((color_t)((t)->nodes[(i)].parent_color & 1))
+
+rbtree32 *new_rbtree32(void);
+rbtree32 *new_rbtree32_with_capacity(const size_t);
+void delete_rbtree32(rbtree32 *);
+
+rbtree32_idx rbtree32_insert(rbtree32 *, const key_t);
+rbtree32_idx rbtree32_find(const rbtree32 *, const key_t);
+rbtree32_idx rbtree32_min(const rbtree32 *);
+rbtree32_idx rbtree32_max(const rbtree32 *);
+int rbtree32_erase(rbtree32 *, rbtree32_idx);
+
+int rbtree32_to_array(const rbtree32 *, key_t *, const size_t);
+
+#endif // _RBTREE32_H_
@@ -0,0 +1,226 @@
+#include "rbtree_concurrent.h"
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 독자의 경로 길이 상한. RB Tree의 높이는 2 log2(n + 1)을 넘지 않으므로
+// 이보다 길면 쓰기 도중의 찢어진 경로를 따라간 것이고, 다시 찾는다.
+#define RBTREE_CONCURRENT_MAX_DEPTH 128
+
+// 독자가 쓰기를 기다리며 다시 찾는 동안 CPU를 양보하는 간격
+#define RBTREE_CONCURRENT_SPINS 64
+
+// 현재 epoch에 이만큼 쌓이면 쓰기 쪽에서 회수를 시도한다.
+#define RBTREE_CONCURRENT_RECLAIM_BATCH 64
+
+rbtree_concurrent *new_rbtree_concurrent(void)
+{
+  rbtree_concurrent *c = (rbtree_concurrent *)aligned_alloc(_Alignof(rbtree_concurrent), sizeof(rbtree_concurrent));
+  if (!c) {
+    return NULL;
+  }
+  memset(c, 0, sizeof(*c));
+
+  if ((c->tree = new_rbtree()) == NULL) {
+    free(c);
+    return NULL;
+  }
+  if (pthread_mutex_init(&c->writer, NULL) != 0) {
+    delete_rbtree(c->tree);
+    free(c);
+    return NULL;
+  }
+  c->epoch = 1; // 0은 쉬는 독자의 상태와 겹치지 않게 비워 둔다
+  return c;
+}
+
+void delete_rbtree_concurrent(rbtree_concurrent *c)
+{
+  if (!c)
+    return;
+
+  // 회수를 기다리던 노드도 풀의 청크에 있으므로 트리와 함께 해제됩니다.
+  for (int i = 0; i < 3; i++) {
+    free(c->retired[i].nodes);
+  }
+  pthread_mutex_destroy(&c->writer);
+  delete_rbtree(c->tree);
+  free(c);
+}
+
+rbtree_reader *rbtree_concurrent_register(rbtree_concurrent *c)
+{
+  for (int i = 0; i < RBTREE_CONCURRENT_MAX_READERS; i++) {
+    int expected = 0;
+    if (__atomic_compare_exchange_n(&c->readers[i].in_use, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+      __atomic_store_n(&c->readers[i].state, 0, __ATOMIC_RELAXED);
+      return &c->readers[i];
+    }
+  }
+  return NULL;
+}
+
+void rbtree_concurrent_unregister(rbtree_reader *r)
+{
+  __atomic_store_n(&r->state, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&r->in_use, 0, __ATOMIC_RELEASE);
+}
+
+// 현재 epoch를 슬롯에 알린다. 쓰기 쪽이 슬롯을 검사하기 전에 이 값이 보이도록 전체 fence를 둔다.
+void rbtree_concurrent_read_begin(rbtree_concurrent *c, rbtree_reader *r)
+{
+  uint64_t epoch = __atomic_load_n(&c->epoch, __ATOMIC_ACQUIRE);
+  __atomic_store_n(&r->state, (epoch << 1) | 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void rbtree_concurrent_read_end(rbtree_reader *r)
+{
+  __atomic_store_n(&r->state, 0, __ATOMIC_RELEASE);
+}
+
+// 키는 노드가 트리에 붙어 있는 동안 바뀌지 않고, 떼어 낸 노드도 자식 포인터를 유지하므로
+// 찾은 노드는 쓰기와 겹쳤더라도 탐색 도중 어느 시점에는 트리에 있던 노드다.
+// 찾지 못한 경우는 회전 때문에 놓쳤을 수 있으므로 seqcount가 그대로일 때만 믿는다.
+node_t *rbtree_concurrent_find(const rbtree_concurrent *c, const key_t key)
+{
+  const rbtree *t = c->tree;
+
+  for (unsigned spins = 1;; spins++) {
+    uint64_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+    node_t *current = __atomic_load_n(&t->root, __ATOMIC_ACQUIRE);
+
+    for (int depth = 0; current != t->nil && depth < RBTREE_CONCURRENT_MAX_DEPTH; depth++) {
+      key_t k = __atomic_load_n(&current->key, __ATOMIC_RELAXED);
+      if (key == k) {
+        return current;
+      }
+      current = key < k ? __atomic_load_n(&current->left, __ATOMIC_ACQUIRE)
+                        : __atomic_load_n(&current->right, __ATOMIC_ACQUIRE);
+    }
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (current == t->nil && (seq & 1) == 0 && __atomic_load_n(&c->seq, __ATOMIC_RELAXED) == seq) {
+      return NULL;
+    }
+    // 쓰기를 하는 스레드가 같은 CPU에서 밀려나 있을 수 있으므로 가끔 양보한다.
+    if (spins % RBTREE_CONCURRENT_SPINS == 0) {
+      sched_yield();
+    }
+  }
+}
+
+// 쓰기 구간의 시작과 끝. 구간 안의 변경은 seq가 홀수인 동안 일어난다.
+static void write_begin(rbtree_concurrent *c)
+{
+  __atomic_store_n(&c->seq, c->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void write_end(rbtree_concurrent *c)
+{
+  __atomic_store_n(&c->seq, c->seq + 1, __ATOMIC_RELEASE);
+}
+
+// 모든 활성 독자가 현재 epoch에 있으면 epoch를 하나 넘기고, 두 epoch 전에 떼어 낸 노드를 반납한다.
+// writer mutex를 잡은 상태에서 부른다.
+static size_t reclaim_locked(rbtree_concurrent *c)
+{
+  uint64_t epoch = c->epoch;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  for (int i = 0; i < RBTREE_CONCURRENT_MAX_READERS; i++) {
+    uint64_t state = __atomic_load_n(&c->readers[i].state, __ATOMIC_ACQUIRE);
+    if ((state & 1) && (state >> 1) != epoch) {
+      return 0;
+    }
+  }
+
+  // epoch + 1의 목록 자리에는 epoch - 2에 떼어 낸 노드가 남아 있다.
+  rbtree_retired *safe = &c->retired[(epoch + 1) % 3];
+  size_t released = safe->n;
+  for (size_t i = 0; i < safe->n; i++) {
+    rbtree_release_node(c->tree, safe->nodes[i]);
+  }
+  safe->n = 0;
+
+  __atomic_store_n(&c->epoch, epoch + 1, __ATOMIC_RELEASE);
+  return released;
+}
+
+size_t rbtree_concurrent_reclaim(rbtree_concurrent *c)
+{
+  pthread_mutex_lock(&c->writer);
+  size_t released = reclaim_locked(c);
+  pthread_mutex_unlock(&c->writer);
+  return released;
+}
+
+// 목록에 넣을 메모리가 없을 때 독자가 모두 node를 지나갈 때까지 기다렸다가 바로 반납한다.
+// node를 떼어 낸 epoch에서 두 번 넘어가면 그때 읽던 독자는 모두 읽기 구간을 마친 것이다.
+// 독자는 writer mutex를 잡지 않으므로 mutex를 쥔 채 기다려도 된다.
+static void synchronize_release(rbtree_concurrent *c, node_t *node)
+{
+  const uint64_t target = c->epoch + 2;
+  for (unsigned spins = 1; c->epoch < target; spins++) {
+    reclaim_locked(c);
+    if (spins % RBTREE_CONCURRENT_SPINS == 0) {
+      sched_yield();
+    }
+  }
+  rbtree_release_node(c->tree, node);
+}
+
+// 떼어 낸 노드를 현재 epoch의 목록에 넣는다.
+static void retire(rbtree_concurrent *c, node_t *node)
+{
+  rbtree_retired *list = &c->retired[c->epoch % 3];
+  if (list->n == list->cap) {
+    size_t cap = list->cap ? list->cap * 2 : RBTREE_CONCURRENT_RECLAIM_BATCH;
+    node_t **nodes = (node_t **)realloc(list->nodes, cap * sizeof(node_t *));
+    if (!nodes) {
+      synchronize_release(c, node);
+      return;
+    }
+    list->nodes = nodes;
+    list->cap = cap;
+  }
+  list->nodes[list->n++] = node;
+
+  if (list->n % RBTREE_CONCURRENT_RECLAIM_BATCH == 0) {
+    reclaim_locked(c);
+  }
+}
+
+int rbtree_concurrent_insert(rbtree_concurrent *c, const key_t key)
+{
+  pthread_mutex_lock(&c->writer);
+  write_begin(c);
+  node_t *node = rbtree_insert(c->tree, key);
+  write_end(c);
+  int ret = node != NULL ? 0 : -1;
+  pthread_mutex_unlock(&c->writer);
+  return ret;
+}
+
+int rbtree_concurrent_erase(rbtree_concurrent *c, const key_t key)
+{
+  pthread_mutex_lock(&c->writer);
+  node_t *node = rbtree_find(c->tree, key);
+#ifdef RBTREE_MULTISET
+  // rbtree_erase처럼 개수만 줄인다. 구조가 바뀌지 않으므로 독자에게 알릴 필요도 없다.
+  if (node != NULL && node->count > 1) {
+    rbtree_erase(c->tree, node);
+    pthread_mutex_unlock(&c->writer);
+    return 1;
+  }
+#endif
+  if (node != NULL) {
+    write_begin(c);
+    rbtree_unlink(c->tree, node);
+    write_end(c);
+    retire(c, node);
+  }
+  pthread_mutex_unlock(&c->writer);
+  return node != NULL;
+}
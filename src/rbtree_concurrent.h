@@ -0,0 +1,56 @@
+#ifndef _RBTREE_CONCURRENT_H_
+#define _RBTREE_CONCURRENT_H_
+
+#include <pthread.h>
+
+#include "rbtree.h"
+
+// 쓰기는 한 번에 하나씩, 읽기는 lock 없이 하는 rbtree.
+// 쓰기는 seqcount로 구조 변경 구간을 알리고, 떼어 낸 노드는 epoch 기반 회수로 미뤄서 반납한다.
+// 독자는 찾은 노드를 바로 돌려주고, 찾지 못했을 때만 그 사이에 쓰기가 있었는지 확인해 다시 찾는다.
+
+#define RBTREE_CONCURRENT_MAX_READERS 64
+
+// 독자 스레드 하나의 슬롯. (epoch << 1) | 1이면 읽는 중, 0이면 쉬는 중이다.
+typedef struct {
+  uint64_t state;
+  int in_use;
+} __attribute__((aligned(64))) rbtree_reader;
+
+// 회수를 기다리는 노드 목록
+typedef struct {
+  node_t **nodes;
+  size_t n, cap;
+} rbtree_retired;
+
+typedef struct {
+  rbtree *tree;
+  pthread_mutex_t writer;
+  uint64_t seq __attribute__((aligned(64))); // 홀수면 쓰기 중
+  uint64_t epoch;
+  rbtree_retired retired[3]; // epoch % 3마다 하나
+  rbtree_reader readers[RBTREE_CONCURRENT_MAX_READERS];
+} rbtree_concurrent;
+
+rbtree_concurrent *new_rbtree_concurrent(void);
+void delete_rbtree_concurrent(rbtree_concurrent *); // 모든 독자가 등록을 해제한 뒤에 부른다
+
+// 독자 스레드는 슬롯을 하나 받아서 읽기 구간을 begin/end로 감싼다. 슬롯이 모자라면 NULL.
+rbtree_reader *rbtree_concurrent_register(rbtree_concurrent *);
+void rbtree_concurrent_unregister(rbtree_reader *);
+void rbtree_concurrent_read_begin(rbtree_concurrent *, rbtree_reader *);
+void rbtree_concurrent_read_end(rbtree_reader *);
+
+// 읽기 구간 안에서만 부른다. 돌려준 노드는 read_end 전까지 유효하다.
+node_t *rbtree_concurrent_find(const rbtree_concurrent *, const key_t);
+
+// 쓰기. 여러 스레드가 불러도 되지만 writer mutex로 한 번에 하나씩 실행된다.
+int rbtree_concurrent_insert(rbtree_concurrent *, const key_t); // 성공하면 0, 메모리가 부족하면 -1
+// 키 하나를 지웠으면 1, 없으면 0. 멀티셋 모드에서는 rbtree_erase처럼 개수를 줄이고 0이 될 때만 노드를 뗀다.
+// 회수 목록을 늘릴 메모리가 없으면 독자가 모두 지나갈 때까지 기다리므로 읽기 구간 안에서 부르지 않는다.
+int rbtree_concurrent_erase(rbtree_concurrent *, const key_t);
+
+// 모든 독자가 지난 epoch를 벗어났으면 epoch를 넘기고 안전해진 노드를 반납한다. 반납한 수를 돌려준다.
+size_t rbtree_concurrent_reclaim(rbtree_concurrent *);
+
+#endif // _RBTREE_CONCURRENT_H_
@@ -0,0 +1,186 @@
+#ifndef _RBTREE_FIXUP_H_
+#define _RBTREE_FIXUP_H_
+
+// 레드블랙 트리의 회전과 삽입/삭제 복구를 한 번만 쓰고, 노드 모양이 다른 변형이 모두 이것으로 함수를 만든다.
+// (rbtree.c의 int API, rbtree32.c의 인덱스 노드, rbtree_intrusive.c의 링크, rbtree_template.h의 템플릿)
+//
+//   RBTREE_FIXUP_GENERATE(attr, prefix, tree_type, node_ref, ops)
+//
+// prefix_left_rotate, prefix_right_rotate, prefix_insert_fixup, prefix_erase_fixup을 만든다.
+// node_ref는 노드를 가리키는 값(포인터나 인덱스)의 타입이고, 노드에는 ops로 시작하는 매크로로만 접근한다.
+//
+//   ops_NIL(t)               빈 자리를 나타내는 값(sentinel, NULL, 0번 인덱스). 이 값에는 쓰지 않는다.
+//   ops_ROOT(t)              루트 링크(lvalue)
+//   ops_LEFT(t, x)           x의 자식 링크(lvalue)
+//   ops_RIGHT(t, x)
+//   ops_LINK(t, link, v)     ops_ROOT나 ops_LEFT/RIGHT로 얻은 링크에 v를 쓴다.
+//   ops_PARENT(t, x)
+//   ops_SET_PARENT(t, x, p)  x는 nil이 아니다.
+//   ops_COLOR(t, x)          nil은 블랙이다.
+//   ops_SET_COLOR(t, x, c)   x는 nil이 아니다.
+//   ops_ROTATED(t, x, y, counter)  x가 y의 자식으로 내려간 뒤 부르는 훅(부가 정보, 계측)
+//   ops_LOOP(t, counter)           복구 루프를 한 번 돌 때마다 부르는 훅
+//
+// counter는 rbtree_stats의 필드 이름(left_rotations, insert_fixup_loops 등)이다.
+
+#define RBTREE_FIXUP_GENERATE(attr, prefix, tree_type, node_ref, ops)                           \
+  attr void prefix##_left_rotate(tree_type *t, node_ref x)                                      \
+  {                                                                                             \
+    node_ref y = ops##_RIGHT(t, x);                                                             \
+    node_ref xp = ops##_PARENT(t, x);                                                           \
+    /* y의 왼쪽 서브트리를 x의 오른쪽으로 옮기고 y를 x 자리로 올린다. */                        \
+    ops##_LINK(t, ops##_RIGHT(t, x), ops##_LEFT(t, y));                                         \
+    if (ops##_LEFT(t, y) != ops##_NIL(t)) {                                                     \
+      ops##_SET_PARENT(t, ops##_LEFT(t, y), x);                                                 \
+    }                                                                                           \
+    ops##_SET_PARENT(t, y, xp);                                                                 \
+    if (xp == ops##_NIL(t)) {                                                                   \
+      ops##_LINK(t, ops##_ROOT(t), y);                                                          \
+    } else if (x == ops##_LEFT(t, xp)) {                                                        \
+      ops##_LINK(t, ops##_LEFT(t, xp), y);                                                      \
+    } else {                                                                                    \
+      ops##_LINK(t, ops##_RIGHT(t, xp), y);                                                     \
+    }                                                                                           \
+    ops##_LINK(t, ops##_LEFT(t, y), x);                                                         \
+    ops##_SET_PARENT(t, x, y);                                                                  \
+    ops##_ROTATED(t, x, y, left_rotations);                                                     \
+  }                                                                                             \
+  attr void prefix##_right_rotate(tree_type *t, node_ref x)                                     \
+  {                                                                                             \
+    node_ref y = ops##_LEFT(t, x);                                                              \
+    node_ref xp = ops##_PARENT(t, x);                                                           \
+    ops##_LINK(t, ops##_LEFT(t, x), ops##_RIGHT(t, y));                                         \
+    if (ops##_RIGHT(t, y) != ops##_NIL(t)) {                                                    \
+      ops##_SET_PARENT(t, ops##_RIGHT(t, y), x);                                                \
+    }                                                                                           \
+    ops##_SET_PARENT(t, y, xp);                                                                 \
+    if (xp == ops##_NIL(t)) {                                                                   \
+      ops##_LINK(t, ops##_ROOT(t), y);                                                          \
+    } else if (x == ops##_LEFT(t, xp)) {                                                        \
+      ops##_LINK(t, ops##_LEFT(t, xp), y);                                                      \
+    } else {                                                                                    \
+      ops##_LINK(t, ops##_RIGHT(t, xp), y);                                                     \
+    }                                                                                           \
+    ops##_LINK(t, ops##_RIGHT(t, y), x);                                                        \
+    ops##_SET_PARENT(t, x, y);                                                                  \
+    ops##_ROTATED(t, x, y, right_rotations);                                                    \
+  }                                                                                             \
+  /* 새 레드 노드 z부터 복구한다. 루트를 블랙으로 바꾸며 블랙 높이가 늘었으면 1. */             \
+  attr int prefix##_insert_fixup(tree_type *t, node_ref z)                                      \
+  {                                                                                             \
+    while (z != ops##_ROOT(t) && ops##_COLOR(t, ops##_PARENT(t, z)) == RBTREE_RED) {            \
+      ops##_LOOP(t, insert_fixup_loops);                                                        \
+      node_ref zp = ops##_PARENT(t, z);                                                         \
+      node_ref zpp = ops##_PARENT(t, zp); /* 부모가 레드이므로 루트가 아니다. */                \
+      if (zp == ops##_LEFT(t, zpp)) {                                                           \
+        node_ref y = ops##_RIGHT(t, zpp);                                                       \
+        if (ops##_COLOR(t, y) == RBTREE_RED) {                                                  \
+          /* 케이스 1: 삼촌이 레드면 조부모의 블랙을 부모와 삼촌에게 내린다. */                 \
+          ops##_SET_COLOR(t, zp, RBTREE_BLACK);                                                 \
+          ops##_SET_COLOR(t, y, RBTREE_BLACK);                                                  \
+          ops##_SET_COLOR(t, zpp, RBTREE_RED);                                                  \
+          z = zpp;                                                                              \
+        } else {                                                                                \
+          if (z == ops##_RIGHT(t, zp)) {                                                        \
+            /* 케이스 2: 안쪽 자식이면 부모에서 회전해 케이스 3으로 바꾼다. */                  \
+            z = zp;                                                                             \
+            prefix##_left_rotate(t, z);                                                         \
+            zp = ops##_PARENT(t, z);                                                            \
+          }                                                                                     \
+          /* 케이스 3: 조부모에서 회전한다. */                                                  \
+          ops##_SET_COLOR(t, zp, RBTREE_BLACK);                                                 \
+          ops##_SET_COLOR(t, zpp, RBTREE_RED);                                                  \
+          prefix##_right_rotate(t, zpp);                                                        \
+        }                                                                                       \
+      } else {                                                                                  \
+        node_ref y = ops##_LEFT(t, zpp);                                                        \
+        if (ops##_COLOR(t, y) == RBTREE_RED) {                                                  \
+          ops##_SET_COLOR(t, zp, RBTREE_BLACK);                                                 \
+          ops##_SET_COLOR(t, y, RBTREE_BLACK);                                                  \
+          ops##_SET_COLOR(t, zpp, RBTREE_RED);                                                  \
+          z = zpp;                                                                              \
+        } else {                                                                                \
+          if (z == ops##_LEFT(t, zp)) {                                                         \
+            z = zp;                                                                             \
+            prefix##_right_rotate(t, z);                                                        \
+            zp = ops##_PARENT(t, z);                                                            \
+          }                                                                                     \
+          ops##_SET_COLOR(t, zp, RBTREE_BLACK);                                                 \
+          ops##_SET_COLOR(t, zpp, RBTREE_RED);                                                  \
+          prefix##_left_rotate(t, zpp);                                                         \
+        }                                                                                       \
+      }                                                                                         \
+    }                                                                                           \
+    const int grew = ops##_COLOR(t, ops##_ROOT(t)) == RBTREE_RED;                               \
+    ops##_SET_COLOR(t, ops##_ROOT(t), RBTREE_BLACK);                                            \
+    return grew;                                                                                \
+  }                                                                                             \
+  /* 블랙 하나를 잃은 자리 x부터 복구한다. x가 nil일 수 있으므로 부모 xp를 따로 받는다. */      \
+  attr void prefix##_erase_fixup(tree_type *t, node_ref x, node_ref xp)                         \
+  {                                                                                             \
+    while (x != ops##_ROOT(t) && ops##_COLOR(t, x) == RBTREE_BLACK) {                           \
+      ops##_LOOP(t, erase_fixup_loops);                                                         \
+      if (x == ops##_LEFT(t, xp)) {                                                             \
+        node_ref w = ops##_RIGHT(t, xp); /* 블랙 높이가 1 이상 남으므로 형제는 nil이 아니다. */ \
+        if (ops##_COLOR(t, w) == RBTREE_RED) {                                                  \
+          /* 케이스 1: 형제가 레드면 부모에서 회전해 블랙 형제를 만든다. */                     \
+          ops##_SET_COLOR(t, w, RBTREE_BLACK);                                                  \
+          ops##_SET_COLOR(t, xp, RBTREE_RED);                                                   \
+          prefix##_left_rotate(t, xp);                                                          \
+          w = ops##_RIGHT(t, xp);                                                               \
+        }                                                                                       \
+        if (ops##_COLOR(t, ops##_LEFT(t, w)) == RBTREE_BLACK &&                                 \
+            ops##_COLOR(t, ops##_RIGHT(t, w)) == RBTREE_BLACK) {                                \
+          /* 케이스 2: 형제의 자식이 모두 블랙이면 형제를 레드로 바꾸고 올라간다. */            \
+          ops##_SET_COLOR(t, w, RBTREE_RED);                                                    \
+          x = xp;                                                                               \
+          xp = ops##_PARENT(t, x);                                                              \
+        } else {                                                                                \
+          if (ops##_COLOR(t, ops##_RIGHT(t, w)) == RBTREE_BLACK) {                              \
+            /* 케이스 3: 바깥쪽 조카가 블랙이면 형제에서 회전해 케이스 4로 바꾼다. */           \
+            ops##_SET_COLOR(t, ops##_LEFT(t, w), RBTREE_BLACK);                                 \
+            ops##_SET_COLOR(t, w, RBTREE_RED);                                                  \
+            prefix##_right_rotate(t, w);                                                        \
+            w = ops##_RIGHT(t, xp);                                                             \
+          }                                                                                     \
+          /* 케이스 4: 부모에서 회전하면 잃은 블랙이 채워진다. */                               \
+          ops##_SET_COLOR(t, w, ops##_COLOR(t, xp));                                            \
+          ops##_SET_COLOR(t, xp, RBTREE_BLACK);                                                 \
+          ops##_SET_COLOR(t, ops##_RIGHT(t, w), RBTREE_BLACK);                                  \
+          prefix##_left_rotate(t, xp);                                                          \
+          x = ops##_ROOT(t);                                                                    \
+        }                                                                                       \
+      } else {                                                                                  \
+        node_ref w = ops##_LEFT(t, xp);                                                         \
+        if (ops##_COLOR(t, w) == RBTREE_RED) {                                                  \
+          ops##_SET_COLOR(t, w, RBTREE_BLACK);                                                  \
+          ops##_SET_COLOR(t, xp, RBTREE_RED);                                                   \
+          prefix##_right_rotate(t, xp);                                                         \
+          w = ops##_LEFT(t, xp);                                                                \
+        }                                                                                       \
+        if (ops##_COLOR(t, ops##_RIGHT(t, w)) == RBTREE_BLACK &&                                \
+            ops##_COLOR(t, ops##_LEFT(t, w)) == RBTREE_BLACK) {                                 \
+          ops##_SET_COLOR(t, w, RBTREE_RED);                                                    \
+          x = xp;                                                                               \
+          xp = ops##_PARENT(t, x);                                                              \
+        } else {                                                                                \
+          if (ops##_COLOR(t, ops##_LEFT(t, w)) == RBTREE_BLACK) {                               \
+            ops##_SET_COLOR(t, ops##_RIGHT(t, w), RBTREE_BLACK);                                \
+            ops##_SET_COLOR(t, w, RBTREE_RED);                                                  \
+            prefix##_left_rotate(t, w);                                                         \
+            w = ops##_LEFT(t, xp);                                                              \
+          }                                                                                     \
+          ops##_SET_COLOR(t, w, ops##_COLOR(t, xp));                                            \
+          ops##_SET_COLOR(t, xp, RBTREE_BLACK);                                                 \
+          ops##_SET_COLOR(t, ops##_LEFT(t, w), RBTREE_BLACK);                                   \
+          prefix##_right_rotate(t, xp);                                                         \
+          x = ops##_ROOT(t);                                                                    \
+        }                                                                                       \
+      }                                                                                         \
+    }                                                                                           \
+    if (x != ops##_NIL(t)) {                                                                    \
+      ops##_SET_COLOR(t, x, RBTREE_BLACK);                                                      \
+    }                                                                                           \
+  }
+
+#endif // _RBTREE_FIXUP_H_
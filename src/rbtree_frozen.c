@@ -0,0 +1,266 @@
+#include "rbtree_frozen.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RBTREE_FROZEN_X86
+#endif
+
+#define FANOUT (RBTREE_FROZEN_BLOCK + 1)
+#define BLOCK_BYTES (RBTREE_FROZEN_BLOCK * sizeof(key_t))
+
+_Static_assert(sizeof(key_t) == 4, "블록 비교는 32비트 키를 가정한다");
+
+// 키 n개를 담는 층 구성을 계산하고 전체 블록 수를 돌려준다.
+// 잎 층은 ceil(n / 16)개 블록이고, 위 층은 아래 층 블록 17개마다 하나씩 둔다.
+static size_t plan_layers(rbtree_frozen *f, size_t n)
+{
+  size_t blocks[RBTREE_FROZEN_MAX_HEIGHT];
+  int height = 0;
+
+  if (n > 0) {
+    size_t b = (n + RBTREE_FROZEN_BLOCK - 1) / RBTREE_FROZEN_BLOCK;
+    blocks[height++] = b;
+    while (b > 1) {
+      b = (b + FANOUT - 1) / FANOUT;
+      blocks[height++] = b;
+    }
+  }
+
+  size_t total = 0;
+  for (int i = 0; i < height; i++) {
+    f->layer[i] = total;
+    total += blocks[height - 1 - i];
+  }
+  f->height = height;
+  return total;
+}
+
+// 잎 층에 정렬된 키를 채운 뒤 위 층을 아래에서부터 만든다.
+// 블록의 j번째 키는 (j + 1)번째 자식 서브트리의 가장 작은 키이고, 없는 자식은 가장 큰 키로 채운다.
+static void build_layers(rbtree_frozen *f, size_t total)
+{
+  const int leaf_layer = f->height - 1;
+  key_t *leaves = f->keys + f->layer[leaf_layer] * RBTREE_FROZEN_BLOCK;
+  const size_t n_leaves = total - f->layer[leaf_layer];
+  for (size_t i = f->n; i < n_leaves * RBTREE_FROZEN_BLOCK; i++) {
+    leaves[i] = RBTREE_KEY_MAX;
+  }
+
+  size_t span = 1; // 한 층 아래 블록 하나가 덮는 잎 블록 수
+  for (int h = leaf_layer - 1; h >= 0; h--) {
+    key_t *block = f->keys + f->layer[h] * RBTREE_FROZEN_BLOCK;
+    const size_t n_blocks = f->layer[h + 1] - f->layer[h];
+    for (size_t k = 0; k < n_blocks; k++) {
+      for (size_t j = 0; j < RBTREE_FROZEN_BLOCK; j++) {
+        size_t leaf = (k * FANOUT + j + 1) * span;
+        block[k * RBTREE_FROZEN_BLOCK + j] = leaf < n_leaves ? leaves[leaf * RBTREE_FROZEN_BLOCK] : RBTREE_KEY_MAX;
+      }
+    }
+    span *= FANOUT;
+  }
+}
+
+static rbtree_frozen_simd detect_simd(void)
+{
+#ifdef RBTREE_FROZEN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+    return RBTREE_FROZEN_AVX2;
+  }
+#endif
+#ifdef __SSE2__
+  return RBTREE_FROZEN_SSE2;
+#else
+  return RBTREE_FROZEN_SCALAR;
+#endif
+}
+
+// 원본을 한 번만 훑는다. 순서 통계가 있으면 루트의 size가 곧 키 수이므로 잎 층에 바로 쓰고,
+// 없으면 늘려 가는 버퍼에 내보낸 뒤 잎 층으로 옮긴다.
+int rbtree_refreeze(rbtree_frozen *f, const rbtree *t)
+{
+  if (f == NULL || t == NULL) {
+    return -1;
+  }
+
+#ifdef RBTREE_ORDER_STATS
+  const size_t n = t->root->size;
+  key_t *scratch = NULL;
+#else
+  size_t n = 0, cap = f->n > 256 ? f->n : 256;
+  key_t *scratch = (key_t *)malloc(cap * sizeof(key_t));
+  if (!scratch) {
+    return -1;
+  }
+  rbtree_cursor cursor;
+  rbtree_cursor_init(&cursor);
+  size_t written;
+  while ((written = rbtree_export(t, &cursor, scratch + n, cap - n)) > 0) {
+    n += written;
+    if (n == cap) {
+      key_t *grown = cap <= SIZE_MAX / (2 * sizeof(key_t)) ? (key_t *)realloc(scratch, 2 * cap * sizeof(key_t)) : NULL;
+      if (!grown) {
+        free(scratch);
+        return -1;
+      }
+      scratch = grown;
+      cap *= 2;
+    }
+  }
+#endif
+
+  // 층 구성은 할당에 성공한 뒤에 반영해서, 실패하면 이전 사본을 그대로 쓸 수 있게 한다.
+  rbtree_frozen plan = *f;
+  size_t total = plan_layers(&plan, n);
+  if (total > SIZE_MAX / BLOCK_BYTES) {
+    free(scratch);
+    return -1;
+  }
+  if (total > f->capacity) {
+    key_t *keys = (key_t *)aligned_alloc(64, total * BLOCK_BYTES);
+    if (!keys) {
+      free(scratch);
+      return -1;
+    }
+    free(f->keys);
+    plan.keys = keys;
+    plan.capacity = total;
+  }
+
+  plan.n = n;
+  *f = plan;
+  if (n > 0) {
+    key_t *leaves = f->keys + f->layer[f->height - 1] * RBTREE_FROZEN_BLOCK;
+#ifdef RBTREE_ORDER_STATS
+    rbtree_to_array(t, leaves, n);
+#else
+    memcpy(leaves, scratch, n * sizeof(key_t));
+#endif
+    build_layers(f, total);
+  }
+  free(scratch);
+  return 0;
+}
+
+rbtree_frozen *rbtree_freeze(const rbtree *t)
+{
+  rbtree_frozen *f = (rbtree_frozen *)calloc(1, sizeof(rbtree_frozen));
+  if (!f) {
+    return NULL;
+  }
+  f->simd = detect_simd();
+  if (rbtree_refreeze(f, t) < 0) {
+    delete_rbtree_frozen(f);
+    return NULL;
+  }
+  return f;
+}
+
+void delete_rbtree_frozen(rbtree_frozen *f)
+{
+  if (!f) {
+    return;
+  }
+  free(f->keys);
+  free(f);
+}
+
+// 블록 하나에서 key보다 작은 키의 수. 컴파일러가 벡터화할 수 있도록 분기 없이 더한다.
+static inline unsigned count_less_scalar(const key_t *block, const key_t key)
+{
+  unsigned count = 0;
+  for (int i = 0; i < RBTREE_FROZEN_BLOCK; i++) {
+    count += block[i] < key;
+  }
+  return count;
+}
+
+// 루트에서 잎 층까지 층마다 블록 하나를 비교해 내려간다. 높이만큼 반복할 뿐 키에 따라 갈라지는 분기가 없다.
+// 같은 키가 여러 블록에 걸쳐 있으면 구분 키와 같은 key는 왼쪽으로 가고, 왼쪽 블록이 모두 작으면
+// 그 블록 끝의 위치가 곧 오른쪽 블록의 시작이므로 결과는 그대로 맞다.
+static inline __attribute__((always_inline)) size_t
+frozen_rank(const rbtree_frozen *f, const key_t key, unsigned (*count_less)(const key_t *, const key_t))
+{
+  size_t k = 0;
+  for (int h = 0; h < f->height - 1; h++) {
+    k = k * FANOUT + count_less(f->keys + (f->layer[h] + k) * RBTREE_FROZEN_BLOCK, key);
+  }
+  return k * RBTREE_FROZEN_BLOCK + count_less(f->keys + (f->layer[f->height - 1] + k) * RBTREE_FROZEN_BLOCK, key);
+}
+
+static size_t rank_scalar(const rbtree_frozen *f, const key_t key)
+{
+  return frozen_rank(f, key, count_less_scalar);
+}
+
+#ifdef __SSE2__
+// 네 번 비교한 결과를 바이트 16개로 좁혀 마스크 하나로 센다.
+static inline unsigned count_less_sse2(const key_t *block, const key_t key)
+{
+  const __m128i x = _mm_set1_epi32(key);
+  const __m128i *b = (const __m128i *)block;
+  __m128i lo = _mm_packs_epi32(_mm_cmpgt_epi32(x, _mm_load_si128(b)), _mm_cmpgt_epi32(x, _mm_load_si128(b + 1)));
+  __m128i hi = _mm_packs_epi32(_mm_cmpgt_epi32(x, _mm_load_si128(b + 2)), _mm_cmpgt_epi32(x, _mm_load_si128(b + 3)));
+  return (unsigned)__builtin_popcount(_mm_movemask_epi8(_mm_packs_epi16(lo, hi)));
+}
+
+static size_t rank_sse2(const rbtree_frozen *f, const key_t key)
+{
+  return frozen_rank(f, key, count_less_sse2);
+}
+#endif
+
+#ifdef RBTREE_FROZEN_X86
+__attribute__((target("avx2,popcnt"))) static inline unsigned count_less_avx2(const key_t *block, const key_t key)
+{
+  const __m256i x = _mm256_set1_epi32(key);
+  const __m256i *b = (const __m256i *)block;
+  __m256i lo = _mm256_cmpgt_epi32(x, _mm256_load_si256(b));
+  __m256i hi = _mm256_cmpgt_epi32(x, _mm256_load_si256(b + 1));
+  unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(lo)) |
+                  (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(hi)) << 8;
+  return (unsigned)__builtin_popcount(mask);
+}
+
+__attribute__((target("avx2,popcnt"))) static size_t rank_avx2(const rbtree_frozen *f, const key_t key)
+{
+  return frozen_rank(f, key, count_less_avx2);
+}
+#endif
+
+size_t rbtree_frozen_rank(const rbtree_frozen *f, const key_t key)
+{
+  if (f->height == 0) {
+    return 0;
+  }
+
+  switch (f->simd) {
+#ifdef RBTREE_FROZEN_X86
+  case RBTREE_FROZEN_AVX2:
+    return rank_avx2(f, key);
+#endif
+#ifdef __SSE2__
+  case RBTREE_FROZEN_SSE2:
+    return rank_sse2(f, key);
+#endif
+  default:
+    return rank_scalar(f, key);
+  }
+}
+
+const key_t *rbtree_frozen_lower_bound(const rbtree_frozen *f, const key_t key)
+{
+  size_t rank = rbtree_frozen_rank(f, key);
+  if (rank >= f->n) {
+    return NULL;
+  }
+  return f->keys + f->layer[f->height - 1] * RBTREE_FROZEN_BLOCK + rank;
+}
+
+int rbtree_frozen_find(const rbtree_frozen *f, const key_t key)
+{
+  const key_t *found = rbtree_frozen_lower_bound(f, key);
+  return found != NULL && *found == key;
+}
@@ -0,0 +1,35 @@
+#ifndef _RBTREE_FROZEN_H_
+#define _RBTREE_FROZEN_H_
+
+#include "rbtree.h"
+
+// 조회만 하는 구간을 위한 읽기 전용 사본. 키를 64바이트(키 16개) 블록으로 묶은 정적 B+ 트리(S+ 트리)로,
+// 마지막 층은 정렬된 키 전체이고 위 층의 블록은 자식 17개를 가른다. 탐색은 층마다 캐시 라인 하나를
+// 읽고, 블록 안에서는 분기 없이 SIMD 비교로 key보다 작은 키의 수를 센다.
+// 원본 트리가 바뀌어도 자동으로 따라가지 않으므로 rbtree_refreeze로 다시 만든다.
+
+#define RBTREE_FROZEN_BLOCK 16 // 블록 하나의 키 수
+#define RBTREE_FROZEN_MAX_HEIGHT 16
+
+// 블록 비교에 쓰는 명령어. rbtree_freeze가 CPU를 보고 가장 넓은 것을 고른다.
+typedef enum { RBTREE_FROZEN_SCALAR, RBTREE_FROZEN_SSE2, RBTREE_FROZEN_AVX2 } rbtree_frozen_simd;
+
+typedef struct {
+  key_t *keys;     // 모든 층의 블록을 루트 층부터 이어 붙인 배열(64바이트 정렬)
+  size_t n;        // 키 수
+  size_t capacity; // keys에 담을 수 있는 블록 수
+  int height;      // 층 수(빈 트리는 0)
+  size_t layer[RBTREE_FROZEN_MAX_HEIGHT]; // 층별 첫 블록의 번호
+  rbtree_frozen_simd simd;
+} rbtree_frozen;
+
+rbtree_frozen *rbtree_freeze(const rbtree *);
+int rbtree_refreeze(rbtree_frozen *, const rbtree *); // 할당을 재사용해 다시 만든다. 실패하면 -1
+void delete_rbtree_frozen(rbtree_frozen *);
+
+// 모두 O(log_17 n)번의 캐시 라인 접근으로 끝난다.
+size_t rbtree_frozen_rank(const rbtree_frozen *, const key_t);               // key보다 작은 키의 수
+const key_t *rbtree_frozen_lower_bound(const rbtree_frozen *, const key_t); // key 이상인 첫 키, 없으면 NULL
+int rbtree_frozen_find(const rbtree_frozen *, const key_t);                 // 있으면 1, 없으면 0
+
+#endif // _RBTREE_FROZEN_H_
@@ -0,0 +1,160 @@
+#include "rbtree_intrusive.h"
+#include "rbtree_fixup.h"
+
+// nil 대신 NULL을 쓰므로 NULL은 블랙으로 본다.
+static inline int is_red(const rbtree_link *n)
+{
+  return n != NULL && rbtree_link_color(n) == RBTREE_RED;
+}
+
+static inline void set_parent(rbtree_link *n, rbtree_link *p)
+{
+  n->parent_color = (uintptr_t)p | (n->parent_color & 1);
+}
+
+static inline void set_color(rbtree_link *n, color_t c)
+{
+  n->parent_color = (n->parent_color & ~(uintptr_t)1) | (uintptr_t)c;
+}
+
+static inline void set_parent_color(rbtree_link *n, rbtree_link *p, color_t c)
+{
+  n->parent_color = (uintptr_t)p | (uintptr_t)c;
+}
+
+// parent의 자식 old를 new로 바꾼다. parent가 NULL이면 루트를 바꾼다.
+static inline void replace_child(rbtree_link_root *root, rbtree_link *parent, rbtree_link *old, rbtree_link *new)
+{
+  if (parent == NULL) {
+    root->root = new;
+  } else if (parent->left == old) {
+    parent->left = new;
+  } else {
+    parent->right = new;
+  }
+}
+
+// rbtree_fixup.h가 노드에 접근하는 방법. 빈 자리는 NULL이다.
+#define RBTREE_LINK_OPS_NIL(t) NULL
+#define RBTREE_LINK_OPS_ROOT(t) ((t)->root)
+#define RBTREE_LINK_OPS_LEFT(t, n) ((n)->left)
+#define RBTREE_LINK_OPS_RIGHT(t, n) ((n)->right)
+#define RBTREE_LINK_OPS_LINK(t, link, v) ((link) = (v))
+#define RBTREE_LINK_OPS_PARENT(t, n) rbtree_link_parent(n)
+#define RBTREE_LINK_OPS_SET_PARENT(t, n, p) set_parent((n), (p))
+#define RBTREE_LINK_OPS_COLOR(t, n) (is_red(n) ? RBTREE_RED : RBTREE_BLACK)
+#define RBTREE_LINK_OPS_SET_COLOR(t, n, c) set_color((n), (c))
+#define RBTREE_LINK_OPS_ROTATED(t, x, y, counter) ((void)0)
+#define RBTREE_LINK_OPS_LOOP(t, counter) ((void)0)
+
+RBTREE_FIXUP_GENERATE(static, rbtree_link, rbtree_link_root, rbtree_link *, RBTREE_LINK_OPS)
+
+void rbtree_link_node(rbtree_link *node, rbtree_link *parent, rbtree_link **link)
+{
+  set_parent_color(node, parent, RBTREE_RED);
+  node->left = node->right = NULL;
+  *link = node;
+}
+
+void rbtree_link_insert_color(rbtree_link_root *root, rbtree_link *z)
+{
+  rbtree_link_insert_fixup(root, z);
+}
+
+// 자식이 둘이면 후계자를 z 자리로 옮긴다. 키를 복사하지 않고 링크만 바꾸므로 사용자 구조체는 움직이지 않는다.
+void rbtree_link_erase(rbtree_link_root *root, rbtree_link *z)
+{
+  rbtree_link *child, *parent;
+  color_t removed_color;
+
+  if (z->left == NULL || z->right == NULL) {
+    child = z->left ? z->left : z->right;
+    parent = rbtree_link_parent(z);
+    removed_color = rbtree_link_color(z);
+    replace_child(root, parent, z, child);
+    if (child) {
+      set_parent(child, parent);
+    }
+  } else {
+    rbtree_link *y = z->right;
+    while (y->left) {
+      y = y->left;
+    }
+    removed_color = rbtree_link_color(y);
+    child = y->right;
+
+    if (rbtree_link_parent(y) == z) {
+      parent = y;
+    } else {
+      parent = rbtree_link_parent(y);
+      parent->left = child;
+      if (child) {
+        set_parent(child, parent);
+      }
+      y->right = z->right;
+      set_parent(y->right, y);
+    }
+    y->left = z->left;
+    set_parent(y->left, y);
+    replace_child(root, rbtree_link_parent(z), z, y);
+    set_parent_color(y, rbtree_link_parent(z), rbtree_link_color(z));
+  }
+
+  if (removed_color == RBTREE_BLACK) {
+    rbtree_link_erase_fixup(root, child, parent);
+  }
+}
+
+rbtree_link *rbtree_link_first(const rbtree_link_root *root)
+{
+  rbtree_link *node = root->root;
+  while (node && node->left) {
+    node = node->left;
+  }
+  return node;
+}
+
+rbtree_link *rbtree_link_last(const rbtree_link_root *root)
+{
+  rbtree_link *node = root->root;
+  while (node && node->right) {
+    node = node->right;
+  }
+  return node;
+}
+
+rbtree_link *rbtree_link_next(const rbtree_link *node)
+{
+  if (node->right) {
+    node = node->right;
+    while (node->left) {
+      node = node->left;
+    }
+    return (rbtree_link *)node;
+  }
+
+  rbtree_link *parent = rbtree_link_parent(node);
+  while (parent && node == parent->right) {
+    node = parent;
+    parent = rbtree_link_parent(parent);
+  }
+  return parent;
+}
+
+rbtree_link *rbtree_link_prev(const rbtree_link *node)
+{
+  if (node->left) {
+    node = node->left;
+    while (node->right) {
+      node = node->right;
+    }
+    return (rbtree_link *)node;
+  }
+
+  rbtree_link *parent = rbtree_link_parent(node);
+  while (parent && node == parent->left) {
+    node = parent;
+    parent = rbtree_link_parent(parent);
+  }
+  return parent;
+}
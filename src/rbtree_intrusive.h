@@ -0,0 +1,70 @@
+#ifndef _RBTREE_INTRUSIVE_H_
+#define _RBTREE_INTRUSIVE_H_
+
+#include "rbtree.h"
+
+// 사용자 구조체 안에 넣어 쓰는 rbtree 링크. 노드를 따로 할당하지 않고, 탐색 중에 노드에서 데이터로
+// 한 번 더 건너가는 포인터도 없다. 키는 사용자 구조체에 있으므로 비교는 호출하는 쪽이 함수로 넘긴다.
+// 색은 parent 포인터의 최하위 비트에 둔다.(RBTREE_COMPACT와 같은 방식, 링크 24바이트)
+typedef struct rbtree_link {
+  uintptr_t parent_color;
+  struct rbtree_link *left, *right; // 없으면 NULL
+} rbtree_link;
+
+typedef struct {
+  rbtree_link *root;
+} rbtree_link_root;
+
+#define RBTREE_LINK_ROOT_INIT {NULL}
+
+#define rbtree_link_parent(n) ((rbtree_link *)((n)->parent_color & ~(uintptr_t)1))
+#define rbtree_link_color(n) ((color_t)((n)->parent_color & 1))
+
+// 링크 포인터에서 그 링크를 담은 구조체를 얻는다. ptr이 NULL이면 안 된다.
+#define rbtree_entry(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+// 직접 내려가서 찾은 자리(*link, 부모 parent)에 node를 붙이고, 이어서 insert_color로 균형을 맞춘다.
+void rbtree_link_node(rbtree_link *node, rbtree_link *parent, rbtree_link **link);
+void rbtree_link_insert_color(rbtree_link_root *, rbtree_link *);
+// node를 트리에서 떼어 낸다. node의 메모리는 호출하는 쪽이 관리한다.
+void rbtree_link_erase(rbtree_link_root *, rbtree_link *);
+
+// 순서대로 훑기. 없으면 NULL
+rbtree_link *rbtree_link_first(const rbtree_link_root *);
+rbtree_link *rbtree_link_last(const rbtree_link_root *);
+rbtree_link *rbtree_link_next(const rbtree_link *);
+rbtree_link *rbtree_link_prev(const rbtree_link *);
+
+// less(a, b)가 참이면 a가 앞에 온다. 같은 키는 rbtree_insert처럼 오른쪽에 들어간다.
+// 헤더에 두어 비교 함수가 호출한 자리에서 인라인되게 한다.
+static inline void rbtree_link_add(rbtree_link_root *root, rbtree_link *node,
+                                   int (*less)(const rbtree_link *, const rbtree_link *))
+{
+  rbtree_link **link = &root->root, *parent = NULL;
+  while (*link) {
+    parent = *link;
+    link = less(node, parent) ? &parent->left : &parent->right;
+  }
+  rbtree_link_node(node, parent, link);
+  rbtree_link_insert_color(root, node);
+}
+
+// cmp(key, node)는 key가 node보다 작으면 음수, 같으면 0, 크면 양수를 돌려준다. 없으면 NULL
+static inline rbtree_link *rbtree_link_find(const rbtree_link_root *root, const void *key,
+                                            int (*cmp)(const void *, const rbtree_link *))
+{
+  rbtree_link *node = root->root;
+  while (node) {
+    int c = cmp(key, node);
+    if (c < 0) {
+      node = node->left;
+    } else if (c > 0) {
+      node = node->right;
+    } else {
+      return node;
+    }
+  }
+  return NULL;
+}
+
+#endif // _RBTREE_INTRUSIVE_H_
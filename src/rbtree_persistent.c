@@ -0,0 +1,396 @@
+#include "rbtree_persistent.h"
+#include <stdlib.h>
+
+// RB Tree의 높이는 2 log2(n + 1)을 넘지 않으므로 순회 스택은 이 크기면 충분하다.
+#define RBTREE_PERSISTENT_MAX_DEPTH 128
+
+// 아래 함수들은 넘겨받은 노드의 참조를 소비하고, 돌려주는 노드의 참조를 넘겨준다.
+// 빈 서브트리는 NULL이다.
+
+static pnode_t *retain(pnode_t *n)
+{
+  if (n) {
+    __atomic_fetch_add(&n->refs, 1, __ATOMIC_RELAXED);
+  }
+  return n;
+}
+
+// 참조를 하나 놓고, 마지막 참조였으면 노드를 해제하고 자식의 참조도 놓는다.
+static void release(pnode_t *n)
+{
+  while (n && __atomic_sub_fetch(&n->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    release(n->left); // 왼쪽만 재귀하고 오른쪽은 반복한다.
+    pnode_t *right = n->right;
+    free(n);
+    n = right;
+  }
+}
+
+static inline int is_red(const pnode_t *n)
+{
+  return n != NULL && n->color == RBTREE_RED;
+}
+
+static inline int is_black(const pnode_t *n)
+{
+  return n != NULL && n->color == RBTREE_BLACK;
+}
+
+// 연산 도중에는 미리 확보한 노드만 쓰므로 할당이 실패하지 않는다.
+static pnode_t *spare_pop(rbtree_persistent *p)
+{
+  pnode_t *n = p->spare;
+  p->spare = n->right;
+  p->n_spare--;
+  return n;
+}
+
+static void spare_push(rbtree_persistent *p, pnode_t *n)
+{
+  n->right = p->spare;
+  p->spare = n;
+  p->n_spare++;
+}
+
+// 노드 n을 펼쳐 자식과 키를 꺼낸다. 다른 참조가 없으면 n의 메모리를 재사용하도록 돌려주고,
+// 공유 중이면 자식의 참조를 늘린 뒤 n을 놓고 NULL을 돌려준다.
+static pnode_t *take(pnode_t *n, pnode_t **left, key_t *key, pnode_t **right)
+{
+  *key = n->key;
+  if (__atomic_load_n(&n->refs, __ATOMIC_ACQUIRE) == 1) {
+    *left = n->left;
+    *right = n->right;
+    return n;
+  }
+  *left = retain(n->left);
+  *right = retain(n->right);
+  release(n);
+  return NULL;
+}
+
+// cell이 있으면 그 자리에, 없으면 예비 노드로 새 노드를 만든다.
+static pnode_t *make(rbtree_persistent *p, pnode_t *cell, color_t color, pnode_t *left, key_t key, pnode_t *right)
+{
+  pnode_t *n = cell ? cell : spare_pop(p);
+  n->key = key;
+  n->color = color;
+  n->refs = 1;
+  n->left = left;
+  n->right = right;
+  return n;
+}
+
+static pnode_t *recolor(rbtree_persistent *p, pnode_t *n, color_t color)
+{
+  if (n == NULL || n->color == color) {
+    return n;
+  }
+  pnode_t *left, *right;
+  key_t key;
+  pnode_t *cell = take(n, &left, &key, &right);
+  return make(p, cell, color, left, key, right);
+}
+
+// 검정 노드 (a, x, b)를 만들되, 자식과 손자가 연속으로 빨강이면 회전해서 빨강 루트로 만든다.
+// (Okasaki의 삽입 balance에 Kahrs의 삭제용 첫 번째 경우를 더한 것)
+static pnode_t *balance(rbtree_persistent *p, pnode_t *cell, pnode_t *a, key_t x, pnode_t *b)
+{
+  pnode_t *l, *m, *r, *c1, *c2;
+  key_t y, z;
+
+  if (is_red(a) && is_red(b)) {
+    return make(p, cell, RBTREE_RED, recolor(p, a, RBTREE_BLACK), x, recolor(p, b, RBTREE_BLACK));
+  }
+  if (is_red(a) && is_red(a->left)) { // ((l y m) z r) x b
+    c1 = take(a, &l, &z, &r);
+    return make(p, c1, RBTREE_RED, recolor(p, l, RBTREE_BLACK), z, make(p, cell, RBTREE_BLACK, r, x, b));
+  }
+  if (is_red(a) && is_red(a->right)) { // (l y (m z r)) x b
+    c1 = take(a, &l, &y, &m);
+    c2 = take(m, &m, &z, &r);
+    return make(p, c2, RBTREE_RED, make(p, c1, RBTREE_BLACK, l, y, m), z, make(p, cell, RBTREE_BLACK, r, x, b));
+  }
+  if (is_red(b) && is_red(b->right)) { // a x (l y (m z r))
+    c1 = take(b, &l, &y, &r);
+    return make(p, c1, RBTREE_RED, make(p, cell, RBTREE_BLACK, a, x, l), y, recolor(p, r, RBTREE_BLACK));
+  }
+  if (is_red(b) && is_red(b->left)) { // a x ((l y m) z r)
+    c1 = take(b, &m, &z, &r);
+    c2 = take(m, &l, &y, &m);
+    return make(p, c2, RBTREE_RED, make(p, cell, RBTREE_BLACK, a, x, l), y, make(p, c1, RBTREE_BLACK, m, z, r));
+  }
+  return make(p, cell, RBTREE_BLACK, a, x, b);
+}
+
+static pnode_t *ins(rbtree_persistent *p, pnode_t *n, const key_t key)
+{
+  if (n == NULL) {
+    return make(p, NULL, RBTREE_RED, NULL, key, NULL);
+  }
+
+  pnode_t *left, *right;
+  key_t k;
+  color_t color = n->color;
+  pnode_t *cell = take(n, &left, &k, &right);
+
+  // 같은 키는 rbtree_insert처럼 오른쪽에 넣는다.
+  if (key < k) {
+    left = ins(p, left, key);
+  } else {
+    right = ins(p, right, key);
+  }
+  return color == RBTREE_BLACK ? balance(p, cell, left, k, right) : make(p, cell, RBTREE_RED, left, k, right);
+}
+
+// 삭제는 Kahrs의 방법을 따른다. 왼쪽 서브트리의 검정 높이가 하나 줄었을 때 다시 맞춘다.
+static pnode_t *bal_left(rbtree_persistent *p, pnode_t *cell, pnode_t *l, key_t x, pnode_t *r)
+{
+  if (is_red(l)) {
+    return make(p, cell, RBTREE_RED, recolor(p, l, RBTREE_BLACK), x, r);
+  }
+  if (is_black(r)) {
+    return balance(p, cell, l, x, recolor(p, r, RBTREE_RED));
+  }
+
+  // r은 빨강이고 왼쪽 자식은 검정이다: l x ((a y b) z c)
+  pnode_t *a, *b, *c, *rl;
+  key_t y, z;
+  pnode_t *c1 = take(r, &rl, &z, &c);
+  pnode_t *c2 = take(rl, &a, &y, &b);
+  return make(p, c2, RBTREE_RED, make(p, cell, RBTREE_BLACK, l, x, a), y,
+              balance(p, c1, b, z, recolor(p, c, RBTREE_RED)));
+}
+
+// 오른쪽 서브트리의 검정 높이가 하나 줄었을 때 다시 맞춘다.
+static pnode_t *bal_right(rbtree_persistent *p, pnode_t *cell, pnode_t *l, key_t x, pnode_t *r)
+{
+  if (is_red(r)) {
+    return make(p, cell, RBTREE_RED, l, x, recolor(p, r, RBTREE_BLACK));
+  }
+  if (is_black(l)) {
+    return balance(p, cell, recolor(p, l, RBTREE_RED), x, r);
+  }
+
+  // l은 빨강이고 오른쪽 자식은 검정이다: (a y (b z c)) x r
+  pnode_t *a, *b, *c, *lr;
+  key_t y, z;
+  pnode_t *c1 = take(l, &a, &y, &lr);
+  pnode_t *c2 = take(lr, &b, &z, &c);
+  return make(p, c2, RBTREE_RED, balance(p, c1, recolor(p, a, RBTREE_RED), y, b), z,
+              make(p, cell, RBTREE_BLACK, c, x, r));
+}
+
+// 지운 노드의 두 서브트리를 하나로 합친다.
+static pnode_t *fuse(rbtree_persistent *p, pnode_t *l, pnode_t *r)
+{
+  if (l == NULL) {
+    return r;
+  }
+  if (r == NULL) {
+    return l;
+  }
+
+  pnode_t *a, *b, *c, *d, *m, *ml, *mr;
+  key_t x, y, z;
+
+  if (l->color != r->color) {
+    if (l->color == RBTREE_BLACK) { // l (c y d)
+      pnode_t *cell = take(r, &c, &y, &d);
+      return make(p, cell, RBTREE_RED, fuse(p, l, c), y, d);
+    }
+    pnode_t *cell = take(l, &a, &x, &b);
+    return make(p, cell, RBTREE_RED, a, x, fuse(p, b, r));
+  }
+
+  color_t color = l->color;
+  pnode_t *cl = take(l, &a, &x, &b);
+  pnode_t *cr = take(r, &c, &y, &d);
+  m = fuse(p, b, c);
+  if (is_red(m)) {
+    pnode_t *cm = take(m, &ml, &z, &mr);
+    return make(p, cm, RBTREE_RED, make(p, cl, color, a, x, ml), z, make(p, cr, color, mr, y, d));
+  }
+  if (color == RBTREE_RED) {
+    return make(p, cl, RBTREE_RED, a, x, make(p, cr, RBTREE_RED, m, y, d));
+  }
+  return bal_left(p, cl, a, x, make(p, cr, RBTREE_BLACK, m, y, d));
+}
+
+static pnode_t *del(rbtree_persistent *p, pnode_t *n, const key_t key)
+{
+  if (n == NULL) {
+    return NULL;
+  }
+
+  pnode_t *left, *right;
+  key_t k;
+  pnode_t *cell = take(n, &left, &k, &right);
+
+  if (key < k) {
+    if (is_black(left)) {
+      return bal_left(p, cell, del(p, left, key), k, right);
+    }
+    return make(p, cell, RBTREE_RED, del(p, left, key), k, right);
+  }
+  if (key > k) {
+    if (is_black(right)) {
+      return bal_right(p, cell, left, k, del(p, right, key));
+    }
+    return make(p, cell, RBTREE_RED, left, k, del(p, right, key));
+  }
+
+  // 이 노드를 지운다. 혼자 쓰던 노드면 예비 노드로 돌린다.
+  if (cell) {
+    spare_push(p, cell);
+  }
+  return fuse(p, left, right);
+}
+
+// 한 번의 삽입/삭제에 필요한 노드를 미리 확보한다. 한 단계마다 새로 만드는 노드는
+// 여덟 개를 넘지 않고, 단계 수는 높이와 fuse 경로를 합쳐도 2 * 2 log2(n + 2)를 넘지 않는다.
+static int reserve(rbtree_persistent *p)
+{
+  size_t bound = 1;
+  for (size_t n = p->current.size + 2; n > 1; n >>= 1) {
+    bound++;
+  }
+  size_t need = 8 * 4 * bound + 8;
+
+  while (p->n_spare < need) {
+    pnode_t *n = (pnode_t *)malloc(sizeof(pnode_t));
+    if (!n) {
+      return -1;
+    }
+    spare_push(p, n);
+  }
+  return 0;
+}
+
+rbtree_persistent *new_rbtree_persistent(void)
+{
+  return (rbtree_persistent *)calloc(1, sizeof(rbtree_persistent));
+}
+
+void delete_rbtree_persistent(rbtree_persistent *p)
+{
+  if (!p)
+    return;
+
+  // 스냅샷과 공유하는 노드는 참조만 줄어들고, 스냅샷을 놓을 때 해제됩니다.
+  release(p->current.root);
+  while (p->spare) {
+    free(spare_pop(p));
+  }
+  free(p);
+}
+
+int rbtree_persistent_insert(rbtree_persistent *p, const key_t key)
+{
+  if (reserve(p) < 0) {
+    return -1;
+  }
+  p->current.root = recolor(p, ins(p, p->current.root, key), RBTREE_BLACK);
+  p->current.size++;
+  return 0;
+}
+
+int rbtree_persistent_erase(rbtree_persistent *p, const key_t key)
+{
+  // 없는 키로 경로를 복사하지 않도록 먼저 찾아본다.
+  if (rbtree_version_find(&p->current, key) == NULL) {
+    return 0;
+  }
+  if (reserve(p) < 0) {
+    return -1;
+  }
+  p->current.root = recolor(p, del(p, p->current.root, key), RBTREE_BLACK);
+  p->current.size--;
+  return 1;
+}
+
+rbtree_version *rbtree_snapshot(rbtree_persistent *p)
+{
+  rbtree_version *v = (rbtree_version *)malloc(sizeof(rbtree_version));
+  if (!v) {
+    return NULL;
+  }
+  v->root = retain(p->current.root);
+  v->size = p->current.size;
+  return v;
+}
+
+void rbtree_version_release(rbtree_version *v)
+{
+  if (!v)
+    return;
+
+  release(v->root);
+  free(v);
+}
+
+const pnode_t *rbtree_version_find(const rbtree_version *v, const key_t key)
+{
+  const pnode_t *current = v->root;
+  while (current != NULL && current->key != key) {
+    current = key < current->key ? current->left : current->right;
+  }
+  return current;
+}
+
+// 부모 포인터가 없으므로 명시적인 스택으로 [lo, hi]를 키 순서로 방문한다.
+size_t rbtree_version_range(const rbtree_version *v, const key_t lo, const key_t hi, rbtree_pvisit_fn callback, void *ctx)
+{
+  const pnode_t *stack[RBTREE_PERSISTENT_MAX_DEPTH];
+  size_t top = 0, visited = 0;
+
+  // lo 이상인 노드 중 경로 위의 것을 쌓는다.
+  for (const pnode_t *n = v->root; n != NULL;) {
+    if (n->key < lo) {
+      n = n->right;
+    } else {
+      stack[top++] = n;
+      n = n->left;
+    }
+  }
+
+  while (top > 0) {
+    const pnode_t *n = stack[--top];
+    if (n->key > hi) {
+      break;
+    }
+    visited++;
+    if (callback(n, ctx)) {
+      break;
+    }
+    for (n = n->right; n != NULL; n = n->left) {
+      stack[top++] = n;
+    }
+  }
+  return visited;
+}
+
+typedef struct {
+  key_t *arr;
+  size_t n, written;
+} to_array_ctx;
+
+static int write_key(const pnode_t *node, void *arg)
+{
+  to_array_ctx *ctx = (to_array_ctx *)arg;
+  if (ctx->written == ctx->n) {
+    return 1;
+  }
+  ctx->arr[ctx->written++] = node->key;
+  return 0;
+}
+
+// rbtree_to_array와 같이 키 수가 n과 다르면 -1을 돌려준다.
+int rbtree_version_to_array(const rbtree_version *v, key_t *arr, const size_t n)
+{
+  if (v == NULL || arr == NULL || v->size != n) {
+    return -1;
+  }
+  to_array_ctx ctx = {arr, n, 0};
+  rbtree_version_range(v, RBTREE_KEY_MIN, RBTREE_KEY_MAX, write_key, &ctx);
+  return ctx.written == n ? 0 : -1;
+}
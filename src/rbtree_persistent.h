@@ -0,0 +1,46 @@
+#ifndef _RBTREE_PERSISTENT_H_
+#define _RBTREE_PERSISTENT_H_
+
+#include "rbtree.h"
+
+// 경로 복사 방식의 persistent rbtree. 부모 포인터 없이 삽입/삭제가 루트부터 바뀐 경로만 새로 만들고,
+// 나머지 서브트리는 이전 버전과 공유한다. 노드는 참조 수로 관리하며, 참조가 하나뿐인 노드는
+// 다른 버전이 볼 수 없으므로 복사하지 않고 그 자리에서 고쳐 쓴다.
+typedef struct pnode_t {
+  key_t key;
+  color_t color;
+  uint32_t refs; // 이 노드를 가리키는 부모와 버전의 수
+  struct pnode_t *left, *right;
+} pnode_t;
+
+// 한 시점의 트리. 스냅샷은 바뀌지 않으므로 여러 스레드에서 함께 읽고 각자 놓아도 된다.
+typedef struct {
+  pnode_t *root; // 빈 트리는 NULL
+  size_t size;
+} rbtree_version;
+
+// 쓰기용 핸들. 한 번에 한 스레드만 쓴다.
+typedef struct {
+  rbtree_version current;
+  pnode_t *spare; // 연산 도중 할당이 실패하지 않도록 미리 확보한 노드(right로 연결)
+  size_t n_spare;
+} rbtree_persistent;
+
+rbtree_persistent *new_rbtree_persistent(void);
+void delete_rbtree_persistent(rbtree_persistent *); // 남은 스냅샷은 각자 놓을 때까지 유효하다
+
+int rbtree_persistent_insert(rbtree_persistent *, const key_t); // 성공하면 0, 메모리가 부족하면 -1
+int rbtree_persistent_erase(rbtree_persistent *, const key_t);  // 지웠으면 1, 없으면 0, 메모리가 부족하면 -1
+
+// 현재 버전을 O(1)에 고정한다. 다 쓴 스냅샷은 rbtree_version_release로 놓는다.
+rbtree_version *rbtree_snapshot(rbtree_persistent *);
+void rbtree_version_release(rbtree_version *);
+
+// 버전 조회. 현재 버전은 &p->current로 넘긴다.
+typedef int (*rbtree_pvisit_fn)(const pnode_t *, void *);
+
+const pnode_t *rbtree_version_find(const rbtree_version *, const key_t);
+size_t rbtree_version_range(const rbtree_version *, const key_t, const key_t, rbtree_pvisit_fn, void *);
+int rbtree_version_to_array(const rbtree_version *, key_t *, const size_t);
+
+#endif // _RBTREE_PERSISTENT_H_
@@ -0,0 +1,220 @@
+#include "rbtree_sharded.h"
+#include <stdlib.h>
+#include <string.h>
+
+// 키가 속한 샤드. RANGE는 키 순서를 지키도록 [KEY_MIN, KEY_MAX]를 n등분하고,
+// HASH는 키를 섞은 뒤 같은 방식으로 나눈다.
+static size_t shard_of(const rbtree_sharded *s, key_t key)
+{
+  uint32_t x = (uint32_t)key ^ 0x80000000u; // 부호를 뒤집어 키 순서와 같은 부호 없는 값으로
+  if (s->mode == RBTREE_SHARD_HASH) {
+    x ^= x >> 16;
+    x *= 0x85EBCA6Bu;
+    x ^= x >> 13;
+    x *= 0xC2B2AE35u;
+    x ^= x >> 16;
+  }
+  return (size_t)(((uint64_t)x * s->n) >> 32);
+}
+
+// n개의 빈 샤드를 만듭니다.
+rbtree_sharded *new_rbtree_sharded(const size_t n, const rbtree_shard_mode mode)
+{
+  if (n == 0 || n > SIZE_MAX / sizeof(rbtree_shard)) {
+    return NULL;
+  }
+
+  rbtree_sharded *s = (rbtree_sharded *)calloc(1, sizeof(rbtree_sharded));
+  if (!s) {
+    return NULL;
+  }
+  s->shards = (rbtree_shard *)aligned_alloc(_Alignof(rbtree_shard), n * sizeof(rbtree_shard));
+  if (!s->shards) {
+    free(s);
+    return NULL;
+  }
+  s->mode = mode;
+
+  for (s->n = 0; s->n < n; s->n++) {
+    rbtree_shard *shard = &s->shards[s->n];
+    memset(shard, 0, sizeof(*shard));
+    if ((shard->tree = new_rbtree()) == NULL) {
+      break;
+    }
+    if (pthread_rwlock_init(&shard->lock, NULL) != 0) {
+      delete_rbtree(shard->tree);
+      break;
+    }
+  }
+
+  // 중간에 실패하면 만든 샤드까지만 정리합니다.
+  if (s->n < n) {
+    delete_rbtree_sharded(s);
+    return NULL;
+  }
+  return s;
+}
+
+void delete_rbtree_sharded(rbtree_sharded *s)
+{
+  if (!s)
+    return;
+
+  for (size_t i = 0; i < s->n; i++) {
+    pthread_rwlock_destroy(&s->shards[i].lock);
+    delete_rbtree(s->shards[i].tree);
+  }
+  free(s->shards);
+  free(s);
+}
+
+int rbtree_sharded_insert(rbtree_sharded *s, const key_t key)
+{
+  rbtree_shard *shard = &s->shards[shard_of(s, key)];
+  pthread_rwlock_wrlock(&shard->lock);
+  node_t *node = rbtree_insert(shard->tree, key);
+  int ret = node != NULL ? 0 : -1;
+  pthread_rwlock_unlock(&shard->lock);
+  return ret;
+}
+
+int rbtree_sharded_find(rbtree_sharded *s, const key_t key)
+{
+  rbtree_shard *shard = &s->shards[shard_of(s, key)];
+  pthread_rwlock_rdlock(&shard->lock);
+  int found = rbtree_find(shard->tree, key) != NULL;
+  pthread_rwlock_unlock(&shard->lock);
+  return found;
+}
+
+int rbtree_sharded_erase(rbtree_sharded *s, const key_t key)
+{
+  rbtree_shard *shard = &s->shards[shard_of(s, key)];
+  pthread_rwlock_wrlock(&shard->lock);
+  node_t *node = rbtree_find(shard->tree, key);
+  if (node != NULL) {
+    rbtree_erase(shard->tree, node);
+  }
+  pthread_rwlock_unlock(&shard->lock);
+  return node != NULL;
+}
+
+// k-way 병합에 쓰는 최소 힙의 원소. 샤드마다 다음에 방문할 노드를 하나씩 담는다.
+typedef struct {
+  node_t *node;
+  const rbtree *tree;
+} merge_head;
+
+static void heap_down(merge_head *heap, size_t n, size_t i)
+{
+  merge_head top = heap[i];
+  for (;;) {
+    size_t child = 2 * i + 1;
+    if (child >= n) {
+      break;
+    }
+    if (child + 1 < n && heap[child + 1].node->key < heap[child].node->key) {
+      child++;
+    }
+    if (top.node->key <= heap[child].node->key) {
+      break;
+    }
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = top;
+}
+
+// 해시 샤드는 키가 흩어져 있으므로 샤드별 lower_bound에서 출발해 힙으로 병합한다. 힙을 할당하지 못하면 -1
+static ssize_t merge_range(rbtree_sharded *s, const key_t lo, const key_t hi, rbtree_visit_fn callback, void *ctx)
+{
+  merge_head *heap = (merge_head *)malloc(s->n * sizeof(merge_head));
+  if (!heap) {
+    return -1;
+  }
+
+  size_t n = 0;
+  for (size_t i = 0; i < s->n; i++) {
+    node_t *node = rbtree_lower_bound(s->shards[i].tree, lo);
+    if (node != NULL && node->key <= hi) {
+      heap[n].node = node;
+      heap[n].tree = s->shards[i].tree;
+      n++;
+    }
+  }
+  for (size_t i = n / 2; i-- > 0;) {
+    heap_down(heap, n, i);
+  }
+
+  ssize_t visited = 0;
+  while (n > 0) {
+    node_t *node = heap[0].node;
+    visited++;
+    if (callback(node, ctx)) {
+      break;
+    }
+
+    node = rbtree_next(heap[0].tree, node);
+    if (node != NULL && node->key <= hi) {
+      heap[0].node = node;
+    } else {
+      heap[0] = heap[--n];
+    }
+    heap_down(heap, n, 0);
+  }
+
+  free(heap);
+  return visited;
+}
+
+// 범위 callback을 이어 붙여 전체 방문 수와 중단 여부를 넘기기 위한 상태
+typedef struct {
+  rbtree_visit_fn callback;
+  void *ctx;
+  int stopped;
+} range_chain;
+
+static int chain_visit(node_t *node, void *arg)
+{
+  range_chain *chain = (range_chain *)arg;
+  if (chain->callback(node, chain->ctx)) {
+    chain->stopped = 1;
+    return 1;
+  }
+  return 0;
+}
+
+ssize_t rbtree_sharded_range(rbtree_sharded *s, const key_t lo, const key_t hi, rbtree_visit_fn callback, void *ctx)
+{
+  if (s == NULL || lo > hi) {
+    return 0;
+  }
+
+  // 범위 샤드는 lo와 hi가 속한 샤드 사이만 보면 된다.
+  size_t first = 0, last = s->n - 1;
+  if (s->mode == RBTREE_SHARD_RANGE) {
+    first = shard_of(s, lo);
+    last = shard_of(s, hi);
+  }
+
+  // 쓰기는 샤드 하나만 잡고 읽기는 항상 샤드 순서대로 잡으므로 교착은 없다.
+  // 모두 잡은 뒤에 방문해서 범위 전체가 한 시점의 모습이 되게 한다.
+  for (size_t i = first; i <= last; i++) {
+    pthread_rwlock_rdlock(&s->shards[i].lock);
+  }
+
+  ssize_t visited = 0;
+  if (s->mode == RBTREE_SHARD_HASH) {
+    visited = merge_range(s, lo, hi, callback, ctx);
+  } else {
+    range_chain chain = {callback, ctx, 0};
+    for (size_t i = first; i <= last && !chain.stopped; i++) {
+      visited += (ssize_t)rbtree_range(s->shards[i].tree, lo, hi, chain_visit, &chain);
+    }
+  }
+
+  for (size_t i = first; i <= last; i++) {
+    pthread_rwlock_unlock(&s->shards[i].lock);
+  }
+  return visited;
+}
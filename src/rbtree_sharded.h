@@ -0,0 +1,37 @@
+#ifndef _RBTREE_SHARDED_H_
+#define _RBTREE_SHARDED_H_
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "rbtree.h"
+
+// 키 공간을 N개의 rbtree로 나누고 샤드마다 reader-writer lock을 두는 thread-safe 컨테이너.
+// RANGE는 키 범위를 고르게 나누어 샤드 순서가 키 순서와 같고, HASH는 키를 섞어 쏠림을 줄인다.
+typedef enum { RBTREE_SHARD_RANGE, RBTREE_SHARD_HASH } rbtree_shard_mode;
+
+// 이웃한 샤드의 lock이 같은 캐시 라인을 쓰지 않도록 64바이트 정렬한다.
+typedef struct {
+  pthread_rwlock_t lock;
+  rbtree *tree;
+} __attribute__((aligned(64))) rbtree_shard;
+
+typedef struct {
+  rbtree_shard_mode mode;
+  size_t n;
+  rbtree_shard *shards;
+} rbtree_sharded;
+
+rbtree_sharded *new_rbtree_sharded(const size_t, const rbtree_shard_mode);
+void delete_rbtree_sharded(rbtree_sharded *);
+
+// 노드 포인터는 lock 밖에서 안전하지 않으므로 결과만 돌려준다.
+int rbtree_sharded_insert(rbtree_sharded *, const key_t); // 성공하면 0, 메모리가 부족하면 -1
+int rbtree_sharded_find(rbtree_sharded *, const key_t);   // 있으면 1, 없으면 0
+int rbtree_sharded_erase(rbtree_sharded *, const key_t);  // 키 하나를 지웠으면 1, 없으면 0
+
+// [lo, hi] 범위의 노드를 키 순서로 방문하고 방문한 노드 수를 돌려준다. 병합할 메모리가 부족하면 -1
+// 겹치는 샤드의 read lock을 모두 잡은 채 방문하므로 callback은 이 컨테이너를 수정하면 안 된다.
+ssize_t rbtree_sharded_range(rbtree_sharded *, const key_t, const key_t, rbtree_visit_fn, void *);
+
+#endif // _RBTREE_SHARDED_H_
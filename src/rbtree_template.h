@@ -0,0 +1,231 @@
+#ifndef _RBTREE_TEMPLATE_H_
+#define _RBTREE_TEMPLATE_H_
+
+// 키/값 타입과 비교 함수를 지정해 레드블랙 트리를 생성하는 매크로 템플릿.(BSD tree.h 방식)
+//
+//   RBTREE_PROTOTYPE(name, key_type, value_type)            헤더에 타입과 함수 선언
+//   RBTREE_GENERATE(name, key_type, value_type, cmp)        .c 파일에 함수 정의
+//   RBTREE_GENERATE_STATIC(name, key_type, value_type, cmp) 한 파일 안에서만 쓰는 static 정의
+//
+// cmp(a, b)는 a < b, a == b, a > b일 때 각각 음수, 0, 양수를 돌려주는 매크로나 inline 함수다.
+// 생성된 코드가 cmp를 직접 호출하므로 함수 포인터 없이 인라인된다.
+// 회전과 삽입/삭제 복구는 rbtree.c의 int API와 같은 rbtree_fixup.h로 만들고, 노드는 rbtree.c의 노드 풀에서
+// 할당하므로 rbtree.c와 함께 링크한다. 컴파일 옵션(COMPACT, ORDER_STATS, INTERVAL, MULTISET, STATS), 양 끝
+// 노드 캐시, join/split 같은 기능은 int API에만 있다. 트리마다 자기 nil을 둔다.
+
+#include "rbtree.h"
+#include "rbtree_fixup.h"
+#include <stddef.h>
+#include <stdlib.h>
+
+#define RBTREE_CMP_NUMERIC(a, b) (((a) > (b)) - ((a) < (b)))
+
+// rbtree_fixup.h가 생성된 노드에 접근하는 방법. 모든 인스턴스의 필드 이름이 같으므로 하나로 충분하다.
+#define RBTREE_TEMPLATE_OPS_NIL(t) ((t)->nil)
+#define RBTREE_TEMPLATE_OPS_ROOT(t) ((t)->root)
+#define RBTREE_TEMPLATE_OPS_LEFT(t, x) ((x)->left)
+#define RBTREE_TEMPLATE_OPS_RIGHT(t, x) ((x)->right)
+#define RBTREE_TEMPLATE_OPS_LINK(t, link, v) ((link) = (v))
+#define RBTREE_TEMPLATE_OPS_PARENT(t, x) ((x)->parent)
+#define RBTREE_TEMPLATE_OPS_SET_PARENT(t, x, p) ((x)->parent = (p))
+#define RBTREE_TEMPLATE_OPS_COLOR(t, x) ((x)->color)
+#define RBTREE_TEMPLATE_OPS_SET_COLOR(t, x, c) ((x)->color = (c))
+#define RBTREE_TEMPLATE_OPS_ROTATED(t, x, y, counter) ((void)0)
+#define RBTREE_TEMPLATE_OPS_LOOP(t, counter) ((void)0)
+
+#define RBTREE_PROTOTYPE(name, key_type, value_type)                   \
+  RBTREE_PROTOTYPE_INTERNAL(name, key_type, value_type, )
+
+#define RBTREE_PROTOTYPE_STATIC(name, key_type, value_type)            \
+  RBTREE_PROTOTYPE_INTERNAL(name, key_type, value_type, static inline __attribute__((unused)))
+
+#define RBTREE_PROTOTYPE_INTERNAL(name, key_type, value_type, attr)    \
+  typedef struct name##_node {                                         \
+    color_t color;                                                     \
+    key_type key;                                                      \
+    value_type value;                                                  \
+    struct name##_node *parent, *left, *right;                         \
+  } name##_node;                                                       \
+                                                                       \
+  typedef struct name {                                                \
+    name##_node *root;                                                 \
+    name##_node *nil;                                                  \
+    name##_node nil_node;                                              \
+    rbtree_pool pool;                                                  \
+  } name;                                                              \
+                                                                       \
+  attr name *name##_new(void);                                         \
+  attr void name##_delete(name *);                                     \
+  attr name##_node *name##_insert(name *, key_type, value_type);       \
+  attr name##_node *name##_find(const name *, key_type);               \
+  attr name##_node *name##_min(const name *);                          \
+  attr name##_node *name##_max(const name *);                          \
+  attr name##_node *name##_next(const name *, name##_node *);          \
+  attr int name##_erase(name *, name##_node *);
+
+#define RBTREE_GENERATE(name, key_type, value_type, cmp)               \
+  RBTREE_GENERATE_INTERNAL(name, key_type, value_type, cmp, )
+
+#define RBTREE_GENERATE_STATIC(name, key_type, value_type, cmp)        \
+  RBTREE_PROTOTYPE_STATIC(name, key_type, value_type)                  \
+  RBTREE_GENERATE_INTERNAL(name, key_type, value_type, cmp, static inline __attribute__((unused)))
+
+#define RBTREE_GENERATE_INTERNAL(name, key_type, value_type, cmp, attr)                 \
+  RBTREE_FIXUP_GENERATE(static inline, name, name, name##_node *, RBTREE_TEMPLATE_OPS)  \
+  attr name *name##_new(void)                                                           \
+  {                                                                                     \
+    name *t = (name *)calloc(1, sizeof(name));                                          \
+    if (!t) {                                                                           \
+      return NULL;                                                                      \
+    }                                                                                   \
+    const size_t link = offsetof(name##_node, right);                                   \
+    if (rbtree_pool_init(&t->pool, sizeof(name##_node), link) < 0) {                    \
+      free(t);                                                                          \
+      return NULL;                                                                      \
+    }                                                                                   \
+    t->nil = &t->nil_node;                                                              \
+    t->nil->color = RBTREE_BLACK;                                                       \
+    t->nil->parent = t->nil->left = t->nil->right = t->nil;                             \
+    t->root = t->nil;                                                                   \
+    return t;                                                                           \
+  }                                                                                     \
+  /* 노드는 모두 풀의 청크에 있으므로 순회하지 않고 청크 단위로 해제한다. */            \
+  attr void name##_delete(name *t)                                                      \
+  {                                                                                     \
+    if (!t) {                                                                           \
+      return;                                                                           \
+    }                                                                                   \
+    rbtree_pool_release(&t->pool);                                                      \
+    free(t);                                                                            \
+  }                                                                                     \
+  /* 같은 키는 rbtree_insert처럼 오른쪽으로 보낸다. */                                  \
+  attr name##_node *name##_insert(name *t, key_type key, value_type value)              \
+  {                                                                                     \
+    name##_node *z = (name##_node *)rbtree_pool_alloc(&t->pool);                        \
+    if (!z) {                                                                           \
+      return NULL;                                                                      \
+    }                                                                                   \
+    z->key = key;                                                                       \
+    z->value = value;                                                                   \
+    z->color = RBTREE_RED;                                                              \
+    z->left = z->right = t->nil;                                                        \
+    name##_node *current = t->root, *parent = t->nil;                                   \
+    int c = 0;                                                                          \
+    while (current != t->nil) {                                                         \
+      parent = current;                                                                 \
+      c = cmp(key, current->key);                                                       \
+      current = c < 0 ? current->left : current->right;                                 \
+    }                                                                                   \
+    z->parent = parent;                                                                 \
+    if (parent == t->nil) {                                                             \
+      t->root = z;                                                                      \
+    } else if (c < 0) {                                                                 \
+      parent->left = z;                                                                 \
+    } else {                                                                            \
+      parent->right = z;                                                                \
+    }                                                                                   \
+    name##_insert_fixup(t, z);                                                          \
+    return z;                                                                           \
+  }                                                                                     \
+  attr name##_node *name##_find(const name *t, key_type key)                            \
+  {                                                                                     \
+    name##_node *current = t->root;                                                     \
+    while (current != t->nil) {                                                         \
+      int c = cmp(key, current->key);                                                   \
+      if (c == 0) {                                                                     \
+        return current;                                                                 \
+      }                                                                                 \
+      current = c < 0 ? current->left : current->right;                                 \
+    }                                                                                   \
+    return NULL;                                                                        \
+  }                                                                                     \
+                                                                                        \
+  static inline name##_node *name##_min_in_subtree(const name *t, name##_node *node)    \
+  {                                                                                     \
+    while (node->left != t->nil) {                                                      \
+      node = node->left;                                                                \
+    }                                                                                   \
+    return node;                                                                        \
+  }                                                                                     \
+                                                                                        \
+  /* 빈 트리면 NULL을 돌려준다. */                                                      \
+  attr name##_node *name##_min(const name *t)                                           \
+  {                                                                                     \
+    return t->root == t->nil ? NULL : name##_min_in_subtree(t, t->root);                \
+  }                                                                                     \
+                                                                                        \
+  attr name##_node *name##_max(const name *t)                                           \
+  {                                                                                     \
+    name##_node *node = t->root;                                                        \
+    if (node == t->nil) {                                                               \
+      return NULL;                                                                      \
+    }                                                                                   \
+    while (node->right != t->nil) {                                                     \
+      node = node->right;                                                               \
+    }                                                                                   \
+    return node;                                                                        \
+  }                                                                                     \
+                                                                                        \
+  attr name##_node *name##_next(const name *t, name##_node *node)                       \
+  {                                                                                     \
+    if (node->right != t->nil) {                                                        \
+      return name##_min_in_subtree(t, node->right);                                     \
+    }                                                                                   \
+    name##_node *parent = node->parent;                                                 \
+    while (parent != t->nil && node == parent->right) {                                 \
+      node = parent;                                                                    \
+      parent = parent->parent;                                                          \
+    }                                                                                   \
+    return parent == t->nil ? NULL : parent;                                            \
+  }                                                                                     \
+  static inline void name##_transplant(name *t, name##_node *u, name##_node *v)         \
+  {                                                                                     \
+    if (u->parent == t->nil) {                                                          \
+      t->root = v;                                                                      \
+    } else if (u == u->parent->left) {                                                  \
+      u->parent->left = v;                                                              \
+    } else {                                                                            \
+      u->parent->right = v;                                                             \
+    }                                                                                   \
+    if (v != t->nil) {                                                                  \
+      v->parent = u->parent;                                                            \
+    }                                                                                   \
+  }                                                                                     \
+  attr int name##_erase(name *t, name##_node *z)                                        \
+  {                                                                                     \
+    if (z == NULL || z == t->nil) {                                                     \
+      return -1;                                                                        \
+    }                                                                                   \
+    name##_node *y = z, *x, *xp = z->parent;                                            \
+    color_t y_original_color = y->color;                                                \
+    if (z->left == t->nil) {                                                            \
+      x = z->right;                                                                     \
+      name##_transplant(t, z, z->right);                                                \
+    } else if (z->right == t->nil) {                                                    \
+      x = z->left;                                                                      \
+      name##_transplant(t, z, z->left);                                                 \
+    } else {                                                                            \
+      y = name##_min_in_subtree(t, z->right);                                           \
+      y_original_color = y->color;                                                      \
+      x = y->right;                                                                     \
+      if (y->parent == z) {                                                             \
+        xp = y;                                                                         \
+      } else {                                                                          \
+        xp = y->parent;                                                                 \
+        name##_transplant(t, y, y->right);                                              \
+        y->right = z->right;                                                            \
+        y->right->parent = y;                                                           \
+      }                                                                                 \
+      name##_transplant(t, z, y);                                                       \
+      y->left = z->left;                                                                \
+      y->left->parent = y;                                                              \
+      y->color = z->color;                                                              \
+    }                                                                                   \
+    rbtree_pool_free(&t->pool, z);                                                      \
+    if (y_original_color == RBTREE_BLACK) {                                             \
+      name##_erase_fixup(t, x, xp);                                                     \
+    }                                                                                   \
+    return 1;                                                                           \
+  }
+
+#endif // _RBTREE_TEMPLATE_H_
@@ -0,0 +1,244 @@
+#include "rbtree_topdown.h"
+#include <stdlib.h>
+
+// 노드는 rbtree.c의 풀에서 잘라 쓴다. 반납된 노드는 link[1]로 연결된다.
+static tnode_t *node_alloc(rbtree_topdown *t)
+{
+  return (tnode_t *)rbtree_pool_alloc(&t->pool);
+}
+
+static void node_free(rbtree_topdown *t, tnode_t *node)
+{
+  rbtree_pool_free(&t->pool, node);
+}
+
+rbtree_topdown *new_rbtree_topdown(void)
+{
+  rbtree_topdown *t = (rbtree_topdown *)calloc(1, sizeof(rbtree_topdown));
+  if (!t) {
+    return NULL;
+  }
+  if (rbtree_pool_init(&t->pool, sizeof(tnode_t), offsetof(tnode_t, link[1])) < 0) {
+    free(t);
+    return NULL;
+  }
+  return t;
+}
+
+void delete_rbtree_topdown(rbtree_topdown *t)
+{
+  if (!t) {
+    return;
+  }
+  rbtree_pool_release(&t->pool);
+  free(t);
+}
+
+static inline int is_red(const tnode_t *node)
+{
+  return node != NULL && node->color == RBTREE_RED;
+}
+
+// root를 dir 쪽으로 회전하고 새 서브트리 루트를 돌려준다. 올라온 노드는 블랙, 내려간 노드는 레드가 된다.
+static tnode_t *rotate_single(tnode_t *root, int dir)
+{
+  tnode_t *save = root->link[!dir];
+  root->link[!dir] = save->link[dir];
+  save->link[dir] = root;
+  root->color = RBTREE_RED;
+  save->color = RBTREE_BLACK;
+  return save;
+}
+
+static tnode_t *rotate_double(tnode_t *root, int dir)
+{
+  root->link[!dir] = rotate_single(root->link[!dir], !dir);
+  return rotate_single(root, dir);
+}
+
+// 내려가는 길에 자식이 둘 다 레드인 노드를 만나면 색을 뒤집어 두고, 그 때문에 생긴 레드-레드는
+// 조부모에서 회전으로 바로 고친다. 새 노드는 항상 블랙 형제가 없는 자리에 레드로 붙으므로
+// 내려간 뒤에 다시 올라올 필요가 없다.
+tnode_t *rbtree_topdown_insert(rbtree_topdown *t, const key_t key)
+{
+  tnode_t *node = node_alloc(t);
+  if (node == NULL) {
+    return NULL;
+  }
+  node->key = key;
+  node->color = RBTREE_RED;
+  node->link[0] = node->link[1] = NULL;
+  t->size++;
+
+  if (t->root == NULL) {
+    t->root = node;
+    t->root->color = RBTREE_BLACK;
+    return node;
+  }
+
+  // head는 루트 위의 가짜 노드로, 루트가 회전으로 바뀌어도 같은 코드로 다룬다.
+  tnode_t head = {0, RBTREE_BLACK, {NULL, t->root}};
+  tnode_t *great = &head; // 조부모의 부모
+  tnode_t *grand = NULL, *parent = NULL, *q = t->root;
+  int dir = 0, last = 0;
+
+  for (;;) {
+    if (q == NULL) {
+      parent->link[dir] = q = node;
+    } else if (is_red(q->link[0]) && is_red(q->link[1])) {
+      q->color = RBTREE_RED;
+      q->link[0]->color = RBTREE_BLACK;
+      q->link[1]->color = RBTREE_BLACK;
+    }
+
+    // 부모와 q가 모두 레드면 조부모에서 회전한다.
+    if (is_red(q) && is_red(parent)) {
+      int dir2 = great->link[1] == grand;
+      if (q == parent->link[last]) {
+        great->link[dir2] = rotate_single(grand, !last);
+      } else {
+        great->link[dir2] = rotate_double(grand, !last);
+      }
+    }
+
+    if (q == node) {
+      break;
+    }
+
+    last = dir;
+    dir = q->key <= key; // 같은 키는 오른쪽으로
+    if (grand != NULL) {
+      great = grand;
+    }
+    grand = parent;
+    parent = q;
+    q = q->link[dir];
+  }
+
+  t->root = head.link[1];
+  t->root->color = RBTREE_BLACK;
+  return node;
+}
+
+tnode_t *rbtree_topdown_find(const rbtree_topdown *t, const key_t key)
+{
+  tnode_t *current = t->root;
+  while (current != NULL && current->key != key) {
+    current = current->link[current->key < key];
+  }
+  return current;
+}
+
+// 내려가는 동안 지나는 노드가 항상 레드가 되도록 색 뒤집기와 회전으로 레드를 밀어 내린다.
+// 맨 아래에 닿으면 그 노드는 레드이거나 레드 자식을 가지므로, 떼어 내도 블랙 높이가 바뀌지 않는다.
+// key와 같은 노드(found)는 내려가면서 기억해 두고, 마지막에 도착한 중위 선행 노드의 키로 채운 뒤
+// 선행 노드를 떼어 낸다.
+int rbtree_topdown_erase(rbtree_topdown *t, const key_t key)
+{
+  if (t->root == NULL) {
+    return 0;
+  }
+
+  tnode_t head = {0, RBTREE_BLACK, {NULL, t->root}};
+  tnode_t *q = &head, *parent = NULL, *grand = NULL, *found = NULL;
+  int dir = 1;
+
+  while (q->link[dir] != NULL) {
+    int last = dir;
+
+    grand = parent;
+    parent = q;
+    q = q->link[dir];
+    dir = q->key < key; // 같은 키는 왼쪽으로 가서 선행 노드를 찾는다.
+
+    if (q->key == key) {
+      found = q;
+    }
+
+    if (is_red(q) || is_red(q->link[dir])) {
+      continue;
+    }
+    if (is_red(q->link[!dir])) {
+      // 반대쪽 레드 자식을 끌어올려 q를 레드로 만든다.
+      parent = parent->link[last] = rotate_single(q, dir);
+      continue;
+    }
+
+    tnode_t *sibling = parent->link[!last];
+    if (sibling == NULL) {
+      continue;
+    }
+    if (!is_red(sibling->link[!last]) && !is_red(sibling->link[last])) {
+      // 형제의 자식이 모두 블랙이면 색만 뒤집는다.
+      parent->color = RBTREE_BLACK;
+      sibling->color = RBTREE_RED;
+      q->color = RBTREE_RED;
+    } else {
+      // 형제 쪽 레드를 회전으로 가져온다.
+      int dir2 = grand->link[1] == parent;
+      if (is_red(sibling->link[last])) {
+        grand->link[dir2] = rotate_double(parent, last);
+      } else {
+        grand->link[dir2] = rotate_single(parent, last);
+      }
+      q->color = grand->link[dir2]->color = RBTREE_RED;
+      grand->link[dir2]->link[0]->color = RBTREE_BLACK;
+      grand->link[dir2]->link[1]->color = RBTREE_BLACK;
+    }
+  }
+
+  if (found != NULL) {
+    found->key = q->key;
+    parent->link[parent->link[1] == q] = q->link[q->link[0] == NULL];
+    node_free(t, q);
+    t->size--;
+  }
+
+  t->root = head.link[1];
+  if (t->root != NULL) {
+    t->root->color = RBTREE_BLACK;
+  }
+  return found != NULL;
+}
+
+// key 이상인 첫 노드까지 내려가며, 앞으로 방문할 조상(왼쪽으로 내려간 노드)만 스택에 쌓는다.
+void rbtree_topdown_iter_init(rbtree_topdown_iter *iter, const rbtree_topdown *t, const key_t key)
+{
+  iter->depth = 0;
+  for (tnode_t *node = t->root; node != NULL;) {
+    if (node->key >= key) {
+      iter->stack[iter->depth++] = node;
+      node = node->link[0];
+    } else {
+      node = node->link[1];
+    }
+  }
+}
+
+tnode_t *rbtree_topdown_iter_next(rbtree_topdown_iter *iter)
+{
+  if (iter->depth == 0) {
+    return NULL;
+  }
+
+  tnode_t *node = iter->stack[--iter->depth];
+  for (tnode_t *next = node->link[1]; next != NULL; next = next->link[0]) {
+    iter->stack[iter->depth++] = next;
+  }
+  return node;
+}
+
+int rbtree_topdown_to_array(const rbtree_topdown *t, key_t *arr, const size_t n)
+{
+  if (t == NULL || arr == NULL || t->size != n) {
+    return -1;
+  }
+
+  rbtree_topdown_iter iter;
+  rbtree_topdown_iter_init(&iter, t, RBTREE_KEY_MIN);
+  size_t i = 0;
+  for (tnode_t *node; (node = rbtree_topdown_iter_next(&iter)) != NULL;) {
+    arr[i++] = node->key;
+  }
+  return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef _RBTREE_TOPDOWN_H_
+#define _RBTREE_TOPDOWN_H_
+
+#include "rbtree.h"
+
+// 부모 포인터 없는 rbtree. 삽입과 삭제가 루트에서 한 번 내려가는 동안 색 뒤집기와 회전을 미리 해 두므로
+// 위로 다시 올라가는 fixup이 없다. 노드는 키, 색, 자식 두 개뿐이라 24바이트이고(64비트 기준)
+// 회전마다 부모 포인터를 고치는 store도 없다. 순회는 명시적인 스택으로 한다.
+typedef struct tnode_t {
+  key_t key;
+  color_t color;
+  struct tnode_t *link[2]; // link[0]은 왼쪽, link[1]은 오른쪽 자식. 없으면 NULL
+} tnode_t;
+
+typedef struct {
+  tnode_t *root;
+  size_t size;
+  rbtree_pool pool; // rbtree와 같은 노드 풀(노드 크기만 다르다)
+} rbtree_topdown;
+
+rbtree_topdown *new_rbtree_topdown(void);
+void delete_rbtree_topdown(rbtree_topdown *);
+
+// 같은 키는 rbtree_insert처럼 오른쪽에 들어간다. 메모리가 부족하면 NULL.
+tnode_t *rbtree_topdown_insert(rbtree_topdown *, const key_t);
+tnode_t *rbtree_topdown_find(const rbtree_topdown *, const key_t);
+// 키 하나를 지웠으면 1, 없으면 0. 지운 자리를 이웃 노드의 키로 채우므로 다른 노드의 키가 바뀔 수 있다.
+int rbtree_topdown_erase(rbtree_topdown *, const key_t);
+
+// 노드 수가 2^64보다 작으면 높이는 2 log2(n + 1) 이하이다.
+#define RBTREE_TOPDOWN_MAX_HEIGHT 128
+
+// 중위 순회 위치. 트리가 바뀌면 무효가 된다.
+typedef struct {
+  tnode_t *stack[RBTREE_TOPDOWN_MAX_HEIGHT];
+  int depth;
+} rbtree_topdown_iter;
+
+void rbtree_topdown_iter_init(rbtree_topdown_iter *, const rbtree_topdown *, const key_t); // key 이상인 첫 노드부터
+tnode_t *rbtree_topdown_iter_next(rbtree_topdown_iter *);                                  // 끝나면 NULL
+
+int rbtree_topdown_to_array(const rbtree_topdown *, key_t *, const size_t);
+
+#endif // _RBTREE_TOPDOWN_H_
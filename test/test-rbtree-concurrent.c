@@ -0,0 +1,181 @@
+#include <assert.h>
+#include <pthread.h>
+#include <rbtree_concurrent.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define READERS 3
+
+// even keys below STABLE are inserted up front and never erased,
+// odd keys are never inserted, and keys from STABLE on churn while readers run
+#define STABLE 2000
+#define CHURN 20000
+
+typedef struct
+{
+  rbtree_concurrent *c;
+  int *stop;
+  size_t lookups;
+} reader_arg;
+
+static void *reader(void *p)
+{
+  reader_arg *arg = (reader_arg *)p;
+  rbtree_reader *r = rbtree_concurrent_register(arg->c);
+  assert(r != NULL);
+
+  unsigned int seed = (unsigned int)(size_t)arg;
+  while (!__atomic_load_n(arg->stop, __ATOMIC_ACQUIRE))
+  {
+    rbtree_concurrent_read_begin(arg->c, r);
+    for (int i = 0; i < 64; i++)
+    {
+      key_t key = rand_r(&seed) % STABLE;
+      node_t *node = rbtree_concurrent_find(arg->c, key);
+      if (key % 2 == 0)
+      {
+        assert(node != NULL && node->key == key);
+      }
+      else
+      {
+        assert(node == NULL);
+      }
+      // churned keys may or may not be present, but a hit must carry its key
+      key_t churn = STABLE + rand_r(&seed) % CHURN;
+      node = rbtree_concurrent_find(arg->c, churn);
+      assert(node == NULL || node->key == churn);
+      arg->lookups += 2;
+    }
+    rbtree_concurrent_read_end(r);
+  }
+
+  rbtree_concurrent_unregister(r);
+  return NULL;
+}
+
+// one writer churns keys while readers look up stable keys that must always be found
+void test_concurrent(const size_t rounds)
+{
+  rbtree_concurrent *c = new_rbtree_concurrent();
+  assert(c != NULL);
+  for (key_t key = 0; key < STABLE; key += 2)
+  {
+    assert(rbtree_concurrent_insert(c, key) == 0);
+  }
+
+  int stop = 0;
+  pthread_t threads[READERS];
+  reader_arg args[READERS];
+  for (int i = 0; i < READERS; i++)
+  {
+    args[i].c = c;
+    args[i].stop = &stop;
+    args[i].lookups = 0;
+    assert(pthread_create(&threads[i], NULL, reader, &args[i]) == 0);
+  }
+
+  unsigned int seed = 31;
+  for (size_t round = 0; round < rounds; round++)
+  {
+    for (int i = 0; i < 1000; i++)
+    {
+      key_t key = STABLE + rand_r(&seed) % CHURN;
+      if (rand_r(&seed) % 2)
+      {
+        assert(rbtree_concurrent_insert(c, key) == 0);
+      }
+      else
+      {
+        rbtree_concurrent_erase(c, key);
+      }
+    }
+  }
+  __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+  for (int i = 0; i < READERS; i++)
+  {
+    pthread_join(threads[i], NULL);
+    assert(args[i].lookups > 0);
+  }
+
+  // with no readers left, retired nodes drain within a few epochs and are reused
+  size_t erased = 0;
+  for (key_t key = STABLE; key < STABLE + CHURN; key++)
+  {
+    while (rbtree_concurrent_erase(c, key))
+    {
+      erased++;
+    }
+  }
+  for (int i = 0; i < 3; i++)
+  {
+    rbtree_concurrent_reclaim(c);
+  }
+  assert(c->retired[0].n + c->retired[1].n + c->retired[2].n == 0);
+  size_t used = c->tree->pool.used;
+  for (size_t i = 0; i < erased; i++)
+  {
+    assert(rbtree_concurrent_insert(c, STABLE) == 0);
+  }
+  assert(c->tree->pool.used == used);
+  while (rbtree_concurrent_erase(c, STABLE))
+  {
+  }
+  for (int i = 0; i < 3; i++)
+  {
+    rbtree_concurrent_reclaim(c);
+  }
+  for (key_t key = 1; key < STABLE; key += 2)
+  {
+    assert(rbtree_concurrent_find(c, key - 1) != NULL);
+    assert(rbtree_concurrent_find(c, key) == NULL);
+  }
+
+  // a reader parked in an old epoch holds back reclamation
+  rbtree_reader *r = rbtree_concurrent_register(c);
+  rbtree_concurrent_read_begin(c, r);
+  rbtree_concurrent_reclaim(c);
+  assert(rbtree_concurrent_erase(c, 0) == 1);
+  assert(rbtree_concurrent_reclaim(c) == 0);
+  assert(rbtree_concurrent_reclaim(c) == 0);
+  rbtree_concurrent_read_end(r);
+  rbtree_concurrent_unregister(r);
+  size_t released = 0;
+  for (int i = 0; i < 4; i++)
+  {
+    released += rbtree_concurrent_reclaim(c);
+  }
+  assert(released == 1);
+
+  delete_rbtree_concurrent(c);
+}
+
+#ifdef RBTREE_MULTISET
+// erasing one copy of a repeated key keeps the node, as rbtree_erase does
+void test_concurrent_multiset(void)
+{
+  rbtree_concurrent *c = new_rbtree_concurrent();
+  for (int i = 0; i < 3; i++)
+  {
+    assert(rbtree_concurrent_insert(c, 5) == 0);
+  }
+  assert(rbtree_concurrent_erase(c, 5) == 1);
+  node_t *node = rbtree_concurrent_find(c, 5);
+  assert(node != NULL && node->count == 2);
+  assert(c->retired[0].n + c->retired[1].n + c->retired[2].n == 0);
+  assert(rbtree_concurrent_erase(c, 5) == 1);
+  assert(rbtree_concurrent_erase(c, 5) == 1);
+  assert(rbtree_concurrent_find(c, 5) == NULL);
+  assert(rbtree_concurrent_erase(c, 5) == 0);
+  assert(c->retired[0].n + c->retired[1].n + c->retired[2].n == 1);
+  delete_rbtree_concurrent(c);
+}
+#endif
+
+int main(void)
+{
+  test_concurrent(50);
+#ifdef RBTREE_MULTISET
+  test_concurrent_multiset();
+#endif
+  printf("Passed all tests!\n");
+}
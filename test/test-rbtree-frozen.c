@@ -0,0 +1,103 @@
+#include <assert.h>
+#include <rbtree_frozen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int comp(const void *p1, const void *p2)
+{
+  const key_t *e1 = (const key_t *)p1;
+  const key_t *e2 = (const key_t *)p2;
+  return (*e1 > *e2) - (*e1 < *e2);
+}
+
+// number of keys in the sorted array that are smaller than key
+static size_t rank_of(const key_t *arr, const size_t n, const key_t key)
+{
+  size_t lo = 0, hi = n;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (arr[mid] < key)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// every SIMD path the CPU supports should agree with a binary search on the sorted keys
+static void check_frozen(rbtree_frozen *f, const key_t *arr, const size_t n, const key_t range)
+{
+  assert(f->n == n);
+  const rbtree_frozen_simd detected = f->simd;
+  for (int simd = RBTREE_FROZEN_SCALAR; simd <= (int)detected; simd++)
+  {
+    f->simd = (rbtree_frozen_simd)simd;
+    for (key_t key = -2; key <= range + 2; key++)
+    {
+      size_t rank = rank_of(arr, n, key);
+      assert(rbtree_frozen_rank(f, key) == rank);
+      const key_t *lb = rbtree_frozen_lower_bound(f, key);
+      assert(rank == n ? lb == NULL : lb != NULL && *lb == arr[rank]);
+      assert(rbtree_frozen_find(f, key) == (rank < n && arr[rank] == key));
+    }
+    assert(rbtree_frozen_rank(f, RBTREE_KEY_MIN) == 0);
+    assert(rbtree_frozen_rank(f, RBTREE_KEY_MAX) == rank_of(arr, n, RBTREE_KEY_MAX));
+  }
+  f->simd = detected;
+}
+
+// sizes around block and fanout boundaries, with duplicates spanning blocks
+void test_freeze(const size_t n, const unsigned int seed)
+{
+  srand(seed);
+  const key_t range = (key_t)(n / 2 + 1);
+  rbtree *t = new_rbtree();
+  key_t *arr = calloc(n + 1, sizeof(key_t));
+  for (size_t i = 0; i < n; i++)
+  {
+    arr[i] = rand() % range;
+    rbtree_insert(t, arr[i]);
+  }
+  qsort(arr, n, sizeof(key_t), comp);
+
+  rbtree_frozen *f = rbtree_freeze(t);
+  assert(f != NULL);
+  check_frozen(f, arr, n, range);
+
+  // the frozen copy ignores later changes until it is refrozen in place
+  if (n > 0)
+  {
+    rbtree_erase(t, rbtree_min(t));
+  }
+  rbtree_insert(t, range + 1);
+  assert(!rbtree_frozen_find(f, range + 1));
+  key_t *keys = f->keys;
+  assert(rbtree_refreeze(f, t) == 0);
+  assert(n == 0 || f->keys == keys); // the same number of keys reuses the blocks
+  size_t m = n > 0 ? n : 1;
+  key_t *now = calloc(m + 1, sizeof(key_t));
+  memmove(now, n > 0 ? arr + 1 : arr, (n > 0 ? n - 1 : 0) * sizeof(key_t));
+  now[m - 1] = range + 1;
+  check_frozen(f, now, m, range + 1);
+
+  free(now);
+  free(arr);
+  delete_rbtree_frozen(f);
+  delete_rbtree(t);
+}
+
+int main(void)
+{
+  const size_t sizes[] = {0, 1, 15, 16, 17, 272, 273, 289, 4624, 4625, 100000};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    test_freeze(sizes[i], (unsigned int)i);
+  }
+  printf("Passed all tests!\n");
+}
@@ -0,0 +1,161 @@
+#include <assert.h>
+#include <rbtree_intrusive.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// a user struct with the link in the middle, so rbtree_entry has a non-zero offset
+typedef struct
+{
+  key_t key;
+  rbtree_link link;
+  size_t id;
+} item_t;
+
+static int item_less(const rbtree_link *a, const rbtree_link *b)
+{
+  return rbtree_entry(a, item_t, link)->key < rbtree_entry(b, item_t, link)->key;
+}
+
+static int item_cmp(const void *key, const rbtree_link *node)
+{
+  key_t k = *(const key_t *)key, nk = rbtree_entry(node, item_t, link)->key;
+  return (k > nk) - (k < nk);
+}
+
+// returns the black height of the subtree, checking parents, order, red-red and black-height rules
+static int check_node(const rbtree_link *node, const rbtree_link *parent, const key_t lo, const key_t hi,
+                      size_t *count)
+{
+  if (node == NULL)
+  {
+    return 1;
+  }
+  assert(rbtree_link_parent(node) == parent);
+  key_t key = rbtree_entry(node, item_t, link)->key;
+  assert(lo <= key && key <= hi);
+  if (rbtree_link_color(node) == RBTREE_RED)
+  {
+    assert(node->left == NULL || rbtree_link_color(node->left) == RBTREE_BLACK);
+    assert(node->right == NULL || rbtree_link_color(node->right) == RBTREE_BLACK);
+  }
+  (*count)++;
+  int left = check_node(node->left, node, lo, key, count);
+  int right = check_node(node->right, node, key, hi, count);
+  assert(left == right);
+  return left + (rbtree_link_color(node) == RBTREE_BLACK);
+}
+
+static void check_tree(const rbtree_link_root *root, const size_t size)
+{
+  assert(root->root == NULL || rbtree_link_color(root->root) == RBTREE_BLACK);
+  size_t n = 0;
+  check_node(root->root, NULL, RBTREE_KEY_MIN, RBTREE_KEY_MAX, &n);
+  assert(n == size);
+
+  // forward and backward walks visit every item in order
+  n = 0;
+  key_t prev = RBTREE_KEY_MIN;
+  for (rbtree_link *p = rbtree_link_first(root); p != NULL; p = rbtree_link_next(p))
+  {
+    assert(prev <= rbtree_entry(p, item_t, link)->key);
+    prev = rbtree_entry(p, item_t, link)->key;
+    n++;
+  }
+  assert(n == size);
+  for (rbtree_link *p = rbtree_link_last(root); p != NULL; p = rbtree_link_prev(p))
+  {
+    n--;
+  }
+  assert(n == 0);
+}
+
+void test_empty(void)
+{
+  rbtree_link_root root = RBTREE_LINK_ROOT_INIT;
+  key_t key = 0;
+  assert(rbtree_link_find(&root, &key, item_cmp) == NULL);
+  assert(rbtree_link_first(&root) == NULL && rbtree_link_last(&root) == NULL);
+
+  item_t item = {1, {0, NULL, NULL}, 0};
+  rbtree_link_add(&root, &item.link, item_less);
+  key = 1;
+  assert(rbtree_link_find(&root, &key, item_cmp) == &item.link);
+  rbtree_link_erase(&root, &item.link);
+  assert(root.root == NULL);
+}
+
+// random adds and erases with duplicate keys; the items live in one array and never move
+void test_random(const size_t n, const key_t range, const unsigned int seed)
+{
+  srand(seed);
+  rbtree_link_root root = RBTREE_LINK_ROOT_INIT;
+  item_t *items = calloc(n, sizeof(item_t));
+  int *linked = calloc(n, sizeof(int));
+  size_t *counts = calloc(range, sizeof(size_t));
+  size_t size = 0;
+
+  for (size_t i = 0; i < n; i++)
+  {
+    items[i].key = rand() % range;
+    items[i].id = i;
+    rbtree_link_add(&root, &items[i].link, item_less);
+    linked[i] = 1;
+    counts[items[i].key]++;
+    size++;
+
+    // erase an earlier item that is still in the tree
+    size_t j = rand() % (i + 1);
+    if (rand() % 3 == 0 && linked[j])
+    {
+      rbtree_link_erase(&root, &items[j].link);
+      linked[j] = 0;
+      counts[items[j].key]--;
+      size--;
+    }
+    if (i % (n / 8 + 1) == 0)
+    {
+      check_tree(&root, size);
+    }
+  }
+  check_tree(&root, size);
+
+  for (key_t key = 0; key < range; key++)
+  {
+    rbtree_link *p = rbtree_link_find(&root, &key, item_cmp);
+    if (counts[key] == 0)
+    {
+      assert(p == NULL);
+      continue;
+    }
+    item_t *item = rbtree_entry(p, item_t, link);
+    assert(item->key == key && linked[item->id] && &items[item->id] == item);
+  }
+
+  // drain by erasing found items, in key order
+  for (key_t key = 0; key < range; key++)
+  {
+    while (counts[key] > 0)
+    {
+      rbtree_link *p = rbtree_link_find(&root, &key, item_cmp);
+      assert(p != NULL);
+      rbtree_link_erase(&root, p);
+      counts[key]--;
+      size--;
+    }
+  }
+  check_tree(&root, 0);
+  assert(root.root == NULL);
+
+  free(counts);
+  free(linked);
+  free(items);
+}
+
+int main(void)
+{
+  test_empty();
+  test_random(20000, 500, 1);
+  test_random(20000, 20, 2);
+  test_random(100000, 50000, 3);
+  printf("Passed all tests!\n");
+}
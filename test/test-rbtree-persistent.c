@@ -0,0 +1,250 @@
+#include <assert.h>
+#include <pthread.h>
+#include <rbtree_persistent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int comp(const void *p1, const void *p2)
+{
+  const key_t *e1 = (const key_t *)p1;
+  const key_t *e2 = (const key_t *)p2;
+  return (*e1 > *e2) - (*e1 < *e2);
+}
+
+// returns black height, or -1 when a constraint is broken
+static int check_subtree(const pnode_t *p)
+{
+  if (p == NULL)
+  {
+    return 0;
+  }
+  if (p->refs == 0)
+  {
+    return -1;
+  }
+  if (p->color == RBTREE_RED &&
+      ((p->left && p->left->color == RBTREE_RED) || (p->right && p->right->color == RBTREE_RED)))
+  {
+    return -1;
+  }
+  if ((p->left && p->left->key > p->key) || (p->right && p->right->key < p->key))
+  {
+    return -1;
+  }
+  int lh = check_subtree(p->left);
+  int rh = check_subtree(p->right);
+  if (lh < 0 || lh != rh)
+  {
+    return -1;
+  }
+  return lh + (p->color == RBTREE_BLACK ? 1 : 0);
+}
+
+// the version should hold exactly the n sorted keys in expected
+static void check_version(const rbtree_version *v, const key_t *expected, const size_t n)
+{
+  assert(v->root == NULL || v->root->color == RBTREE_BLACK);
+  assert(check_subtree(v->root) >= 0);
+  assert(v->size == n);
+  key_t *res = calloc(n + 1, sizeof(key_t));
+  assert(rbtree_version_to_array(v, res, n) == 0);
+  assert(memcmp(res, expected, n * sizeof(key_t)) == 0);
+  free(res);
+}
+
+// erase the first occurrence of key from the sorted array
+static size_t remove_key(key_t *arr, size_t n, key_t key)
+{
+  for (size_t i = 0; i < n; i++)
+  {
+    if (arr[i] == key)
+    {
+      memmove(&arr[i], &arr[i + 1], (n - i - 1) * sizeof(key_t));
+      return n - 1;
+    }
+  }
+  return n;
+}
+
+// snapshots must keep their contents while the live version keeps changing
+void test_snapshots(const size_t n, const unsigned int seed)
+{
+  srand(seed);
+  rbtree_persistent *p = new_rbtree_persistent();
+  assert(p != NULL);
+  assert(rbtree_version_find(&p->current, 0) == NULL);
+
+  enum { SNAPSHOTS = 8 };
+  rbtree_version *snaps[SNAPSHOTS];
+  key_t *expected[SNAPSHOTS];
+  size_t sizes[SNAPSHOTS];
+
+  key_t *live = calloc(n, sizeof(key_t));
+  size_t m = 0;
+  for (int s = 0; s < SNAPSHOTS; s++)
+  {
+    // a round of inserts, some of them duplicates, then a round of erases
+    for (size_t i = 0; i < n / SNAPSHOTS; i++)
+    {
+      key_t key = rand() % (int)n;
+      assert(rbtree_persistent_insert(p, key) == 0);
+      live[m++] = key;
+    }
+    qsort(live, m, sizeof(key_t), comp);
+    for (size_t i = 0; i < n / (2 * SNAPSHOTS); i++)
+    {
+      key_t key = rand() % (int)n;
+      size_t before = m;
+      m = remove_key(live, m, key);
+      assert(rbtree_persistent_erase(p, key) == (before != m));
+    }
+    check_version(&p->current, live, m);
+
+    snaps[s] = rbtree_snapshot(p);
+    assert(snaps[s] != NULL && snaps[s]->root == p->current.root);
+    expected[s] = calloc(m + 1, sizeof(key_t));
+    memcpy(expected[s], live, m * sizeof(key_t));
+    sizes[s] = m;
+  }
+
+  // every older snapshot is untouched by later writes
+  for (int s = 0; s < SNAPSHOTS; s++)
+  {
+    check_version(snaps[s], expected[s], sizes[s]);
+  }
+
+  // drop snapshots out of order while erasing everything from the live version
+  for (int s = 0; s < SNAPSHOTS; s += 2)
+  {
+    rbtree_version_release(snaps[s]);
+  }
+  while (m > 0)
+  {
+    key_t key = live[rand() % m];
+    assert(rbtree_persistent_erase(p, key) == 1);
+    m = remove_key(live, m, key);
+  }
+  assert(p->current.root == NULL && p->current.size == 0);
+  for (int s = 1; s < SNAPSHOTS; s += 2)
+  {
+    check_version(snaps[s], expected[s], sizes[s]);
+    rbtree_version_release(snaps[s]);
+  }
+
+  for (int s = 0; s < SNAPSHOTS; s++)
+  {
+    free(expected[s]);
+  }
+  free(live);
+  delete_rbtree_persistent(p);
+}
+
+typedef struct
+{
+  key_t *keys;
+  size_t n;
+} collect_ctx;
+
+static int collect_key(const pnode_t *node, void *p)
+{
+  collect_ctx *ctx = (collect_ctx *)p;
+  ctx->keys[ctx->n++] = node->key;
+  return 0;
+}
+
+// range scans visit keys in order; unshared nodes are rewritten in place
+void test_range_and_reuse(const size_t n)
+{
+  rbtree_persistent *p = new_rbtree_persistent();
+  for (size_t i = 0; i < n; i++)
+  {
+    rbtree_persistent_insert(p, (key_t)(i * 2));
+  }
+
+  key_t *keys = calloc(n, sizeof(key_t));
+  collect_ctx ctx = {keys, 0};
+  assert(rbtree_version_range(&p->current, 11, 41, collect_key, &ctx) == 15);
+  for (size_t i = 0; i < ctx.n; i++)
+  {
+    assert(keys[i] == (key_t)(12 + 2 * i));
+  }
+
+  // without snapshots nothing is shared: an erase only gives back the erased node
+  // and an insert only takes the new one
+  assert(rbtree_persistent_erase(p, 0) == 1);
+  size_t spare = p->n_spare;
+  assert(rbtree_persistent_erase(p, 2) == 1);
+  assert(p->n_spare == spare + 1);
+  assert(rbtree_persistent_insert(p, 0) == 0);
+  assert(p->n_spare == spare);
+  const pnode_t *root = p->current.root;
+
+  // with a snapshot the changed path is copied and the old root is kept
+  rbtree_version *v = rbtree_snapshot(p);
+  assert(rbtree_persistent_insert(p, -1) == 0);
+  assert(p->n_spare < spare);
+  assert(v->root == root && p->current.root != root);
+  assert(rbtree_version_find(v, -1) == NULL);
+  assert(rbtree_version_find(&p->current, -1) != NULL);
+  rbtree_version_release(v);
+
+  free(keys);
+  delete_rbtree_persistent(p);
+}
+
+typedef struct
+{
+  rbtree_version *v;
+  size_t n;
+} scan_arg;
+
+static int count_key(const pnode_t *node, void *p)
+{
+  key_t *last = (key_t *)p;
+  assert(node->key > *last);
+  *last = node->key;
+  return 0;
+}
+
+static void *scanner(void *p)
+{
+  scan_arg *arg = (scan_arg *)p;
+  for (int round = 0; round < 20; round++)
+  {
+    key_t last = RBTREE_KEY_MIN;
+    assert(rbtree_version_range(arg->v, RBTREE_KEY_MIN + 1, INT_MAX, count_key, &last) == arg->n);
+  }
+  rbtree_version_release(arg->v);
+  return NULL;
+}
+
+// a scanner thread reads and releases a snapshot while the writer keeps going
+void test_concurrent_scan(const size_t n)
+{
+  rbtree_persistent *p = new_rbtree_persistent();
+  for (size_t i = 0; i < n; i++)
+  {
+    rbtree_persistent_insert(p, (key_t)i);
+  }
+
+  scan_arg arg = {rbtree_snapshot(p), n};
+  pthread_t thread;
+  assert(pthread_create(&thread, NULL, scanner, &arg) == 0);
+  for (size_t i = 0; i < n; i += 2)
+  {
+    assert(rbtree_persistent_erase(p, (key_t)i) == 1);
+    assert(rbtree_persistent_insert(p, (key_t)(n + i)) == 0);
+  }
+  pthread_join(thread, NULL);
+  assert(check_subtree(p->current.root) >= 0);
+  delete_rbtree_persistent(p);
+}
+
+int main(void)
+{
+  test_snapshots(4000, 21);
+  test_range_and_reuse(100);
+  test_concurrent_scan(20000);
+  printf("Passed all tests!\n");
+}
@@ -0,0 +1,120 @@
+#include <assert.h>
+#include <pthread.h>
+#include <rbtree_sharded.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define THREADS 4
+
+typedef struct
+{
+  rbtree_sharded *s;
+  int id;
+  size_t per_thread;
+} worker_arg;
+
+// each thread owns the keys congruent to its id, so the final set is known
+static void *worker(void *p)
+{
+  worker_arg *arg = (worker_arg *)p;
+  for (size_t i = 0; i < arg->per_thread; i++)
+  {
+    key_t key = (key_t)(i * THREADS + (size_t)arg->id) - (key_t)(arg->per_thread * THREADS / 2);
+    assert(rbtree_sharded_insert(arg->s, key) == 0);
+    assert(rbtree_sharded_find(arg->s, key) == 1);
+  }
+  // erase the odd-indexed keys again
+  for (size_t i = 1; i < arg->per_thread; i += 2)
+  {
+    key_t key = (key_t)(i * THREADS + (size_t)arg->id) - (key_t)(arg->per_thread * THREADS / 2);
+    assert(rbtree_sharded_erase(arg->s, key) == 1);
+    assert(rbtree_sharded_erase(arg->s, key) == 0);
+  }
+  return NULL;
+}
+
+typedef struct
+{
+  key_t *keys;
+  size_t n, limit;
+} collect_ctx;
+
+static int collect_key(node_t *node, void *p)
+{
+  collect_ctx *ctx = (collect_ctx *)p;
+  ctx->keys[ctx->n++] = node->key;
+  return ctx->n == ctx->limit;
+}
+
+// concurrent writers, then ordered scans over the surviving keys
+void test_sharded(const size_t shards, const rbtree_shard_mode mode, const size_t per_thread)
+{
+  rbtree_sharded *s = new_rbtree_sharded(shards, mode);
+  assert(s != NULL);
+
+  pthread_t threads[THREADS];
+  worker_arg args[THREADS];
+  for (int i = 0; i < THREADS; i++)
+  {
+    args[i].s = s;
+    args[i].id = i;
+    args[i].per_thread = per_thread;
+    assert(pthread_create(&threads[i], NULL, worker, &args[i]) == 0);
+  }
+  for (int i = 0; i < THREADS; i++)
+  {
+    pthread_join(threads[i], NULL);
+  }
+
+  // surviving keys are those whose index i is even: k = i * THREADS + id - base
+  const key_t base = (key_t)(per_thread * THREADS / 2);
+  size_t total = per_thread * THREADS;
+  key_t *keys = calloc(total, sizeof(key_t));
+  collect_ctx ctx = {keys, 0, 0};
+  ssize_t visited = rbtree_sharded_range(s, RBTREE_KEY_MIN, INT_MAX, collect_key, &ctx);
+  assert(visited >= 0 && (size_t)visited == ctx.n);
+  size_t expected = 0;
+  for (size_t k = 0; k < total; k++)
+  {
+    if ((k / THREADS) % 2 == 0)
+    {
+      assert(keys[expected] == (key_t)k - base);
+      expected++;
+    }
+  }
+  assert(ctx.n == expected);
+
+  // a sub-range and an early stop
+  key_t lo = -10, hi = 25;
+  ctx.n = 0;
+  rbtree_sharded_range(s, lo, hi, collect_key, &ctx);
+  for (size_t i = 0; i < ctx.n; i++)
+  {
+    assert(keys[i] >= lo && keys[i] <= hi);
+    assert(i == 0 || keys[i - 1] < keys[i]);
+    assert(rbtree_sharded_find(s, keys[i]) == 1);
+  }
+  for (key_t k = lo; k <= hi; k++)
+  {
+    size_t index = (size_t)(k + base);
+    assert(rbtree_sharded_find(s, k) == ((index / THREADS) % 2 == 0));
+  }
+  ctx.n = 0;
+  ctx.limit = 3;
+  assert(rbtree_sharded_range(s, RBTREE_KEY_MIN, INT_MAX, collect_key, &ctx) == 3);
+  assert(keys[0] == -base);
+  assert(rbtree_sharded_range(s, 5, 4, collect_key, &ctx) == 0);
+
+  free(keys);
+  delete_rbtree_sharded(s);
+}
+
+int main(void)
+{
+  assert(new_rbtree_sharded(0, RBTREE_SHARD_HASH) == NULL);
+  test_sharded(1, RBTREE_SHARD_RANGE, 1000);
+  test_sharded(8, RBTREE_SHARD_RANGE, 10000);
+  test_sharded(8, RBTREE_SHARD_HASH, 10000);
+  test_sharded(7, RBTREE_SHARD_HASH, 1000);
+  printf("Passed all tests!\n");
+}
@@ -0,0 +1,130 @@
+#include <assert.h>
+#include <rbtree_template.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// int keys with the same ordering as rbtree.h, carrying a value
+RBTREE_GENERATE_STATIC(int_map, key_t, double, RBTREE_CMP_NUMERIC)
+
+// string keys compared by an inline function
+static inline int str_cmp(const char *a, const char *b) { return strcmp(a, b); }
+RBTREE_GENERATE_STATIC(str_map, const char *, int, str_cmp)
+
+// returns black height, or -1 when a constraint is broken
+static int check_int_map(const int_map *t, const int_map_node *p)
+{
+  if (p == t->nil)
+  {
+    return 0;
+  }
+  if (p->color == RBTREE_RED && (p->left->color == RBTREE_RED || p->right->color == RBTREE_RED))
+  {
+    return -1;
+  }
+  if ((p->left != t->nil && (p->left->key > p->key || p->left->parent != p)) ||
+      (p->right != t->nil && (p->right->key < p->key || p->right->parent != p)))
+  {
+    return -1;
+  }
+  int lh = check_int_map(t, p->left);
+  int rh = check_int_map(t, p->right);
+  if (lh < 0 || lh != rh)
+  {
+    return -1;
+  }
+  return lh + (p->color == RBTREE_BLACK ? 1 : 0);
+}
+
+// the int instantiation should agree with the int API of rbtree.h
+void test_int_map(const size_t n, const unsigned int seed)
+{
+  srand(seed);
+  int_map *m = int_map_new();
+  rbtree *t = new_rbtree();
+  assert(m != NULL && t != NULL);
+  assert(int_map_min(m) == NULL);
+
+  for (size_t i = 0; i < n; i++)
+  {
+    key_t key = rand() % (int)n;
+    int_map_node *p = int_map_insert(m, key, key * 0.5);
+    assert(p != NULL && p->key == key);
+    rbtree_insert(t, key);
+  }
+  assert(m->root->color == RBTREE_BLACK);
+  assert(check_int_map(m, m->root) >= 0);
+
+  for (size_t i = 0; i < n; i += 3)
+  {
+    key_t key = rand() % (int)n;
+    int_map_node *p = int_map_find(m, key);
+    node_t *q = rbtree_find(t, key);
+    assert((p == NULL) == (q == NULL));
+    if (p != NULL)
+    {
+      assert(p->value == key * 0.5);
+      int_map_erase(m, p);
+      rbtree_erase(t, q);
+    }
+  }
+  assert(check_int_map(m, m->root) >= 0);
+
+  size_t count = 0;
+  for (int_map_node *p = int_map_min(m); p != NULL; p = int_map_next(m, p))
+  {
+    count++;
+  }
+  key_t *arr = calloc(count + 1, sizeof(key_t));
+  assert(rbtree_to_array(t, arr, count) == 0);
+  size_t i = 0;
+  for (int_map_node *p = int_map_min(m); p != NULL; p = int_map_next(m, p))
+  {
+    assert(arr[i++] == p->key);
+  }
+  assert(int_map_max(m)->key == rbtree_max(t)->key);
+
+  free(arr);
+  delete_rbtree(t);
+  int_map_delete(m);
+}
+
+void test_str_map()
+{
+  const char *words[] = {"pear", "apple", "fig", "banana", "cherry", "kiwi", "grape"};
+  const size_t n = sizeof(words) / sizeof(words[0]);
+
+  str_map *m = str_map_new();
+  for (size_t i = 0; i < n; i++)
+  {
+    assert(str_map_insert(m, words[i], (int)i) != NULL);
+  }
+
+  str_map_node *p = str_map_find(m, "fig");
+  assert(p != NULL && p->value == 2);
+  assert(str_map_find(m, "plum") == NULL);
+  assert(strcmp(str_map_min(m)->key, "apple") == 0);
+  assert(strcmp(str_map_max(m)->key, "pear") == 0);
+
+  str_map_erase(m, p);
+  assert(str_map_find(m, "fig") == NULL);
+
+  const char *prev = "";
+  size_t count = 0;
+  for (p = str_map_min(m); p != NULL; p = str_map_next(m, p))
+  {
+    assert(strcmp(prev, p->key) < 0);
+    prev = p->key;
+    count++;
+  }
+  assert(count == n - 1);
+
+  str_map_delete(m);
+}
+
+int main(void)
+{
+  test_int_map(10000, 17);
+  test_str_map();
+  printf("Passed all tests!\n");
+}
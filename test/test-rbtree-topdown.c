@@ -0,0 +1,162 @@
+#include <assert.h>
+#include <rbtree_topdown.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// returns the black height of the subtree, checking order, red-red and black-height rules
+static int check_node(const tnode_t *node, const key_t lo, const key_t hi, size_t *count)
+{
+  if (node == NULL)
+  {
+    return 1;
+  }
+  assert(lo <= node->key && node->key <= hi);
+  if (node->color == RBTREE_RED)
+  {
+    assert(node->link[0] == NULL || node->link[0]->color == RBTREE_BLACK);
+    assert(node->link[1] == NULL || node->link[1]->color == RBTREE_BLACK);
+  }
+  (*count)++;
+  int left = check_node(node->link[0], lo, node->key, count);
+  int right = check_node(node->link[1], node->key, hi, count);
+  assert(left == right);
+  return left + (node->color == RBTREE_BLACK);
+}
+
+static void check_tree(const rbtree_topdown *t, const size_t *counts, const key_t range)
+{
+  assert(t->root == NULL || t->root->color == RBTREE_BLACK);
+  size_t n = 0;
+  check_node(t->root, RBTREE_KEY_MIN, RBTREE_KEY_MAX, &n);
+  assert(n == t->size);
+
+  // the iterator walks the keys in order from any starting key
+  for (key_t from = -1; from <= range + 1; from += range / 7 + 1)
+  {
+    rbtree_topdown_iter iter;
+    rbtree_topdown_iter_init(&iter, t, from);
+    for (key_t key = from < 0 ? 0 : from; key < range; key++)
+    {
+      for (size_t i = 0; i < counts[key]; i++)
+      {
+        tnode_t *node = rbtree_topdown_iter_next(&iter);
+        assert(node != NULL && node->key == key);
+      }
+    }
+    assert(rbtree_topdown_iter_next(&iter) == NULL);
+  }
+}
+
+void test_empty(void)
+{
+  rbtree_topdown *t = new_rbtree_topdown();
+  assert(t != NULL && t->root == NULL && t->size == 0);
+  assert(rbtree_topdown_find(t, 0) == NULL);
+  assert(rbtree_topdown_erase(t, 0) == 0);
+  key_t dummy;
+  assert(rbtree_topdown_to_array(t, &dummy, 0) == 0);
+  rbtree_topdown_iter iter;
+  rbtree_topdown_iter_init(&iter, t, RBTREE_KEY_MIN);
+  assert(rbtree_topdown_iter_next(&iter) == NULL);
+  delete_rbtree_topdown(t);
+}
+
+// random inserts and erases with duplicates, checked against a count per key
+void test_random(const size_t n, const key_t range, const unsigned int seed)
+{
+  srand(seed);
+  rbtree_topdown *t = new_rbtree_topdown();
+  size_t *counts = calloc(range, sizeof(size_t));
+  size_t size = 0;
+
+  for (size_t i = 0; i < n; i++)
+  {
+    key_t key = rand() % range;
+    if (rand() % 3 != 0)
+    {
+      tnode_t *node = rbtree_topdown_insert(t, key);
+      assert(node != NULL && node->key == key);
+      counts[key]++;
+      size++;
+    }
+    else
+    {
+      assert(rbtree_topdown_erase(t, key) == (counts[key] > 0));
+      if (counts[key] > 0)
+      {
+        counts[key]--;
+        size--;
+      }
+    }
+    assert(t->size == size);
+    if (i % (n / 8 + 1) == 0)
+    {
+      check_tree(t, counts, range);
+    }
+  }
+  check_tree(t, counts, range);
+
+  for (key_t key = 0; key < range; key++)
+  {
+    tnode_t *node = rbtree_topdown_find(t, key);
+    assert(counts[key] > 0 ? node != NULL && node->key == key : node == NULL);
+  }
+
+  key_t *arr = calloc(size + 1, sizeof(key_t));
+  assert(rbtree_topdown_to_array(t, arr, size + 1) == -1);
+  assert(rbtree_topdown_to_array(t, arr, size) == 0);
+  for (size_t i = 1; i < size; i++)
+  {
+    assert(arr[i - 1] <= arr[i]);
+  }
+
+  // drain everything, reusing freed nodes along the way
+  for (key_t key = 0; key < range; key++)
+  {
+    while (counts[key] > 0)
+    {
+      assert(rbtree_topdown_erase(t, key) == 1);
+      counts[key]--;
+    }
+    assert(rbtree_topdown_erase(t, key) == 0);
+  }
+  assert(t->root == NULL && t->size == 0);
+
+  free(arr);
+  free(counts);
+  delete_rbtree_topdown(t);
+}
+
+// sorted input is the worst case for the push-down rotations
+void test_sorted(const size_t n)
+{
+  rbtree_topdown *t = new_rbtree_topdown();
+  size_t *counts = calloc(n, sizeof(size_t));
+  for (size_t i = 0; i < n; i++)
+  {
+    rbtree_topdown_insert(t, (key_t)i);
+    counts[i]++;
+  }
+  check_tree(t, counts, (key_t)n);
+  for (size_t i = n; i-- > 0;)
+  {
+    if (i % 2 == 0)
+    {
+      assert(rbtree_topdown_erase(t, (key_t)i) == 1);
+      counts[i]--;
+    }
+  }
+  check_tree(t, counts, (key_t)n);
+  free(counts);
+  delete_rbtree_topdown(t);
+}
+
+int main(void)
+{
+  test_empty();
+  test_random(20000, 500, 1);
+  test_random(20000, 20, 2);
+  test_random(100000, 50000, 3);
+  test_sorted(10000);
+  printf("Passed all tests!\n");
+}
@@ -1,8 +1,22 @@
 #include <assert.h>
+#include <pthread.h>
 #include <rbtree.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// number of keys a node holds; a multiset node stands for all copies of its key
+static size_t node_keys(const node_t *p)
+{
+#ifdef RBTREE_MULTISET
+  return p->count;
+#else
+  (void)p;
+  return 1;
+#endif
+}
 
 // new_rbtree should return rbtree struct with null root node
 void test_init(void)
@@ -30,11 +44,11 @@ void test_insert_single(const key_t key)
 #ifdef SENTINEL
   assert(p->left == t->nil);
   assert(p->right == t->nil);
-  assert(p->parent == t->nil);
+  assert(rbtree_parent(p) == t->nil);
 #else
   assert(p->left == NULL);
   assert(p->right == NULL);
-  assert(p->parent == NULL);
+  assert(rbtree_parent(p) == NULL);
 #endif
   delete_rbtree(t);
 }
@@ -239,6 +253,18 @@ void test_search_constraint(const rbtree *t)
   node_t *nil = NULL;
 #endif
   assert(search_traverse(p, &min, &max, nil));
+
+  // the cached ends should be the ends of the walk from the root
+  node_t *lo = t->nil, *hi = t->nil;
+  for (node_t *q = p; q != nil; q = q->left)
+  {
+    lo = q;
+  }
+  for (node_t *q = p; q != nil; q = q->right)
+  {
+    hi = q;
+  }
+  assert(t->leftmost == lo && t->rightmost == hi);
 }
 
 // Color constraint
@@ -273,13 +299,13 @@ static bool color_traverse(const node_t *p, const color_t parent_color,
     }
     return true;
   }
-  if (parent_color == RBTREE_RED && p->color == RBTREE_RED)
+  if (parent_color == RBTREE_RED && rbtree_color(p) == RBTREE_RED)
   {
     return false;
   }
-  int next_depth = ((p->color == RBTREE_BLACK) ? 1 : 0) + black_depth;
-  return color_traverse(p->left, p->color, next_depth, nil) &&
-         color_traverse(p->right, p->color, next_depth, nil);
+  int next_depth = ((rbtree_color(p) == RBTREE_BLACK) ? 1 : 0) + black_depth;
+  return color_traverse(p->left, rbtree_color(p), next_depth, nil) &&
+         color_traverse(p->right, rbtree_color(p), next_depth, nil);
 }
 
 void test_color_constraint(const rbtree *t)
@@ -291,12 +317,65 @@ void test_color_constraint(const rbtree *t)
   node_t *nil = NULL;
 #endif
   node_t *p = t->root;
-  assert(p == nil || p->color == RBTREE_BLACK);
+  assert(p == nil || rbtree_color(p) == RBTREE_BLACK);
 
   init_color_traverse();
   assert(color_traverse(p, RBTREE_BLACK, 0, nil));
 }
 
+// Augmented fields should match a recomputation from the children
+#ifdef RBTREE_INTERVAL
+static key_t max_traverse(const node_t *p, const node_t *nil, bool *ok)
+{
+  if (p == nil)
+  {
+    return RBTREE_KEY_MIN;
+  }
+  key_t max = p->hi;
+  key_t l = max_traverse(p->left, nil, ok);
+  key_t r = max_traverse(p->right, nil, ok);
+  max = l > max ? l : max;
+  max = r > max ? r : max;
+  if (p->max != max || p->hi < p->key)
+  {
+    *ok = false;
+  }
+  return max;
+}
+#endif
+
+#ifdef RBTREE_ORDER_STATS
+static size_t size_traverse(const node_t *p, const node_t *nil, bool *ok)
+{
+  if (p == nil)
+  {
+    return 0;
+  }
+  size_t size = size_traverse(p->left, nil, ok) + size_traverse(p->right, nil, ok) + node_keys(p);
+  if (p->size != size)
+  {
+    *ok = false;
+  }
+  return size;
+}
+#endif
+
+void test_augment_constraint(const rbtree *t)
+{
+  assert(t != NULL);
+#ifdef RBTREE_ORDER_STATS
+  bool ok = true;
+  size_traverse(t->root, t->nil, &ok);
+  assert(ok);
+  assert(t->nil->size == 0);
+#endif
+#ifdef RBTREE_INTERVAL
+  bool max_ok = true;
+  max_traverse(t->root, t->nil, &max_ok);
+  assert(max_ok);
+#endif
+}
+
 // rbtree should keep search tree and color constraints
 void test_rb_constraints(const key_t arr[], const size_t n)
 {
@@ -307,6 +386,7 @@ void test_rb_constraints(const key_t arr[], const size_t n)
   assert(t->root != NULL);
 
   test_color_constraint(t);
+  test_augment_constraint(t);
   test_search_constraint(t);
 
   delete_rbtree(t);
@@ -412,18 +492,1487 @@ void test_find_erase_rand(const size_t n, const unsigned int seed)
   delete_rbtree(t);
 }
 
-int main(void)
+// new_rbtree_with_capacity should hold n nodes without growing,
+// and erased nodes should be reused by the next insert
+void test_capacity_and_reuse(const size_t n)
 {
-  test_init();
-  test_insert_single(1024);
-  test_find_single(512, 1024);
-  test_erase_root(128);
-  test_find_erase_fixed();
-  test_minmax_suite();
-  test_to_array_suite();
-  test_distinct_values();
-  test_duplicate_values();
-  test_multi_instance();
-  test_find_erase_rand(10000, 17);
+  rbtree *t = new_rbtree_with_capacity(n);
+  assert(t != NULL);
+  assert(t->root == t->nil);
+
+  node_t **nodes = calloc(n, sizeof(node_t *));
+  for (size_t i = 0; i < n; i++)
+  {
+    nodes[i] = rbtree_insert(t, (key_t)i);
+    assert(nodes[i] != NULL);
+  }
+  // all nodes are carved from the single pre-reserved chunk
+  for (size_t i = 1; i < n; i++)
+  {
+    assert(nodes[i] == nodes[0] + i);
+  }
+  test_color_constraint(t);
+  test_augment_constraint(t);
+  test_search_constraint(t);
+
+  for (size_t i = 0; i < n; i += 2)
+  {
+    rbtree_erase(t, nodes[i]);
+  }
+  for (size_t i = 0; i < n; i += 2)
+  {
+    node_t *p = rbtree_insert(t, (key_t)i);
+    assert(p >= nodes[0] && p < nodes[0] + n);
+  }
+  test_color_constraint(t);
+  test_augment_constraint(t);
+  test_search_constraint(t);
+
+  free(nodes);
+  delete_rbtree(t);
+}
+
+#ifdef RBTREE_COMPACT
+// compact layout keeps the color in the parent pointer
+void test_compact_layout(void)
+{
+#if !defined(RBTREE_ORDER_STATS) && !defined(RBTREE_INTERVAL) && !defined(RBTREE_MULTISET)
+  assert(sizeof(node_t) == 32);
+#endif
+
+  rbtree *t = new_rbtree();
+  node_t *p = rbtree_insert(t, 1);
+  node_t *q = rbtree_insert(t, 2);
+  assert(rbtree_color(p) == RBTREE_BLACK);
+  assert(rbtree_color(q) == RBTREE_RED);
+  assert(rbtree_parent(q) == p);
+  assert(rbtree_parent(p) == t->nil);
+  delete_rbtree(t);
+}
+#endif
+
+// bulk construction should give a valid tree with every key in order
+void test_from_sorted_array(const size_t n)
+{
+  key_t *arr = calloc(n + 1, sizeof(key_t));
+  for (size_t i = 0; i < n; i++)
+  {
+    arr[i] = (key_t)(i / 3); // with duplicates
+  }
+
+  rbtree *t = rbtree_from_sorted_array(arr, n);
+  assert(t != NULL);
+  test_color_constraint(t);
+  test_augment_constraint(t);
+  test_search_constraint(t);
+
+  key_t *res = calloc(n + 1, sizeof(key_t));
+  assert(rbtree_to_array(t, res, n) == 0);
+  for (size_t i = 0; i < n; i++)
+  {
+    assert(res[i] == arr[i]);
+  }
+
+  // the bulk-built tree should keep working as a normal tree
+  for (size_t i = 0; i < n; i += 2)
+  {
+    node_t *p = rbtree_find(t, arr[i]);
+    assert(p != NULL);
+    rbtree_erase(t, p);
+  }
+  rbtree_insert(t, -1);
+  test_color_constraint(t);
+  test_augment_constraint(t);
+  test_search_constraint(t);
+
+  free(res);
+  free(arr);
+  delete_rbtree(t);
+}
+
+void test_from_array(const size_t n, const unsigned int seed)
+{
+  srand(seed);
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (size_t i = 0; i < n; i++)
+  {
+    arr[i] = rand() - RAND_MAX / 2;
+  }
+
+  rbtree *t = rbtree_from_array(arr, n);
+  assert(t != NULL);
+  test_color_constraint(t);
+  test_augment_constraint(t);
+
+  key_t *res = calloc(n, sizeof(key_t));
+  assert(rbtree_to_array(t, res, n) == 0);
+  qsort(arr, n, sizeof(key_t), comp);
+  for (size_t i = 0; i < n; i++)
+  {
+    assert(res[i] == arr[i]);
+  }
+
+  free(res);
+  free(arr);
+  delete_rbtree(t);
+}
+
+void test_bulk_suite()
+{
+  for (size_t n = 0; n < 70; n++)
+  {
+    test_from_sorted_array(n);
+  }
+  test_from_sorted_array(4095);
+  test_from_sorted_array(4096);
+  test_from_array(1000, 7);
+  test_from_array((1 << 20) + 3, 11);
+}
+
+// apply_batch should match applying the same ops one by one
+void test_apply_batch(const size_t n, const size_t m, const unsigned int seed)
+{
+  srand(seed);
+  rbtree *t = new_rbtree();
+  rbtree *ref = new_rbtree();
+  for (size_t i = 0; i < n; i++)
+  {
+    key_t key = rand() % (int)(n + m);
+    rbtree_insert(t, key);
+    rbtree_insert(ref, key);
+  }
+
+  op_t *ops = calloc(m, sizeof(op_t));
+  size_t size = n;
+  for (size_t i = 0; i < m; i++)
+  {
+    ops[i].kind = rand() % 2 ? RBTREE_OP_INSERT : RBTREE_OP_ERASE;
+    ops[i].key = rand() % (int)(n + m);
+    if (ops[i].kind == RBTREE_OP_INSERT)
+    {
+      rbtree_insert(ref, ops[i].key);
+      size++;
+    }
+    else
+    {
+      node_t *p = rbtree_find(ref, ops[i].key);
+      if (p != NULL)
+      {
+        rbtree_erase(ref, p);
+        size--;
+      }
+    }
+  }
+
+  assert(rbtree_apply_batch(t, ops, m) == 0);
+  test_color_constraint(t);
+  test_augment_constraint(t);
+  test_search_constraint(t);
+#ifndef RBTREE_MULTISET
+  assert(t->nodes == size);
+#endif
+
+  key_t *res = calloc(size + 1, sizeof(key_t));
+  key_t *expected = calloc(size + 1, sizeof(key_t));
+  assert(rbtree_to_array(t, res, size) == 0);
+  assert(rbtree_to_array(ref, expected, size) == 0);
+  for (size_t i = 0; i < size; i++)
+  {
+    assert(res[i] == expected[i]);
+  }
+
+  free(expected);
+  free(res);
+  free(ops);
+  delete_rbtree(ref);
+  delete_rbtree(t);
+}
+
+static size_t insert_compares(const rbtree *t)
+{
+#ifdef RBTREE_STATS
+  rbtree_stats st;
+  rbtree_get_stats(t, &st);
+  return st.insert_compares;
+#else
+  (void)t;
+  return 0;
+#endif
+}
+
+static void reset_compares(rbtree *t)
+{
+#ifdef RBTREE_STATS
+  rbtree_reset_stats(t);
+#else
+  (void)t;
+#endif
+}
+
+static void apply_range(rbtree *t, const op_kind_t kind, const key_t first, const key_t step, const size_t m)
+{
+  op_t *ops = calloc(m, sizeof(op_t));
+  for (size_t i = 0; i < m; i++)
+  {
+    ops[i].kind = kind;
+    ops[i].key = first + (key_t)i * step;
+  }
+  assert(rbtree_apply_batch(t, ops, m) == 0);
+  free(ops);
+}
+
+// a small batch on a large tree goes in one by one (and compares keys), a batch a few times the tree
+// size is merged and rebuilt (no key compares); after a split the node count is found lazily
+void test_apply_batch_paths(const size_t n)
+{
+  const size_t small = 1000, large = 3 * n;
+  key_t *arr = calloc(4 * n, sizeof(key_t));
+  for (size_t i = 0; i < n; i++)
+  {
+    arr[i] = (key_t)(2 * i);
+  }
+  rbtree *t = rbtree_from_sorted_array(arr, n);
+  assert(t->nodes == n);
+
+  apply_range(t, RBTREE_OP_ERASE, 0, 2, small);
+  apply_range(t, RBTREE_OP_INSERT, 1, 2, small);
+#ifdef RBTREE_STATS
+  assert(insert_compares(t) > 0);
+#endif
+  assert(t->nodes == n);
+  assert(rbtree_find(t, 0) == NULL && rbtree_find(t, 1) != NULL && rbtree_find(t, 2 * small) != NULL);
+
+  reset_compares(t);
+  apply_range(t, RBTREE_OP_INSERT, (key_t)(2 * n), 1, large);
+  assert(insert_compares(t) == 0);
+  assert(t->nodes == 4 * n);
+  test_color_constraint(t);
+  test_search_constraint(t);
+  assert(rbtree_to_array(t, arr, 4 * n) == 0);
+  for (size_t i = 0; i < 4 * n; i++)
+  {
+    key_t expected = i < small ? (key_t)(2 * i + 1) : i < n ? (key_t)(2 * i) : (key_t)(n + i);
+    assert(arr[i] == expected);
+  }
+
+  // t keeps [0, 2n) and r gets [2n, 5n)
+  rbtree *r = rbtree_split(t, (key_t)(2 * n));
+#if !defined(RBTREE_ORDER_STATS) || defined(RBTREE_MULTISET)
+  assert(t->nodes == RBTREE_NODES_UNKNOWN && r->nodes == RBTREE_NODES_UNKNOWN);
+#endif
+  reset_compares(r);
+  apply_range(r, RBTREE_OP_INSERT, (key_t)(5 * n), 1, small);
+#ifdef RBTREE_STATS
+  assert(insert_compares(r) > 0);
+#endif
+  reset_compares(t);
+  apply_range(t, RBTREE_OP_INSERT, -(key_t)large, 1, large);
+  assert(insert_compares(t) == 0);
+  assert(t->nodes == n + large);
+  assert(rbtree_min(t)->key == -(key_t)large && rbtree_max(r)->key == (key_t)(5 * n + small - 1));
+
+  free(arr);
+  delete_rbtree(r);
+  delete_rbtree(t);
+}
+
+void test_apply_batch_suite()
+{
+  test_apply_batch(0, 100, 1);     // empty tree
+  test_apply_batch(100, 1000, 2);  // batch larger than the tree
+  test_apply_batch(100000, 20, 3); // small batch on a large tree
+  test_apply_batch(10000, 5000, 4);
+  test_apply_batch_paths(1 << 18);
+
+  // an insert and an erase of the same key in one batch cancel out
+  rbtree *t = new_rbtree();
+  const op_t ops[] = {{RBTREE_OP_INSERT, 5}, {RBTREE_OP_ERASE, 5}, {RBTREE_OP_ERASE, 7}, {RBTREE_OP_INSERT, 3}};
+  assert(rbtree_apply_batch(t, ops, sizeof(ops) / sizeof(ops[0])) == 0);
+  assert(rbtree_find(t, 5) == NULL);
+  assert(rbtree_find(t, 3) != NULL);
+  delete_rbtree(t);
+}
+
+typedef struct
+{
+  key_t *keys;
+  size_t count;
+  size_t limit;
+} range_ctx;
+
+static int collect_key(node_t *p, void *arg)
+{
+  range_ctx *ctx = (range_ctx *)arg;
+  ctx->keys[ctx->count++] = p->key;
+  return ctx->count == ctx->limit;
+}
+
+// next/prev and the bound queries should agree with the sorted array
+void test_ordered_access(const size_t n, const unsigned int seed)
+{
+  srand(seed);
+  rbtree *t = new_rbtree();
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (size_t i = 0; i < n; i++)
+  {
+    arr[i] = rand() % (int)(n * 2);
+    rbtree_insert(t, arr[i]);
+  }
+  qsort(arr, n, sizeof(key_t), comp);
+
+  size_t i = 0;
+  for (node_t *p = rbtree_min(t); p != NULL; p = rbtree_next(t, p))
+  {
+    assert(p->key == arr[i]);
+    i += node_keys(p);
+  }
+  assert(i == n);
+  for (node_t *p = rbtree_max(t); p != NULL; p = rbtree_prev(t, p))
+  {
+    i -= node_keys(p);
+    assert(p->key == arr[i]);
+  }
+  assert(i == 0);
+
+  for (key_t key = -1; key <= (key_t)(n * 2); key++)
+  {
+    size_t lo = 0;
+    while (lo < n && arr[lo] < key)
+      lo++;
+    size_t hi = lo;
+    while (hi < n && arr[hi] <= key)
+      hi++;
+
+    node_t *p = rbtree_lower_bound(t, key);
+    assert(lo == n ? p == NULL : p != NULL && p->key == arr[lo]);
+    assert(rbtree_ceil(t, key) == p);
+    p = rbtree_upper_bound(t, key);
+    assert(hi == n ? p == NULL : p != NULL && p->key == arr[hi]);
+    p = rbtree_floor(t, key);
+    assert(hi == 0 ? p == NULL : p != NULL && p->key == arr[hi - 1]);
+  }
+
+  // range should visit exactly the keys in [lo, hi] and stop on request
+  range_ctx ctx = {calloc(n, sizeof(key_t)), 0, n + 1};
+  const key_t lo = (key_t)(n / 2), hi = (key_t)n;
+  size_t first = 0;
+  while (first < n && arr[first] < lo)
+    first++;
+  size_t visited = rbtree_range(t, lo, hi, collect_key, &ctx);
+  assert(visited == ctx.count);
+  size_t at = first;
+  for (size_t j = 0; j < ctx.count; j++)
+  {
+    assert(ctx.keys[j] == arr[at]);
+    at += node_keys(rbtree_find(t, arr[at]));
+  }
+  assert(at == n || arr[at] > hi);
+
+  ctx.count = 0;
+  ctx.limit = 3;
+  assert(rbtree_range(t, lo, hi, collect_key, &ctx) == 3);
+
+  free(ctx.keys);
+  free(arr);
+  delete_rbtree(t);
+}
+
+// export should stream the keys in fixed-size chunks without overrunning
+void test_export_chunks(const size_t n, const size_t cap)
+{
+  rbtree *t = new_rbtree();
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (size_t i = 0; i < n; i++)
+  {
+    arr[i] = rand() % (int)n;
+    rbtree_insert(t, arr[i]);
+  }
+  qsort(arr, n, sizeof(key_t), comp);
+
+  key_t *buf = calloc(cap + 1, sizeof(key_t));
+  rbtree_cursor cursor;
+  rbtree_cursor_init(&cursor);
+  size_t total = 0, got;
+  buf[cap] = -12345;
+  while ((got = rbtree_export(t, &cursor, buf, cap)) > 0)
+  {
+    assert(got <= cap);
+    assert(buf[cap] == -12345);
+    for (size_t i = 0; i < got; i++)
+    {
+      assert(buf[i] == arr[total + i]);
+    }
+    total += got;
+  }
+  assert(total == n);
+  assert(rbtree_export(t, &cursor, buf, cap) == 0);
+
+  // an undersized buffer is rejected without writing past its end
+  if (n > 1)
+  {
+    key_t *small = calloc(n, sizeof(key_t));
+    small[n - 1] = -12345;
+    assert(rbtree_to_array(t, small, n - 1) == -1);
+    assert(small[n - 1] == -12345);
+    free(small);
+  }
+
+  free(buf);
+  free(arr);
+  delete_rbtree(t);
+}
+
+#ifdef RBTREE_ORDER_STATS
+// select/rank/count_range should agree with the sorted array
+void test_order_stats(const size_t n, const unsigned int seed)
+{
+  srand(seed);
+  rbtree *t = new_rbtree();
+  key_t *arr = calloc(n, sizeof(key_t));
+  node_t **nodes = calloc(n, sizeof(node_t *));
+  for (size_t i = 0; i < n; i++)
+  {
+    arr[i] = rand() % (int)n;
+    nodes[i] = rbtree_insert(t, arr[i]);
+  }
+  // erase every other node to exercise the erase path
+  size_t m = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    if (i % 2 == 0)
+    {
+      rbtree_erase(t, nodes[i]);
+    }
+    else
+    {
+      arr[m++] = nodes[i]->key;
+    }
+  }
+  test_augment_constraint(t);
+  test_color_constraint(t);
+  qsort(arr, m, sizeof(key_t), comp);
+  assert(t->root->size == m);
+
+  for (size_t k = 0; k < m; k++)
+  {
+    node_t *p = rbtree_select(t, k);
+    assert(p != NULL && p->key == arr[k]);
+  }
+  assert(rbtree_select(t, m) == NULL);
+
+  for (key_t key = -1; key <= (key_t)n; key++)
+  {
+    size_t less = 0, less_equal = 0;
+    for (size_t i = 0; i < m; i++)
+    {
+      less += arr[i] < key;
+      less_equal += arr[i] <= key;
+    }
+    assert(rbtree_rank(t, key) == less);
+    assert(rbtree_count_range(t, key, key) == less_equal - less);
+    assert(rbtree_count_range(t, -1, key) == less_equal);
+  }
+  assert(rbtree_count_range(t, 5, 4) == 0);
+
+  free(nodes);
+  free(arr);
+  delete_rbtree(t);
+}
+#endif
+
+#ifdef RBTREE_INTERVAL
+static int collect_node(node_t *p, void *arg)
+{
+  node_t **out = (node_t **)arg;
+  while (*out != NULL)
+    out++;
+  *out = p;
+  return 0;
+}
+
+// overlap queries should agree with a linear scan over all intervals
+void test_interval(const size_t n, const unsigned int seed)
+{
+  srand(seed);
+  rbtree *t = new_rbtree();
+  node_t **nodes = calloc(n, sizeof(node_t *));
+  for (size_t i = 0; i < n; i++)
+  {
+    key_t lo = rand() % 1000;
+    nodes[i] = rbtree_interval_insert(t, lo, lo + rand() % 50);
+    assert(nodes[i] != NULL);
+  }
+  assert(rbtree_interval_insert(t, 5, 4) == NULL);
+  for (size_t i = 0; i < n; i += 3)
+  {
+    rbtree_erase(t, nodes[i]);
+    nodes[i] = NULL;
+  }
+  test_color_constraint(t);
+  test_augment_constraint(t);
+
+  node_t **found = calloc(n + 1, sizeof(node_t *));
+  for (key_t lo = -10; lo < 1060; lo += 7)
+  {
+    const key_t hi = lo + rand() % 20;
+    size_t expected = 0;
+    node_t *first = NULL;
+    for (size_t i = 0; i < n; i++)
+    {
+      if (nodes[i] != NULL && nodes[i]->key <= hi && nodes[i]->hi >= lo)
+      {
+        expected++;
+        if (first == NULL || nodes[i]->key < first->key)
+          first = nodes[i];
+      }
+    }
+
+    node_t *p = rbtree_interval_overlap_first(t, lo, hi);
+    assert((p == NULL) == (first == NULL));
+    assert(p == NULL || (p->key == first->key && p->key <= hi && p->hi >= lo));
+
+    memset(found, 0, (n + 1) * sizeof(node_t *));
+    assert(rbtree_interval_overlap_all(t, lo, hi, collect_node, found) == expected);
+    for (size_t i = 0; i < expected; i++)
+    {
+      assert(found[i]->key <= hi && found[i]->hi >= lo);
+      assert(i == 0 || found[i - 1]->key <= found[i]->key);
+    }
+  }
+  assert(rbtree_interval_overlap_first(t, RBTREE_KEY_MIN, -1) == NULL);
+
+  free(found);
+  free(nodes);
+  delete_rbtree(t);
+}
+#endif
+
+#ifdef RBTREE_STATS
+// counters should track the work done, and the node count and height should match the tree
+void test_stats(const size_t n)
+{
+  rbtree *t = new_rbtree();
+  rbtree_stats st;
+  rbtree_get_stats(t, &st);
+  assert(st.nodes == 0 && st.height == 0);
+  assert(st.left_rotations == 0 && st.find_compares == 0);
+
+  // ascending inserts only ever rotate left
+  for (size_t i = 0; i < n; i++)
+  {
+    rbtree_insert(t, (key_t)i);
+  }
+  rbtree_get_stats(t, &st);
+  assert(st.nodes == n);
+  assert(st.left_rotations > 0 && st.right_rotations == 0);
+  assert(st.insert_fixup_loops > 0 && st.insert_compares > 0);
+  // red-black height bound: h <= 2 log2(n + 1)
+  size_t bound = 0;
+  while (((size_t)1 << bound) <= n)
+  {
+    bound++;
+  }
+  assert(st.height > 0 && st.height <= 2 * bound);
+
+  // a hit on the root compares exactly one node
+  rbtree_reset_stats(t);
+  assert(rbtree_find(t, t->root->key) == t->root);
+  rbtree_get_stats(t, &st);
+  assert(st.find_compares == 1 && st.insert_compares == 0);
+
+  for (size_t i = 0; i < n; i++)
+  {
+    rbtree_erase(t, rbtree_find(t, (key_t)i));
+  }
+  rbtree_get_stats(t, &st);
+  assert(st.nodes == 0 && st.height == 0);
+  assert(st.erase_fixup_loops > 0);
+
+#ifdef RBTREE_STATS_LATENCY
+  uint64_t samples[RBTREE_STAT_OPS] = {0};
+  for (int op = 0; op < RBTREE_STAT_OPS; op++)
+  {
+    for (int b = 0; b < RBTREE_STATS_BUCKETS; b++)
+    {
+      samples[op] += st.latency[op][b];
+    }
+  }
+  assert(samples[RBTREE_STAT_INSERT] == 0);
+  assert(samples[RBTREE_STAT_FIND] == n + 1);
+  assert(samples[RBTREE_STAT_ERASE] == n);
+#endif
+  delete_rbtree(t);
+}
+
+typedef struct
+{
+  const rbtree *t;
+  size_t n, rounds;
+} stats_reader;
+
+static void *stats_read(void *arg)
+{
+  const stats_reader *r = (const stats_reader *)arg;
+  for (size_t round = 0; round < r->rounds; round++)
+  {
+    for (size_t i = 0; i < r->n; i++)
+    {
+      assert(rbtree_find(r->t, (key_t)i) != NULL);
+    }
+  }
+  return NULL;
+}
+
+// lookups on a shared const tree from several threads should not lose counts
+void test_stats_shared(const size_t n, const int threads)
+{
+  rbtree *t = new_rbtree();
+  for (size_t i = 0; i < n; i++)
+  {
+    rbtree_insert(t, (key_t)i);
+  }
+  rbtree_reset_stats(t);
+  stats_reader one = {t, n, 1};
+  stats_read(&one);
+  rbtree_stats st;
+  rbtree_get_stats(t, &st);
+  const uint64_t per_round = st.find_compares;
+
+  rbtree_reset_stats(t);
+  stats_reader reader = {t, n, 20};
+  pthread_t tid[8];
+  for (int i = 0; i < threads; i++)
+  {
+    assert(pthread_create(&tid[i], NULL, stats_read, &reader) == 0);
+  }
+  for (int i = 0; i < threads; i++)
+  {
+    pthread_join(tid[i], NULL);
+  }
+  rbtree_get_stats(t, &st);
+  assert(st.find_compares == per_round * reader.rounds * (uint64_t)threads);
+#ifdef RBTREE_STATS_LATENCY
+  uint64_t samples = 0;
+  for (int b = 0; b < RBTREE_STATS_BUCKETS; b++)
+  {
+    samples += st.latency[RBTREE_STAT_FIND][b];
+  }
+  assert(samples == n * reader.rounds * (uint64_t)threads);
+#endif
+  delete_rbtree(t);
+}
+#endif
+
+// parent pointers should match the child links after subtrees are moved around
+static bool parent_traverse(const node_t *p, const node_t *nil)
+{
+  if (p == nil)
+  {
+    return true;
+  }
+  if ((p->left != nil && rbtree_parent(p->left) != p) ||
+      (p->right != nil && rbtree_parent(p->right) != p))
+  {
+    return false;
+  }
+  return parent_traverse(p->left, nil) && parent_traverse(p->right, nil);
+}
+
+// the tree should be valid and hold exactly the n sorted keys in expected
+static void check_keys(const rbtree *t, const key_t *expected, const size_t n)
+{
+  test_color_constraint(t);
+  test_augment_constraint(t);
+  test_search_constraint(t);
+  assert(t->root == t->nil || rbtree_parent(t->root) == t->nil);
+  assert(parent_traverse(t->root, t->nil));
+
+  key_t *res = calloc(n + 1, sizeof(key_t));
+  assert(rbtree_to_array(t, res, n) == 0);
+  assert(memcmp(res, expected, n * sizeof(key_t)) == 0);
+  free(res);
+
+  // the cached node count, when known, matches the tree (equal keys share a node in a multiset)
+  size_t nodes = n;
+#ifdef RBTREE_MULTISET
+  for (size_t i = 1; i < n; i++)
+  {
+    nodes -= expected[i] == expected[i - 1];
+  }
+#endif
+  assert(t->nodes == RBTREE_NODES_UNKNOWN || t->nodes == nodes);
+}
+
+// split at every position and join back, which covers every black-height difference
+void test_join_split(const size_t n)
+{
+  key_t *arr = calloc(n + 1, sizeof(key_t));
+  for (size_t i = 0; i < n; i++)
+  {
+    arr[i] = (key_t)(i * 2);
+  }
+
+  rbtree *t = rbtree_from_sorted_array(arr, n);
+  for (size_t cut = 0; cut <= n; cut += 1 + cut / 4)
+  {
+    rbtree *r = rbtree_split(t, (key_t)(cut * 2));
+    assert(r != NULL);
+    check_keys(t, arr, cut);
+    check_keys(r, arr + cut, n - cut);
+
+    // keys out of order are rejected and both trees are left alone
+    if (cut > 0 && cut < n)
+    {
+      assert(rbtree_join(t, (key_t)(cut * 2 + 1), r) == -1);
+      check_keys(r, arr + cut, n - cut);
+    }
+
+    assert(rbtree_join(t, (key_t)(cut * 2 - 1), r) == 0);
+    node_t *p = rbtree_find(t, (key_t)(cut * 2 - 1));
+    assert(p != NULL);
+    rbtree_erase(t, p);
+    check_keys(t, arr, n);
+  }
+
+  // a split-off tree shares node memory with the original, so either may go first
+  rbtree *r = rbtree_split(t, (key_t)n);
+  delete_rbtree(t);
+  for (size_t i = 0; i < n; i++)
+  {
+    rbtree_insert(r, (key_t)(i * 2 + 1));
+  }
+  test_color_constraint(r);
+  test_augment_constraint(r);
+
+  // trees built separately join into one that keeps allocating from both
+  rbtree *t1 = new_rbtree();
+  rbtree *t2 = new_rbtree();
+  const key_t base = -3 * (key_t)n;
+  for (size_t i = 0; i < n; i++)
+  {
+    rbtree_insert(t1, base + (key_t)i);
+    rbtree_insert(t2, base + (key_t)(n + 1 + i / 7));
+  }
+  assert(rbtree_join(t1, base + (key_t)n, t2) == 0);
+  assert(rbtree_join(t1, -1, r) == 0);
+  for (size_t i = 0; i < n; i++)
+  {
+    node_t *p = rbtree_find(t1, base + (key_t)i);
+    assert(p != NULL);
+    rbtree_erase(t1, p);
+    rbtree_insert(t1, base - 1 - (key_t)i);
+  }
+  test_color_constraint(t1);
+  test_augment_constraint(t1);
+  test_search_constraint(t1);
+  delete_rbtree(t1);
+  free(arr);
+}
+
+// union, intersection and difference should match the same operation on flags
+void test_set_ops(const size_t universe, const int pa, const int pb, const unsigned int seed)
+{
+  srand(seed);
+  bool *in_a = calloc(universe, sizeof(bool));
+  bool *in_b = calloc(universe, sizeof(bool));
+  key_t *b_keys = calloc(universe + 1, sizeof(key_t));
+  key_t *expected = calloc(2 * universe + 1, sizeof(key_t));
+
+  for (int kind = 0; kind < 3; kind++)
+  {
+    rbtree *t1 = new_rbtree();
+    size_t nb = 0;
+    for (size_t k = 0; k < universe; k++)
+    {
+      in_a[k] = rand() % 100 < pa;
+      in_b[k] = rand() % 100 < pb;
+      if (in_b[k])
+      {
+        b_keys[nb++] = (key_t)k;
+      }
+    }
+    // insert in a scattered order so t1 has a different shape than the bulk-built t2
+    for (size_t i = 0; i < universe; i++)
+    {
+      size_t k = (i * 7919) % universe;
+      if (in_a[k])
+      {
+        rbtree_insert(t1, (key_t)k);
+      }
+    }
+    rbtree *t2 = rbtree_from_sorted_array(b_keys, nb);
+
+    size_t n = 0;
+    for (size_t k = 0; k < universe; k++)
+    {
+      bool keep = kind == 0 ? in_a[k] || in_b[k] : kind == 1 ? in_a[k] && in_b[k] : in_a[k] && !in_b[k];
+      if (keep)
+      {
+        expected[n++] = (key_t)k;
+      }
+#ifdef RBTREE_MULTISET
+      // a multiset union adds the counts of keys in both trees
+      if (kind == 0 && in_a[k] && in_b[k])
+      {
+        expected[n++] = (key_t)k;
+      }
+#endif
+    }
+
+    int ret = kind == 0 ? rbtree_union(t1, t2) : kind == 1 ? rbtree_intersection(t1, t2) : rbtree_difference(t1, t2);
+    assert(ret == 0);
+    check_keys(t1, expected, n);
+
+    // dropped nodes go back to t1's pool
+    for (size_t k = 0; k < universe; k += 3)
+    {
+      rbtree_insert(t1, (key_t)(universe + k));
+    }
+    test_color_constraint(t1);
+    test_augment_constraint(t1);
+    delete_rbtree(t1);
+  }
+
+  rbtree *t = new_rbtree();
+  assert(rbtree_union(t, t) == -1);
+  assert(rbtree_union(t, NULL) == -1);
+  delete_rbtree(t);
+
+  free(expected);
+  free(b_keys);
+  free(in_b);
+  free(in_a);
+}
+
+// erase_range should remove every key in [lo, hi], duplicates included
+void test_erase_range(const size_t n)
+{
+  key_t *arr = calloc(n + 1, sizeof(key_t));
+  for (size_t i = 0; i < n; i++)
+  {
+    arr[i] = (key_t)(i / 2);
+  }
+  rbtree *t = rbtree_from_sorted_array(arr, n);
+
+  assert(rbtree_erase_range(t, 10, 5) == 0);
+  assert(rbtree_erase_range(t, 10, 19) == 20);
+  size_t m = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    if (arr[i] < 10 || arr[i] > 19)
+    {
+      arr[m++] = arr[i];
+    }
+  }
+  check_keys(t, arr, m);
+
+  assert(rbtree_erase_range(t, RBTREE_KEY_MIN, 3) == 8);
+  check_keys(t, arr + 8, m - 8);
+  assert(rbtree_erase_range(t, (key_t)(n / 4), RBTREE_KEY_MAX) == m - 8 - (n / 4 - 4 - 10) * 2);
+  check_keys(t, arr + 8, (n / 4 - 4 - 10) * 2);
+  assert(rbtree_erase_range(t, RBTREE_KEY_MIN, RBTREE_KEY_MAX) == (n / 4 - 14) * 2);
+  assert(t->root == t->nil);
+
+  free(arr);
+  delete_rbtree(t);
+}
+
+void test_join_suite()
+{
+  test_join_split(1);
+  test_join_split(300);
+  test_set_ops(1000, 50, 50, 19);
+  test_set_ops(200000, 40, 60, 23); // large enough to fork threads
+  test_set_ops(200000, 70, 1, 29);  // a small tree against a large one
+  test_set_ops(300, 0, 50, 31);     // an empty side
+  test_erase_range(1000);
+}
+
+// a saved image should open as a working tree without touching the file again
+void test_save_mmap(const size_t n, const unsigned int seed)
+{
+  srand(seed);
+  rbtree *t = new_rbtree();
+  key_t *arr = calloc(n + 1, sizeof(key_t));
+  for (size_t i = 0; i < n; i++)
+  {
+    arr[i] = rand() % (int)(n * 4);
+    rbtree_insert(t, arr[i]);
+  }
+  qsort(arr, n, sizeof(key_t), comp);
+
+  FILE *fp;
+  char path[] = "/tmp/test-rbtree-image-XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+  assert(rbtree_save(t, path) == 0);
+  delete_rbtree(t);
+
+  rbtree *m = rbtree_open_mmap(path);
+  assert(m != NULL);
+  check_keys(m, arr, n);
+  if (n > 0)
+  {
+    assert(rbtree_min(m)->key == arr[0]);
+    assert(rbtree_max(m)->key == arr[n - 1]);
+    assert(rbtree_find(m, arr[n / 2]) != NULL);
+  }
+
+  // the same image can be open more than once, at different addresses
+  rbtree *m2 = rbtree_open_mmap(path);
+  assert(m2 != NULL);
+  assert(m2->nil != m->nil);
+  check_keys(m2, arr, n);
+
+  // changes stay in memory and share the image's own sentinel
+  for (size_t i = 0; i < n; i += 2)
+  {
+    node_t *p = rbtree_find(m, arr[i]);
+    assert(p != NULL);
+    rbtree_erase(m, p);
+    rbtree_insert(m, -1 - (key_t)i);
+  }
+  test_color_constraint(m);
+  test_augment_constraint(m);
+  test_search_constraint(m);
+  rbtree *r = rbtree_split(m, 0);
+  assert(r != NULL);
+  assert(rbtree_join(m, 0, r) == 0);
+  rbtree *other = new_rbtree();
+  assert(rbtree_union(m, other) == -1);
+  delete_rbtree(other);
+  delete_rbtree(m);
+
+  rbtree *m3 = rbtree_open_mmap(path);
+  assert(m3 != NULL);
+  check_keys(m3, arr, n);
+  delete_rbtree(m3);
+  check_keys(m2, arr, n);
+  delete_rbtree(m2);
+
+  // a link pointing outside the image, or back up the tree, is caught when opening
+  if (n > 1)
+  {
+    const long nodes_at = 64 + (long)sizeof(node_t); // header, then the nil, then the root
+    const long link_at = nodes_at + (long)offsetof(node_t, left);
+    node_t *bad[] = {(node_t *)(uintptr_t)((n + 1) * sizeof(node_t)), (node_t *)(uintptr_t)1,
+                     (node_t *)(uintptr_t)sizeof(node_t)}; // past the end, inside a node, the root itself
+    for (int k = 0; k < 3; k++)
+    {
+      fp = fopen(path, "r+b");
+      node_t *saved;
+      assert(fseek(fp, link_at, SEEK_SET) == 0 && fread(&saved, sizeof(saved), 1, fp) == 1);
+      assert(fseek(fp, link_at, SEEK_SET) == 0 && fwrite(&bad[k], sizeof(bad[k]), 1, fp) == 1);
+      fclose(fp);
+      assert(rbtree_open_mmap(path) == NULL);
+
+      fp = fopen(path, "r+b");
+      assert(fseek(fp, link_at, SEEK_SET) == 0 && fwrite(&saved, sizeof(saved), 1, fp) == 1);
+      fclose(fp);
+    }
+    rbtree *v = rbtree_open_mmap(path);
+    assert(v != NULL);
+    check_keys(v, arr, n);
+    delete_rbtree(v);
+  }
+
+  // a header whose fields do not match its checksum is rejected
+  {
+    const long count_at = 16; // magic, node_size and layout come first
+    fp = fopen(path, "r+b");
+    uint64_t count;
+    assert(fseek(fp, count_at, SEEK_SET) == 0 && fread(&count, sizeof(count), 1, fp) == 1);
+    const uint64_t fewer = count - 1;
+    assert(fseek(fp, count_at, SEEK_SET) == 0 && fwrite(&fewer, sizeof(fewer), 1, fp) == 1);
+    fclose(fp);
+    assert(rbtree_open_mmap(path) == NULL);
+    fp = fopen(path, "r+b");
+    assert(fseek(fp, count_at, SEEK_SET) == 0 && fwrite(&count, sizeof(count), 1, fp) == 1);
+    fclose(fp);
+    rbtree *v = rbtree_open_mmap(path);
+    assert(v != NULL);
+    delete_rbtree(v);
+  }
+
+  // anything but a saved image is rejected
+  fp = fopen(path, "wb");
+  fputs("not an image", fp);
+  fclose(fp);
+  assert(rbtree_open_mmap(path) == NULL);
+  remove(path);
+  assert(rbtree_open_mmap(path) == NULL);
+  free(arr);
+}
+
+// find_batch should give the same answers as rbtree_find for each key
+void test_find_batch(const size_t n, const size_t m, const unsigned int seed)
+{
+  srand(seed);
+  rbtree *t = new_rbtree();
+  for (size_t i = 0; i < n; i++)
+  {
+    rbtree_insert(t, rand() % (int)(2 * n + 1));
+  }
+
+  key_t *keys = calloc(m + 1, sizeof(key_t));
+  node_t **out = calloc(m + 1, sizeof(node_t *));
+  size_t expected = 0;
+  for (size_t i = 0; i < m; i++)
+  {
+    keys[i] = rand() % (int)(2 * n + 1);
+    out[i] = (node_t *)keys; // every slot must be overwritten
+    expected += rbtree_find(t, keys[i]) != NULL;
+  }
+
+  assert(rbtree_find_batch(t, keys, out, m) == expected);
+  for (size_t i = 0; i < m; i++)
+  {
+    assert(out[i] == rbtree_find(t, keys[i]));
+  }
+
+  free(out);
+  free(keys);
+  delete_rbtree(t);
+}
+
+// hinted inserts should land where rbtree_insert would, whether or not the hint is adjacent
+void test_insert_hint(const size_t n, const unsigned int seed)
+{
+  // monotone streams with the previous node as the hint
+  rbtree *up = new_rbtree();
+  rbtree *down = new_rbtree();
+  node_t *hint_up = NULL, *hint_down = NULL;
+#ifdef RBTREE_STATS
+  rbtree_reset_stats(up);
+#endif
+  for (size_t i = 0; i < n; i++)
+  {
+    hint_up = rbtree_insert_hint(up, hint_up, (key_t)i);
+    hint_down = rbtree_insert_hint(down, hint_down, (key_t)(n - 1 - i));
+    assert(hint_up->key == (key_t)i && hint_down->key == (key_t)(n - 1 - i));
+  }
+#ifdef RBTREE_STATS
+  // each append after the first compares only against its hint
+  rbtree_stats st;
+  rbtree_get_stats(up, &st);
+  assert(st.insert_compares == (n > 0 ? n - 1 : 0));
+#endif
+  key_t *arr = calloc(n + 1, sizeof(key_t));
+  for (size_t i = 0; i < n; i++)
+  {
+    arr[i] = (key_t)i;
+  }
+  check_keys(up, arr, n);
+  check_keys(down, arr, n);
+  delete_rbtree(down);
+  delete_rbtree(up);
+
+  // random keys with duplicates against random hints, checked against plain inserts
+  srand(seed);
+  rbtree *t = new_rbtree();
+  rbtree *ref = new_rbtree();
+  const key_t range = (key_t)(n / 4 + 1);
+  for (size_t i = 0; i < n; i++)
+  {
+    key_t key = rand() % range;
+    node_t *hint = NULL;
+    switch (rand() % 4)
+    {
+    case 0:
+      hint = rbtree_find(t, rand() % range);
+      break;
+    case 1:
+      hint = rbtree_find(t, key - 1);
+      break;
+    case 2:
+      hint = rbtree_max(t);
+      break;
+    }
+    node_t *p = rbtree_insert_hint(t, hint, key);
+    rbtree_insert(ref, key);
+    assert(p != NULL && p->key == key);
+    // a duplicate goes after every node with the same key
+    node_t *next = rbtree_next(t, p);
+    assert(next == NULL || next->key > key);
+  }
+  test_color_constraint(t);
+  test_augment_constraint(t);
+  key_t *expected = calloc(n + 1, sizeof(key_t));
+  assert(rbtree_to_array(ref, expected, n) == 0);
+  check_keys(t, expected, n);
+
+  free(expected);
+  free(arr);
+  delete_rbtree(ref);
+  delete_rbtree(t);
+}
+
+// the tree as a double-ended priority queue and as a timer queue, checked against sorted keys
+void test_pop(const size_t n, const unsigned int seed)
+{
+  srand(seed);
+  rbtree *t = new_rbtree();
+  key_t key;
+  assert(rbtree_pop_min(t, &key) == 0 && rbtree_pop_max(t, NULL) == 0);
+  assert(rbtree_min(t) == t->nil && rbtree_max(t) == t->nil);
+
+  key_t *arr = calloc(n + 1, sizeof(key_t));
+  for (size_t i = 0; i < n; i++)
+  {
+    arr[i] = rand() % (key_t)(n / 2 + 1);
+    rbtree_insert(t, arr[i]);
+  }
+  qsort(arr, n, sizeof(key_t), comp);
+
+  size_t lo = 0, hi = n;
+  while (lo < hi)
+  {
+    if (rand() % 2)
+    {
+      assert(rbtree_pop_min(t, &key) == 1 && key == arr[lo++]);
+    }
+    else
+    {
+      assert(rbtree_pop_max(t, &key) == 1 && key == arr[--hi]);
+    }
+    if (lo < hi)
+    {
+      assert(rbtree_min(t)->key == arr[lo] && rbtree_max(t)->key == arr[hi - 1]);
+    }
+    if ((hi - lo) % 512 == 0)
+    {
+      test_color_constraint(t);
+      test_search_constraint(t);
+    }
+  }
+  assert(t->root == t->nil && rbtree_pop_min(t, &key) == 0);
+
+  // expire the earliest deadline and re-arm it later, as a poll loop would
+  for (size_t i = 0; i < n; i++)
+  {
+    rbtree_insert(t, rand() % 1000);
+  }
+  key_t now = RBTREE_KEY_MIN;
+  for (size_t i = 0; i < 4 * n; i++)
+  {
+    assert(rbtree_pop_min(t, &key) == 1 && key >= now);
+    now = key;
+    rbtree_insert_hint(t, rbtree_max(t), key + 1 + rand() % 1000);
+  }
+  test_color_constraint(t);
+  test_augment_constraint(t);
+  test_search_constraint(t);
+
+  free(arr);
+  delete_rbtree(t);
+}
+
+// counts every byte handed out so the test can see what a tree still holds
+typedef struct
+{
+  size_t allocs, frees, live_bytes;
+  size_t fail_after; // allocations left before every request fails
+} counting_ctx;
+
+static void *counting_alloc(void *ctx, size_t size)
+{
+  counting_ctx *c = (counting_ctx *)ctx;
+  if (c->fail_after == 0)
+  {
+    return NULL;
+  }
+  c->fail_after--;
+  c->allocs++;
+  c->live_bytes += size;
+  return malloc(size);
+}
+
+static void counting_free(void *ctx, void *ptr, size_t size)
+{
+  counting_ctx *c = (counting_ctx *)ctx;
+  c->frees++;
+  c->live_bytes -= size;
+  free(ptr);
+}
+
+// trees built on a custom allocator should return all of it and report allocation failures
+void test_allocator(const size_t n)
+{
+  counting_ctx ctx = {0, 0, 0, SIZE_MAX};
+  const rbtree_allocator counting = {counting_alloc, counting_free, &ctx};
+
+  rbtree *t = new_rbtree_ex(&counting);
+  assert(t != NULL && ctx.allocs == 2); // the tree and its arena
+  for (size_t i = 0; i < n; i++)
+  {
+    assert(rbtree_insert(t, (key_t)i) != NULL);
+  }
+  assert(ctx.allocs > 2);
+
+  // split trees share the allocator, and joining them back needs no new memory beyond the middle node
+  rbtree *r = rbtree_split(t, (key_t)(n / 2));
+  assert(r != NULL);
+  assert(rbtree_join(t, (key_t)(n / 2), r) == 0);
+
+  // trees on different allocators cannot be joined
+  rbtree *other = new_rbtree();
+  rbtree_insert(other, (key_t)(2 * n));
+  assert(rbtree_join(t, (key_t)(2 * n), other) == -1);
+  assert(rbtree_union(t, other) == -1);
+  delete_rbtree(other);
+
+  // once the current chunk runs out, an allocation failure leaves the tree as it was
+  ctx.fail_after = 0;
+  key_t key = (key_t)n;
+  while (rbtree_insert(t, key) != NULL)
+  {
+    key++;
+  }
+  assert(rbtree_find(t, key) == NULL);
+  test_color_constraint(t);
+  test_search_constraint(t);
+  ctx.fail_after = SIZE_MAX;
+
+  delete_rbtree(t);
+  assert(ctx.allocs == ctx.frees && ctx.live_bytes == 0);
+
+  ctx.fail_after = 1;
+  assert(new_rbtree_ex(&counting) == NULL); // the arena cannot be allocated
+  assert(ctx.allocs == ctx.frees && ctx.live_bytes == 0);
+
+  // the NUMA allocator falls back to plain pages where there is no NUMA support
+  const rbtree_allocator numa = rbtree_numa_allocator(-1);
+  rbtree *local = new_rbtree_ex(&numa);
+  assert(local != NULL);
+  for (size_t i = 0; i < n; i++)
+  {
+    assert(rbtree_insert(local, (key_t)(i * 7 % (n + 1))) != NULL);
+  }
+  test_color_constraint(local);
+  test_search_constraint(local);
+  delete_rbtree(local);
+}
+
+// clearing keeps every node for the next fill, whether or not the chunks are shared
+void test_clear(const size_t n)
+{
+  counting_ctx ctx = {0, 0, 0, SIZE_MAX};
+  const rbtree_allocator counting = {counting_alloc, counting_free, &ctx};
+  key_t *arr = calloc(n + 1, sizeof(key_t));
+  for (size_t i = 0; i < n; i++)
+  {
+    arr[i] = (key_t)i;
+  }
+
+  rbtree *t = new_rbtree_ex(&counting);
+  rbtree_clear(t);
+  assert(t->root == t->nil && rbtree_min(t) == t->nil);
+  for (int round = 0; round < 3; round++)
+  {
+    for (size_t i = 0; i < n; i++)
+    {
+      assert(rbtree_insert(t, (key_t)((i * 7919) % n)) != NULL);
+    }
+    check_keys(t, arr, n);
+    rbtree_clear(t);
+    assert(t->root == t->nil && rbtree_min(t) == t->nil && rbtree_max(t) == t->nil);
+    check_keys(t, arr, 0);
+    // later rounds fit in the chunks of the first one
+    ctx.fail_after = 0;
+  }
+  ctx.fail_after = SIZE_MAX;
+
+  // after a split the halves share chunks, so only the cleared half's nodes are reused
+  for (size_t i = 0; i < n; i++)
+  {
+    rbtree_insert(t, (key_t)i);
+  }
+  rbtree *r = rbtree_split(t, (key_t)(n / 2));
+  rbtree_clear(t);
+  ctx.fail_after = 0;
+  for (size_t i = 0; i < n / 2; i++)
+  {
+    assert(rbtree_insert(t, (key_t)i) != NULL);
+  }
+  ctx.fail_after = SIZE_MAX;
+  check_keys(t, arr, n / 2);
+  check_keys(r, arr + n / 2, n - n / 2);
+  rbtree_clear(r);
+  check_keys(r, arr, 0);
+  delete_rbtree(r);
+
+  // a joined tree owns its merged chunks again and can rewind them
+  rbtree *u = new_rbtree_ex(&counting);
+  for (size_t i = 0; i < n; i++)
+  {
+    rbtree_insert(u, (key_t)(n + i));
+  }
+  assert(rbtree_join(t, (key_t)n, u) == 0);
+  rbtree_clear(t);
+  ctx.fail_after = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    assert(rbtree_insert(t, (key_t)i) != NULL);
+  }
+  ctx.fail_after = SIZE_MAX;
+  check_keys(t, arr, n);
+
+  delete_rbtree(t);
+  assert(ctx.allocs == ctx.frees && ctx.live_bytes == 0);
+  free(arr);
+}
+
+#ifdef RBTREE_MULTISET
+// a multiset tree should keep one node per distinct key and expand counts on export
+void test_multiset(const size_t n, const int distinct, const unsigned int seed)
+{
+  srand(seed);
+  rbtree *t = new_rbtree();
+  size_t *counts = calloc(distinct, sizeof(size_t));
+  node_t **nodes = calloc(distinct, sizeof(node_t *));
+  for (size_t i = 0; i < n; i++)
+  {
+    // skewed keys: half of the inserts hit key 0
+    key_t key = rand() % 2 ? 0 : rand() % distinct;
+    node_t *p = rbtree_insert(t, key);
+    assert(p != NULL && p->key == key);
+    assert(nodes[key] == NULL || nodes[key] == p); // repeated keys reuse the node
+    nodes[key] = p;
+    assert(p->count == ++counts[key]);
+  }
+  test_color_constraint(t);
+  test_augment_constraint(t);
+  test_search_constraint(t);
+
+  size_t n_nodes = 0;
+  for (node_t *p = rbtree_min(t); p != NULL; p = rbtree_next(t, p))
+  {
+    n_nodes++;
+  }
+  assert(n_nodes <= (size_t)distinct);
+
+  // erase takes one copy at a time and drops the node at zero
+  for (key_t key = 0; key < distinct; key += 3)
+  {
+    while (counts[key] > 0)
+    {
+      node_t *p = rbtree_find(t, key);
+      assert(p != NULL && p->count == counts[key]);
+      rbtree_erase(t, p);
+      counts[key]--;
+    }
+    assert(rbtree_find(t, key) == NULL);
+  }
+
+  // a batch of repeated inserts and erases lands on the same counts
+  op_t *ops = calloc(n, sizeof(op_t));
+  for (size_t i = 0; i < n; i++)
+  {
+    ops[i].kind = rand() % 3 ? RBTREE_OP_INSERT : RBTREE_OP_ERASE;
+    ops[i].key = rand() % distinct;
+    if (ops[i].kind == RBTREE_OP_INSERT)
+    {
+      counts[ops[i].key]++;
+    }
+    else if (counts[ops[i].key] > 0)
+    {
+      counts[ops[i].key]--;
+    }
+  }
+  assert(rbtree_apply_batch(t, ops, n) == 0);
+
+  size_t total = 0;
+  for (key_t key = 0; key < distinct; key++)
+  {
+    total += counts[key];
+  }
+  key_t *expected = calloc(total + 1, sizeof(key_t));
+  size_t at = 0;
+  for (key_t key = 0; key < distinct; key++)
+  {
+    for (size_t c = 0; c < counts[key]; c++)
+    {
+      expected[at++] = key;
+    }
+  }
+  check_keys(t, expected, total);
+
+  // a bulk build collapses runs of the same key
+  rbtree *bulk = rbtree_from_array(expected, total);
+  check_keys(bulk, expected, total);
+  for (node_t *p = rbtree_min(bulk); p != NULL; p = rbtree_next(bulk, p))
+  {
+    assert(p->count == counts[p->key]);
+  }
+
+  // joining on a key that ends both trees merges the copies into one node
+  rbtree *rest = rbtree_split(bulk, 1);
+  rbtree *zeros = rbtree_from_sorted_array(expected, counts[0]);
+  assert(rbtree_join(bulk, 0, zeros) == 0);
+  assert(rbtree_join(bulk, 0, rest) == 0);
+  node_t *zero = rbtree_find(bulk, 0);
+  assert(zero != NULL && zero->count == 2 * counts[0] + 2);
+  test_color_constraint(bulk);
+  test_augment_constraint(bulk);
+  delete_rbtree(bulk);
+
+  free(expected);
+  free(ops);
+  free(nodes);
+  free(counts);
+  delete_rbtree(t);
+}
+#endif
+
+int main(void)
+{
+  test_init();
+  test_insert_single(1024);
+  test_find_single(512, 1024);
+  test_erase_root(128);
+  test_find_erase_fixed();
+  test_minmax_suite();
+  test_to_array_suite();
+  test_distinct_values();
+  test_duplicate_values();
+  test_multi_instance();
+  test_find_erase_rand(10000, 17);
+  test_capacity_and_reuse(1000);
+  test_bulk_suite();
+  test_apply_batch_suite();
+  test_find_batch(0, 10, 43);
+  test_find_batch(1000, 5, 47);
+  test_find_batch(10000, 20000, 53);
+  test_insert_hint(0, 67);
+  test_insert_hint(5000, 71);
+  test_pop(0, 73);
+  test_pop(5000, 79);
+  test_allocator(5000);
+  test_clear(0);
+  test_clear(5000);
+  test_join_suite();
+  test_save_mmap(0, 37);
+  test_save_mmap(5000, 41);
+  test_ordered_access(1000, 5);
+  test_export_chunks(1000, 7);
+  test_export_chunks(1, 7);
+#ifdef RBTREE_COMPACT
+  test_compact_layout();
+#endif
+#ifdef RBTREE_ORDER_STATS
+  test_order_stats(1000, 9);
+#endif
+#ifdef RBTREE_INTERVAL
+  test_interval(2000, 13);
+#endif
+#ifdef RBTREE_STATS
+  test_stats(1000);
+  test_stats_shared(2000, 4);
+#endif
+#ifdef RBTREE_MULTISET
+  test_multiset(20000, 100, 59);
+  test_multiset(300, 1000, 61);
+#endif
   printf("Passed all tests!\n");
 }
\ No newline at end of file
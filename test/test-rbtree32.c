@@ -0,0 +1,129 @@
+#include <assert.h>
+#include <rbtree32.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static int comp(const void *p1, const void *p2)
+{
+  const key_t *e1 = (const key_t *)p1;
+  const key_t *e2 = (const key_t *)p2;
+  return (*e1 > *e2) - (*e1 < *e2);
+}
+
+// index nodes should be 16 bytes, and a new tree should have only nil
+void test_init(void)
+{
+  assert(sizeof(node32_t) == 16);
+
+  rbtree32 *t = new_rbtree32();
+  assert(t != NULL);
+  assert(t->root == RBTREE32_NIL);
+  assert(rbtree32_color(t, RBTREE32_NIL) == RBTREE_BLACK);
+  assert(rbtree32_find(t, 1) == RBTREE32_NIL);
+  delete_rbtree32(t);
+}
+
+// returns black height, or -1 when a constraint is broken
+static int check_subtree(const rbtree32 *t, rbtree32_idx i, key_t *min, key_t *max)
+{
+  if (i == RBTREE32_NIL)
+  {
+    return 0;
+  }
+
+  const node32_t *p = rbtree32_node(t, i);
+  key_t l_min = p->key, l_max = p->key, r_min = p->key, r_max = p->key;
+  if (p->left != RBTREE32_NIL && rbtree32_parent(t, p->left) != i)
+  {
+    return -1;
+  }
+  if (p->right != RBTREE32_NIL && rbtree32_parent(t, p->right) != i)
+  {
+    return -1;
+  }
+  if (rbtree32_color(t, i) == RBTREE_RED &&
+      (rbtree32_color(t, p->left) == RBTREE_RED || rbtree32_color(t, p->right) == RBTREE_RED))
+  {
+    return -1;
+  }
+
+  int lh = check_subtree(t, p->left, &l_min, &l_max);
+  int rh = check_subtree(t, p->right, &r_min, &r_max);
+  if (lh < 0 || rh < 0 || lh != rh || l_max > p->key || r_min < p->key)
+  {
+    return -1;
+  }
+
+  *min = l_min;
+  *max = r_max;
+  return lh + (rbtree32_color(t, i) == RBTREE_BLACK ? 1 : 0);
+}
+
+static void test_constraints(const rbtree32 *t)
+{
+  key_t min, max;
+  assert(rbtree32_color(t, t->root) == RBTREE_BLACK);
+  assert(check_subtree(t, t->root, &min, &max) >= 0);
+}
+
+// insert, find, erase and to_array should behave like the pointer tree
+void test_find_erase_rand(const size_t n, const unsigned int seed)
+{
+  srand(seed);
+  rbtree32 *t = new_rbtree32();
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (size_t i = 0; i < n; i++)
+  {
+    arr[i] = rand() % (int)n;
+    assert(rbtree32_insert(t, arr[i]) != RBTREE32_NIL);
+  }
+  test_constraints(t);
+
+  key_t *res = calloc(n, sizeof(key_t));
+  assert(rbtree32_to_array(t, res, n) == 0);
+  qsort(arr, n, sizeof(key_t), comp);
+  for (size_t i = 0; i < n; i++)
+  {
+    assert(arr[i] == res[i]);
+  }
+  assert(rbtree32_key(t, rbtree32_min(t)) == arr[0]);
+  assert(rbtree32_key(t, rbtree32_max(t)) == arr[n - 1]);
+
+  for (size_t i = 0; i < n; i += 2)
+  {
+    rbtree32_idx p = rbtree32_find(t, arr[i]);
+    assert(p != RBTREE32_NIL);
+    assert(rbtree32_key(t, p) == arr[i]);
+    rbtree32_erase(t, p);
+  }
+  test_constraints(t);
+
+  // erased slots should be reused before the array grows
+  rbtree32_idx used = t->used;
+  for (size_t i = 0; i < n; i += 2)
+  {
+    rbtree32_insert(t, arr[i]);
+  }
+  assert(t->used == used);
+  test_constraints(t);
+
+  for (size_t i = 0; i < n; i++)
+  {
+    rbtree32_idx p = rbtree32_find(t, arr[i]);
+    assert(p != RBTREE32_NIL);
+    rbtree32_erase(t, p);
+  }
+  assert(t->root == RBTREE32_NIL);
+
+  free(res);
+  free(arr);
+  delete_rbtree32(t);
+}
+
+int main(void)
+{
+  test_init();
+  test_find_erase_rand(10000, 17);
+  printf("Passed all tests!\n");
+}